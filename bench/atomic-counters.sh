@@ -0,0 +1,17 @@
+#!/bin/sh
+# compare the uninstrumented kernel with plain and atomic edge counters,
+# both also kept in registers in the loops by -promote-profile-counters.
+# run from the bench build directory:  ./atomic-counters.sh [iterations]
+ITER=${1:-20000000}
+OUT=$(mktemp -d)
+for T in 1 2 4 8; do
+   echo "== $T threads"
+   printf "  none   : "; ./edge-kernel $T $ITER
+   printf "  plain  : "; LLVMPROF_OUTPUT=$OUT/plain ./edge-kernel-plain $T $ITER
+   printf "  atomic : "; LLVMPROF_OUTPUT=$OUT/atomic ./edge-kernel-atomic $T $ITER
+   printf "  plain, promoted  : "
+   LLVMPROF_OUTPUT=$OUT/promoted ./edge-kernel-promoted $T $ITER
+   printf "  atomic, promoted : "
+   LLVMPROF_OUTPUT=$OUT/atomic-promoted ./edge-kernel-atomic-promoted $T $ITER
+done
+echo "profiles left in $OUT, compare them with llvm-prof edge-kernel-plain.bc"
@@ -0,0 +1,44 @@
+/*
+ * feed the basic block tracing runtime a trace shaped like a loop nest: an
+ * outer loop over a few hundred functions whose inner loops run a handful
+ * of blocks many times.  reports the time the program spent tracing, which
+ * includes waiting for the trace to be written.  run it again with
+ * LLVMPROF_TRACE_RAW=1 to compare time and profile size with raw packets.
+ *
+ * usage: bb-trace [blocks]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int llvm_start_basic_block_tracing(int argc, const char** argv,
+                                   unsigned* arrayStart, unsigned numElements);
+void llvm_trace_basic_block(unsigned BBNum);
+
+int main(int argc, const char** argv)
+{
+   long Blocks = argc > 1 ? atol(argv[1]) : 500000000;
+   struct timespec Begin, End;
+   unsigned x = 12345;
+   long i = 0;
+
+   llvm_start_basic_block_tracing(argc, argv, NULL, 0);
+
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   while (i < Blocks) {
+      /* a function of 2..33 blocks whose loop body runs 1..64 times */
+      unsigned Function = (x = x * 1103515245 + 12345) >> 16 & 255;
+      unsigned First = Function * 40, Body = 2 + (x >> 8 & 31), Trips = 1 + (x & 63);
+      unsigned t, b;
+      llvm_trace_basic_block(First);
+      for (t = 0; t < Trips && i < Blocks; ++t)
+         for (b = 1; b < Body && i < Blocks; ++b, ++i)
+            llvm_trace_basic_block(First + b);
+      llvm_trace_basic_block(First + Body);
+      i += 2;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &End);
+   printf("trace  : %.3f s\n",
+          (End.tv_sec - Begin.tv_sec) + (End.tv_nsec - Begin.tv_nsec) * 1e-9);
+   return 0;
+}
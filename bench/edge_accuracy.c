@@ -0,0 +1,147 @@
+/*
+ * compare the edge counts of a -insert-edge-profiling-sampled profile with
+ * the exact profile of the same program: the error of the scaled counts,
+ * weighted by the exact ones, and how many of the hottest exact edges are
+ * among the hottest sampled ones.
+ *
+ * usage: edge-accuracy <exact profile> <sampled profile> [hot edges]
+ */
+#include "ProfileDataTypes.h"
+#include "ProfileVarint.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint64_t* SortCounts;
+
+/* loadSparse - decode the rest of an EdgeInfo64Sparse packet of N counters
+ * into Counts, which is zero.
+ */
+static int loadSparse(FILE* F, uint64_t* Counts, uint64_t N)
+{
+   uint64_t Bytes, Next = 0, Skip, Count;
+   unsigned char* Encoded;
+   const unsigned char* In;
+   int Ok = 1;
+   if (fread(&Bytes, sizeof(Bytes), 1, F) != 1) return 0;
+   Encoded = malloc(((Bytes + 3) & ~3ull) + 1);
+   if (fread(Encoded, 1, (Bytes + 3) & ~3ull, F) != ((Bytes + 3) & ~3ull))
+      Ok = 0;
+   for (In = Encoded; Ok && In != Encoded + Bytes;) {
+      Ok = profile_varint_get(&In, Encoded + Bytes, &Skip) &&
+           profile_varint_get(&In, Encoded + Bytes, &Count) &&
+           Skip < N - Next;
+      if (Ok) {
+         Next += Skip;
+         Counts[Next++] = Count;
+      }
+   }
+   free(Encoded);
+   return Ok;
+}
+
+/* load - add up the EdgeInfo64, EdgeInfo64Sparse and SampledEdgeInfo64
+ * packets of Name, the sampled ones scaled like the loader does.
+ */
+static uint64_t* load(const char* Name, uint64_t* Size)
+{
+   FILE* F = fopen(Name, "rb");
+   uint64_t* Counts = NULL;
+   unsigned Type;
+   *Size = 0;
+   if (!F) {
+      perror(Name);
+      exit(1);
+   }
+   while (fread(&Type, sizeof(Type), 1, F) == 1) {
+      unsigned Length;
+      uint64_t N, i, Scale = 1, Burst = 1, *Packet;
+      if (Type == ArgumentInfo) {
+         if (fread(&Length, sizeof(Length), 1, F) != 1) break;
+         fseek(F, (Length + 3) & ~3u, SEEK_CUR);
+         continue;
+      }
+      if (Type != EdgeInfo64 && Type != EdgeInfo64Sparse &&
+          Type != SampledEdgeInfo64) {
+         fprintf(stderr, "%s: packet type %u is not edge counts\n", Name, Type);
+         exit(1);
+      }
+      if (fread(&N, sizeof(N), 1, F) != 1) break;
+      Packet = calloc(N + 1, sizeof(uint64_t));
+      if (Type == EdgeInfo64Sparse ? !loadSparse(F, Packet, N) :
+          fread(Packet, sizeof(uint64_t), N, F) != N) {
+         fprintf(stderr, "%s: packet truncated\n", Name);
+         exit(1);
+      }
+      if (Type == SampledEdgeInfo64) {
+         Burst = Packet[--N];
+         Scale = Packet[--N];
+      }
+      if (N > *Size) {
+         Counts = realloc(Counts, N * sizeof(uint64_t));
+         for (i = *Size; i < N; ++i) Counts[i] = 0;
+         *Size = N;
+      }
+      for (i = 0; i < N; ++i)
+         Counts[i] += (Packet[i] * Scale + Burst / 2) / Burst;
+      free(Packet);
+   }
+   fclose(F);
+   return Counts;
+}
+
+static int hotter(const void* A, const void* B)
+{
+   uint64_t a = SortCounts[*(const uint64_t*)A];
+   uint64_t b = SortCounts[*(const uint64_t*)B];
+   return a < b ? 1 : a > b ? -1 : 0;
+}
+
+/* hottest - the indices of Counts, hottest first */
+static uint64_t* hottest(uint64_t* Counts, uint64_t Size)
+{
+   uint64_t* Order = malloc(Size * sizeof(uint64_t) + 1);
+   uint64_t i;
+   for (i = 0; i < Size; ++i) Order[i] = i;
+   SortCounts = Counts;
+   qsort(Order, Size, sizeof(uint64_t), hotter);
+   return Order;
+}
+
+int main(int argc, char** argv)
+{
+   uint64_t ExactSize, SampledSize, i, j, Hot, Found = 0;
+   uint64_t *Exact, *Sampled, *ExactOrder, *SampledOrder;
+   double Total = 0, Error = 0;
+
+   if (argc < 3) {
+      fprintf(stderr, "usage: %s <exact profile> <sampled profile> [hot edges]\n",
+              argv[0]);
+      return 1;
+   }
+   Exact = load(argv[1], &ExactSize);
+   Sampled = load(argv[2], &SampledSize);
+   if (ExactSize != SampledSize) {
+      fprintf(stderr, "the profiles have %llu and %llu edges\n",
+              (unsigned long long)ExactSize, (unsigned long long)SampledSize);
+      return 1;
+   }
+   Hot = argc > 3 ? strtoull(argv[3], NULL, 10) : 10;
+   if (Hot > ExactSize) Hot = ExactSize;
+
+   for (i = 0; i < ExactSize; ++i) {
+      Total += Exact[i];
+      Error += Exact[i] > Sampled[i] ? Exact[i] - Sampled[i]
+                                     : Sampled[i] - Exact[i];
+   }
+   ExactOrder = hottest(Exact, ExactSize);
+   SampledOrder = hottest(Sampled, SampledSize);
+   for (i = 0; i < Hot; ++i)
+      for (j = 0; j < Hot; ++j)
+         if (ExactOrder[i] == SampledOrder[j]) ++Found;
+
+   printf("%llu edges, weighted error %.2f%%, %llu of the %llu hottest found\n",
+          (unsigned long long)ExactSize, Total ? 100 * Error / Total : 0.0,
+          (unsigned long long)Found, (unsigned long long)Hot);
+   return 0;
+}
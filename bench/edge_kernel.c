@@ -0,0 +1,57 @@
+/*
+ * a branchy multithreaded kernel used to measure counter instrumentation
+ * overhead: every thread runs the same loop nest, so all of them hammer the
+ * same counters.
+ *
+ * usage: edge-kernel [threads] [iterations]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static long Iterations = 20000000;
+static volatile unsigned long Sink;
+
+static void* kernel(void* arg)
+{
+   unsigned long x = (unsigned long)arg + 1, acc = 0;
+   long i;
+   for (i = 0; i < Iterations; ++i) {
+      if (x & 1)
+         x = 3 * x + 1;
+      else
+         x >>= 1;
+      if (x % 3 == 0)
+         acc += x;
+      else if (x % 5 == 0)
+         acc ^= x;
+      if (x <= 1) x = i + 7;
+   }
+   Sink += acc;
+   return NULL;
+}
+
+int main(int argc, char** argv)
+{
+   int NumThreads = argc > 1 ? atoi(argv[1]) : 4;
+   pthread_t* Threads;
+   struct timespec Begin, End;
+   int i;
+
+   if (argc > 2) Iterations = atol(argv[2]);
+   if (NumThreads < 1) NumThreads = 1;
+   Threads = malloc(sizeof(pthread_t) * NumThreads);
+
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   for (i = 0; i < NumThreads; ++i)
+      pthread_create(&Threads[i], NULL, kernel, (void*)(long)i);
+   for (i = 0; i < NumThreads; ++i)
+      pthread_join(Threads[i], NULL);
+   clock_gettime(CLOCK_MONOTONIC, &End);
+
+   printf("%d threads: %.3f s\n", NumThreads,
+          (End.tv_sec - Begin.tv_sec) + (End.tv_nsec - Begin.tv_nsec) * 1e-9);
+   free(Threads);
+   return 0;
+}
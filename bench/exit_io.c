@@ -0,0 +1,96 @@
+/*
+ * measure the exit phase of many profiled ranks: each child registers edge,
+ * path and value profiling like an instrumented MPI rank, fills its counters
+ * and exits, so all of them write their profile at the same time.  the
+ * parent reports the wall time from the first fork to the last exit.
+ *
+ * run it with LLVMPROF_OUTPUT or PROFILING_OUTDIR pointing at the
+ * filesystem to measure, every rank writes its own file.
+ *
+ * usage: exit-io [ranks] [functions]
+ */
+#include "ProfileInfoTypes.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+int llvm_start_edge_profiling(int argc, const char** argv,
+                              uint64_t* arrayStart, uint64_t numElements);
+int llvm_start_path_profiling(int argc, const char** argv,
+                              void* functionTable, uint32_t numElements);
+int llvm_start_value_profiling(int argc, const char** argv,
+                               uint64_t* arrayStart, uint64_t numElements);
+void llvm_profiling_trap_value(int index, int value, int isConstant);
+
+#define PATHS_PER_FUNCTION 64
+#define EDGES_PER_FUNCTION 32
+#define VALUE_SITES 256
+
+typedef struct {
+  enum ProfilingStorageType type;
+  uint32_t size;
+  void* array;
+} FunctionEntry;
+
+static void rank(int argc, const char** argv, int Id, int Functions)
+{
+   uint64_t* Edges = calloc((size_t)Functions * EDGES_PER_FUNCTION,
+                            sizeof(uint64_t));
+   uint64_t* Paths = calloc((size_t)Functions * PATHS_PER_FUNCTION,
+                            sizeof(uint64_t));
+   FunctionEntry* Table = malloc(sizeof(FunctionEntry) * Functions);
+   uint64_t* Sites = calloc(VALUE_SITES, sizeof(uint64_t));
+   int i, j;
+
+   for (i = 0; i < Functions; ++i) {
+      Table[i].type = ProfilingArray;
+      Table[i].size = PATHS_PER_FUNCTION;
+      Table[i].array = Paths + (size_t)i * PATHS_PER_FUNCTION;
+   }
+   /* the value handler runs last, older runtimes closed the file in it */
+   llvm_start_value_profiling(argc, argv, Sites, VALUE_SITES);
+   llvm_start_edge_profiling(argc, argv, Edges,
+                             (uint64_t)Functions * EDGES_PER_FUNCTION);
+   llvm_start_path_profiling(argc, argv, Table, Functions);
+
+   /* a quarter of the functions ran, each through a few paths */
+   for (i = 0; i < Functions; i += 4) {
+      for (j = 0; j < EDGES_PER_FUNCTION; ++j)
+         Edges[(size_t)i * EDGES_PER_FUNCTION + j] = i + j + Id;
+      for (j = 0; j < PATHS_PER_FUNCTION; j += 7)
+         Paths[(size_t)i * PATHS_PER_FUNCTION + j] = i ^ j;
+   }
+   for (i = 0; i < 100000; ++i)
+      llvm_profiling_trap_value(i % VALUE_SITES, (i * 7 + Id) % 100, 0);
+   exit(0);
+}
+
+int main(int argc, const char** argv)
+{
+   int Ranks = argc > 1 ? atoi(argv[1]) : 64;
+   int Functions = argc > 2 ? atoi(argv[2]) : 4000;
+   struct timespec Begin, End;
+   int i;
+
+   if (Ranks < 1) Ranks = 1;
+   if (Functions < 1) Functions = 1;
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   for (i = 0; i < Ranks; ++i) {
+      pid_t Pid = fork();
+      if (Pid == 0) rank(argc, argv, i, Functions);
+      if (Pid < 0) {
+         perror("fork");
+         return 1;
+      }
+   }
+   for (i = 0; i < Ranks; ++i)
+      wait(NULL);
+   clock_gettime(CLOCK_MONOTONIC, &End);
+
+   printf("%d ranks: %.3f s\n", Ranks,
+          (End.tv_sec - Begin.tv_sec) + (End.tv_nsec - Begin.tv_nsec) * 1e-9);
+   return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# compare the run time of the kernel with a counter on every edge and with
+# -insert-optimal-edge-profiling, which only counts the edges outside a
+# maximum spanning tree and lets llvm-prof calculate the others, then check
+# both give the same single thread profile.
+# run from the bench build directory:  ./optimal-edges.sh [iterations]
+ITER=${1:-20000000}
+PROF=${LLVM_PROF:-../src/llvm-prof}
+OUT=$(mktemp -d)
+for T in 1 4; do
+   echo "== $T threads"
+   printf "  none    : "; ./edge-kernel $T $ITER
+   printf "  plain   : "; LLVMPROF_OUTPUT=$OUT/plain$T ./edge-kernel-plain $T $ITER
+   printf "  optimal : "; LLVMPROF_OUTPUT=$OUT/optimal$T ./edge-kernel-optimal $T $ITER
+done
+$PROF -list-all edge-kernel-plain.bc $OUT/plain1* | grep -v edge-kernel > $OUT/plain.txt
+$PROF -list-all edge-kernel-optimal.bc $OUT/optimal1* | grep -v edge-kernel > $OUT/optimal.txt
+if diff -q $OUT/plain.txt $OUT/optimal.txt > /dev/null; then
+   echo "the plain and optimal profiles are the same"
+else
+   echo "the plain and optimal profiles differ:"; diff $OUT/plain.txt $OUT/optimal.txt
+fi
+rm -r $OUT
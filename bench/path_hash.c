@@ -0,0 +1,101 @@
+/*
+ * compare the path counter lookup of the path profiling runtime with the
+ * 100-bin chained hash it used before.  a function with a huge path space
+ * executes a skewed subset of its paths, like a large solver does.
+ *
+ * usage: path-hash [distinct paths] [increments]
+ */
+#include "ProfileInfoTypes.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int llvm_start_path_profiling(int argc, const char** argv,
+                              void* functionTable, uint32_t numElements);
+void llvm_increment_path_count(uint32_t functionNumber, uint32_t pathNumber);
+
+/* the old design, copied from libprofile/PathProfiling.c */
+#define ARBITRARY_HASH_BIN_COUNT 100
+
+typedef struct pathHashEntry_s {
+  uint32_t pathNumber;
+  uint32_t pathCount;
+  struct pathHashEntry_s* next;
+} pathHashEntry_t;
+
+static pathHashEntry_t* hashBins[ARBITRARY_HASH_BIN_COUNT];
+
+__attribute__((noinline))
+static void chained_increment_path_count(uint32_t pathNumber) {
+  uint32_t index = pathNumber % ARBITRARY_HASH_BIN_COUNT;
+  pathHashEntry_t* hashEntry = hashBins[index];
+
+  while (hashEntry) {
+    if (hashEntry->pathNumber == pathNumber) break;
+    hashEntry = hashEntry->next;
+  }
+  if (!hashEntry) {
+    hashEntry = malloc(sizeof(pathHashEntry_t));
+    hashEntry->pathNumber = pathNumber;
+    hashEntry->pathCount = 0;
+    hashEntry->next = hashBins[index];
+    hashBins[index] = hashEntry;
+  }
+  if (hashEntry->pathCount < 0xffffffff)
+    hashEntry->pathCount++;
+}
+
+static struct {
+  enum ProfilingStorageType type;
+  uint32_t size;
+  void* array;
+} FunctionTable[1] = { { ProfilingHash, 0, NULL } };
+
+static double seconds(struct timespec* Begin, struct timespec* End)
+{
+   return (End->tv_sec - Begin->tv_sec) + (End->tv_nsec - Begin->tv_nsec) * 1e-9;
+}
+
+int main(int argc, const char** argv)
+{
+   long Distinct = argc > 1 ? atol(argv[1]) : 20000;
+   long Increments = argc > 2 ? atol(argv[2]) : 50000000;
+   uint32_t* Paths;
+   struct timespec Begin, End;
+   unsigned long x = 88172645463325252UL;
+   long i;
+
+   if (Distinct < 1) Distinct = 1;
+   /* spread the executed path numbers over a large path space */
+   Paths = malloc(sizeof(uint32_t) * Distinct);
+   for (i = 0; i < Distinct; ++i)
+      Paths[i] = (uint32_t)(i * 2654435761UL % 1000000007UL);
+
+   llvm_start_path_profiling(argc, argv, FunctionTable, 1);
+
+   /* the same xorshift sequence for both, squaring it favours low indices */
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   for (i = 0; i < Increments; ++i) {
+      double r;
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      r = (double)(x >> 11) / (double)(1UL << 53);
+      chained_increment_path_count(Paths[(long)(r * r * Distinct)]);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &End);
+   printf("chained        : %.3f s\n", seconds(&Begin, &End));
+
+   x = 88172645463325252UL;
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   for (i = 0; i < Increments; ++i) {
+      double r;
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      r = (double)(x >> 11) / (double)(1UL << 53);
+      llvm_increment_path_count(1, Paths[(long)(r * r * Distinct)]);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &End);
+   printf("open addressing: %.3f s\n", seconds(&Begin, &End));
+
+   free(Paths);
+   return 0;
+}
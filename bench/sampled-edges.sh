@@ -0,0 +1,14 @@
+#!/bin/sh
+# compare exact and sampled edge counters of the kernel: the run time of
+# each, and the accuracy of the scaled sampled counts.
+# run from the bench build directory:  ./sampled-edges.sh [iterations]
+ITER=${1:-20000000}
+OUT=$(mktemp -d)
+for T in 1 4; do
+   echo "== $T threads"
+   printf "  none    : "; ./edge-kernel $T $ITER
+   printf "  plain   : "; LLVMPROF_OUTPUT=$OUT/plain$T ./edge-kernel-plain $T $ITER
+   printf "  sampled : "; LLVMPROF_OUTPUT=$OUT/sampled$T ./edge-kernel-sampled $T $ITER
+   printf "  accuracy: "; ./edge-accuracy $OUT/plain$T* $OUT/sampled$T*
+done
+rm -r $OUT
@@ -0,0 +1,64 @@
+/*
+ * stress the value profiling runtime in full log mode: a few hot sites and
+ * many cold ones trap millions of values.  reports the trapping time, the
+ * time spent in the exit handler writing the log and the peak RSS.
+ *
+ * usage: value-trap [traps] [sites]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+int llvm_start_value_profiling(int argc, const char** argv,
+                               uint64_t* arrayStart, uint64_t numElements);
+void llvm_profiling_trap_value(int index, int value, int isConstant);
+
+static struct timespec ExitBegin;
+
+static double since(struct timespec* Begin)
+{
+   struct timespec End;
+   clock_gettime(CLOCK_MONOTONIC, &End);
+   return (End.tv_sec - Begin->tv_sec) + (End.tv_nsec - Begin->tv_nsec) * 1e-9;
+}
+
+/* atexit handlers run backwards: ExitBegin is taken before the value
+ * profiling handler runs, report after it */
+static void report(void)
+{
+   struct rusage Usage;
+   getrusage(RUSAGE_SELF, &Usage);
+   printf("exit   : %.3f s\nmax rss: %ld KB\n", since(&ExitBegin),
+          Usage.ru_maxrss);
+}
+
+static void begin_exit(void)
+{
+   clock_gettime(CLOCK_MONOTONIC, &ExitBegin);
+}
+
+int main(int argc, const char** argv)
+{
+   long Traps = argc > 1 ? atol(argv[1]) : 50000000;
+   int Sites = argc > 2 ? atoi(argv[2]) : 1000;
+   uint64_t* Counters;
+   struct timespec Begin;
+   long i;
+
+   if (Sites < 4) Sites = 4;
+   Counters = calloc(Sites, sizeof(uint64_t));
+   atexit(report);
+   llvm_start_value_profiling(argc, argv, Counters, Sites);
+   atexit(begin_exit);
+
+   clock_gettime(CLOCK_MONOTONIC, &Begin);
+   for (i = 0; i < Traps; ++i) {
+      /* 3 of 4 traps hit the first 4 sites */
+      int Site = (i & 3) ? (int)(i & 3) : (int)(i / 4 % Sites);
+      llvm_profiling_trap_value(Site, (int)(i * 7 % 1000), 0);
+   }
+   printf("trap   : %.3f s\n", since(&Begin));
+   return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef LLVM_FUNCTION_FILTER_H_H
+#define LLVM_FUNCTION_FILTER_H_H
+
+namespace llvm {
+class Function;
+
+/*
+ * isProfiledFunction - Whether the profiling passes instrument F, chosen
+ * by -profile-functions, -profile-skip-functions and -profile-hot-functions.
+ * The counter arrays only cover these functions, and the profile loader
+ * applies the same filter to find them again, so llvm-prof needs the same
+ * options as opt.  Declarations are never profiled.
+ */
+bool isProfiledFunction(const Function &F);
+}
+
+#endif
@@ -36,6 +36,28 @@ enum ProfilingType {
    MPIFullInfo  = 103, /* an expand MPI Inst profiling info contain datatype */
    BlockInfo64  = 104, /* Block profiling information with 64bit */
    EdgeInfo64   = 105, /* Edge Profiling information with 64bit */
+   ThreadEdgeInfo64  = 106, /* EdgeInfo64 of a single thread */
+   ThreadBlockInfo64 = 107, /* BlockInfo64 of a single thread */
+   ValueSummaryInfo  = 108, /* Value profiling top-K summaries, with K */
+   SnapshotInfo      = 109, /* Header of a snapshot of a running program */
+   BBTraceVarintInfo = 110, /* BBTraceInfo as zigzag varint differences */
+   SampledEdgeInfo64 = 111, /* EdgeInfo64 counted in bursts, followed by
+                               the sampling period and burst */
+   OptEdgeInfo64     = 112, /* OptEdgeInfo with 64bit, ~0 if uncounted */
+   ValueInfo64       = 113, /* ValueInfo with 64bit site counts */
+   ValueSummaryInfo64 = 114, /* ValueSummaryInfo with 64bit site counts */
+   PathInfo64        = 115, /* PathInfo of PathProfileTableEntry64 */
+   MPIFullInfo64     = 116, /* MPIFullInfo with 64bit */
+   BlockMapInfo64    = 117, /* The counters of some blocks, preceded by the
+                               equations which give the other block counts */
+   ModuleInfo64      = 118, /* The hash of the module the packets up to the
+                               next ModuleInfo64 or ArgumentInfo belong to */
+   PagedInfo64       = 119, /* An EdgeInfo64 or BlockInfo64 packet without
+                               its zero pages */
+   EdgeInfo64Sparse  = 120, /* EdgeInfo64 as varints of the counters which
+                               are not zero */
+   BlockInfo64Sparse = 121, /* BlockInfo64 as varints of the counters which
+                               are not zero */
 };
 
 // special flags used in value profiling
@@ -26,7 +26,7 @@
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include <llvm/IR/Instructions.h>
-#include "ProfileDataTypes.h"
+#include "ProfileInfoTypes.h"
 #include <cassert>
 #include <map>
 #include <set>
@@ -63,13 +63,16 @@ namespace llvm {
     typedef std::map<const BType*, double> BlockCounts;
     typedef std::map<const BType*, const BType*> Path;
     struct ValueCounts{
-       unsigned Nums;
+       uint64_t Nums;
        enum ProfilingFlags flags;
        std::vector<int> Contents;
+       // only for sites profiled with LLVMPROF_VALUE_TOPK
+       uint64_t Others;
+       std::vector<ValueSummaryEntry> TopK;
     };
     typedef std::pair<unsigned, const Instruction*> 
        SLGCounts;
-    typedef std::pair<unsigned, unsigned> MPICounts; // index, count
+    typedef std::pair<unsigned, uint64_t> MPICounts; // index, count
 
   protected:
     // EdgeInformation - Count the number of times a transition between two
@@ -127,6 +130,12 @@ namespace llvm {
 
     double getExecutionCount(const CallInst* V);
     const std::vector<int>& getValueContents(const CallInst* V);
+    /** return the top-K table of a value site which was summarized instead
+     * of logged, empty otherwise. Others receives the observations missing
+     * a full table.
+     */
+    const std::vector<ValueSummaryEntry>& getValueTopK(const CallInst* V,
+                                                       uint64_t* Others = 0);
     /** return traped instructions.
      * if Instruction is CallInst it is ValueProfiling
      * if Instruction is LoadInst it is SLGProfiling
@@ -16,6 +16,8 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOLOADER_H
 #define LLVM_ANALYSIS_PROFILEINFOLOADER_H
 
+#include "ProfileInfoTypes.h"
+#include <cstdio>
 #include <string>
 #include <utility>
 #include <vector>
@@ -29,23 +31,48 @@ class BasicBlock;
 raw_ostream& operator<<(raw_ostream& O,
                         std::pair<const BasicBlock*, const BasicBlock*> E);
 
+// ValueSummary - The top-K table of a value profiling site, written instead
+// of its value contents when the program ran with LLVMPROF_VALUE_TOPK.
+struct ValueSummary {
+  int Flags;
+  uint64_t Others; // observations which missed a full table
+  std::vector<ValueSummaryEntry> TopK; // sorted by count, backwards
+  unsigned Capacity; // the largest K of the runs
+  ValueSummary():Flags(0), Others(0), Capacity(0) {}
+};
+
+// SkipProfilingPacket - Skip the packet of type PacketType whose type word
+// was just read from F.  Returns false for an unknown type or a truncated
+// packet.
+bool SkipProfilingPacket(FILE *F, unsigned PacketType, bool ShouldByteSwap);
+
+// getProfileModuleHash - The identity of M in ModuleInfo64 packets: a hash of
+// the names of its functions, which the instrumentation leaves alone.
+uint64_t getProfileModuleHash(const Module &M);
+
 class ProfileInfoLoader {
   const std::string &Filename;
   std::vector<std::string> CommandLines;
   std::vector<unsigned>    FunctionCounts;
   std::vector<uint64_t>    BlockCounts;
   std::vector<uint64_t>    EdgeCounts;
-  std::vector<unsigned>    OptimalEdgeCounts;
-  std::vector<unsigned>    BBTrace;
-  std::vector<unsigned>	   ValueCounts;
+  std::vector<uint64_t>    OptimalEdgeCounts;
+  std::vector<uint64_t>    ValueCounts;
   std::vector<std::vector<int> > ValueContents;
+  std::vector<ValueSummary> ValueSummaries;
   std::vector<unsigned>    SLGCounts;
   std::vector<unsigned>    MPICounts;
-  std::vector<unsigned>    MPIFullCounters; // new mpi profiling format
+  std::vector<uint64_t>    MPIFullCounters; // new mpi profiling format
+  std::vector<std::vector<uint64_t> > ThreadBlockCounts; // one per thread
+  std::vector<std::vector<uint64_t> > ThreadEdgeCounts;
+  std::vector<SnapshotHeader> Snapshots;
+  double EdgeSampleScale;
 public:
   // ProfileInfoLoader ctor - Read the specified profiling data file, exiting
-  // the program if the file is invalid or broken.
-  ProfileInfoLoader(const char *ToolName, const std::string &Filename);
+  // the program if the file is invalid or broken.  With a ModuleHash, the
+  // packets of the other modules of a process are skipped.
+  ProfileInfoLoader(const char *ToolName, const std::string &Filename,
+                    uint64_t ModuleHash = 0);
 
   static const uint64_t Uncounted;
 
@@ -78,11 +105,11 @@ public:
   // getEdgeOptimalCounts - This method is used by consumers of optimal edge 
   // counting information.
   //
-  const std::vector<unsigned> &getRawOptimalEdgeCounts() const {
+  const std::vector<uint64_t> &getRawOptimalEdgeCounts() const {
     return OptimalEdgeCounts;
   }
 
-  const std::vector<unsigned> &getRawValueCounts() const {
+  const std::vector<uint64_t> &getRawValueCounts() const {
 	  return ValueCounts;
   }
 
@@ -90,6 +117,13 @@ public:
 	  return ValueContents[index];
   }
 
+  // getRawValueSummaries - One top-K table per value site, empty if the
+  // value contents were logged instead.
+  //
+  const std::vector<ValueSummary> &getRawValueSummaries() const {
+	  return ValueSummaries;
+  }
+
   const std::vector<unsigned> &getRawSLGCounts() const {
      return SLGCounts;
   }
@@ -98,10 +132,33 @@ public:
      return MPICounts;
   }
 
-  const std::vector<unsigned> &getRawMPIFullCounts() const {
+  const std::vector<uint64_t> &getRawMPIFullCounts() const {
      return MPIFullCounters;
   }
 
+  // getRawThreadEdgeCounts - The edge counters of each thread, present when
+  // the program was run with LLVMPROF_THREAD_PACKETS.
+  //
+  const std::vector<std::vector<uint64_t> > &getRawThreadEdgeCounts() const {
+     return ThreadEdgeCounts;
+  }
+
+  const std::vector<std::vector<uint64_t> > &getRawThreadBlockCounts() const {
+     return ThreadBlockCounts;
+  }
+
+  // getSnapshots - The headers of the snapshots in the file, empty unless it
+  // was written by a program running with LLVMPROF_SNAPSHOT_INTERVAL.
+  //
+  const std::vector<SnapshotHeader> &getSnapshots() const {
+     return Snapshots;
+  }
+
+  // getEdgeSampleScale - The factor the edge counts of a program built with
+  // -insert-edge-profiling-sampled were scaled up by, 0 if they are exact.
+  //
+  double getEdgeSampleScale() const { return EdgeSampleScale; }
+
 };
 
 } // End llvm namespace
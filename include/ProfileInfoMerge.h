@@ -17,9 +17,9 @@ class ProfileInfoMerge
    std::vector<unsigned> FunctionCounts;
    std::vector<uint64_t> BlockCounts;
    std::vector<uint64_t> EdgeCounts;
-   std::vector<unsigned> OptimalEdgeCounts;
+   std::vector<uint64_t> OptimalEdgeCounts;
    std::vector<unsigned> BBTrace;
-   std::vector<unsigned> ValueCounts;
+   std::vector<uint64_t> ValueCounts;
    std::vector<unsigned> SLGCounts;
    std::vector<std::vector<int> > ValueContents; 
    public:
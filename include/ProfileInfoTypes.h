@@ -16,6 +16,8 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOTYPES_H
 #define LLVM_ANALYSIS_PROFILEINFOTYPES_H
 
+#include <stdint.h>
+
 /* Included by libprofile. */
 #if defined(__cplusplus)
 extern "C" {
@@ -24,7 +26,8 @@ extern "C" {
 /* IDs to distinguish between those path counters stored in hashses vs arrays */
 enum ProfilingStorageType {
   ProfilingArray = 1,
-  ProfilingHash = 2
+  ProfilingHash = 2,
+  ProfilingCachedHash = 3 /* a hash behind an inline path cache */
 };
 
 #include "ProfileDataTypes.h"
@@ -45,6 +48,61 @@ typedef struct {
   unsigned pathCounter;
 } PathProfileTableEntry;
 
+/*
+ * The entry of a PathInfo64 table.
+ */
+typedef struct {
+  unsigned pathNumber;
+  unsigned reserved;
+  uint64_t pathCounter;
+} PathProfileTableEntry64;
+
+/*
+ * Describes a value in the top-K table of a value profiling site.  count
+ * over-estimates the value's occurrences by at most error.
+ */
+typedef struct {
+  int value;
+  unsigned reserved;
+  uint64_t count;
+  uint64_t error;
+} ValueSummaryEntry;
+
+/*
+ * Follows the arguments in a snapshot file, written by a program running
+ * with LLVMPROF_SNAPSHOT_INTERVAL.
+ */
+#define SNAPSHOT_DELTA 1 /* the counts are since the previous snapshot */
+typedef struct {
+  unsigned flags;
+  unsigned reserved;
+  uint64_t sequence; /* the first snapshot of a process is 1 */
+  uint64_t time;     /* seconds since the epoch */
+} SnapshotHeader;
+
+/*
+ * The head of the shared memory object a program running with LLVMPROF_SHM
+ * mirrors its counters to, followed by size bytes of packets in the format
+ * of a profile file.  generation is odd while the runtime updates the
+ * packets, a reader copies them and retries if it changed meanwhile.
+ */
+#define PROFILE_SHM_MAGIC 0x4c505348 /* "LPSH" */
+#define PROFILE_SHM_MAX_PACKETS 8
+typedef struct {
+  uint32_t type;         /* enum ProfilingType */
+  uint32_t reserved;
+  uint64_t offset;       /* of the packet, from the end of the header */
+  uint64_t numElements;
+} ProfileShmPacket;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t numPackets;
+  volatile uint64_t generation;
+  uint64_t size;
+  ProfileShmPacket packets[PROFILE_SHM_MAX_PACKETS];
+} ProfileShmHeader;
+
 #if defined(__cplusplus)
 }
 #endif
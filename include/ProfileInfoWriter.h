@@ -21,6 +21,8 @@ class ProfileInfoWriter {
     * @param Counter: a Array of unsigned Counter
     */
    void write(ProfilingType Type, const std::vector<unsigned>& Counter);
+   /* write the counters of a 64bit Type, such as BlockInfo64 */
+   void write(ProfilingType Type, const std::vector<uint64_t>& Counter);
 };
 
 }
@@ -68,12 +68,26 @@ ModulePass *createPathProfileVerifierPass();
 // Insert edge profiling instrumentation
 ModulePass *createEdgeProfilerPass();
 
+// Insert edge profiling instrumentation which counts bursts of samples
+ModulePass *createSampledEdgeProfilerPass();
+
 // Insert optimal edge profiling instrumentation
 ModulePass *createOptimalEdgeProfilerPass();
 
+// Insert the fewest block counters which give all block counts
+ModulePass *createBlockProfilerPass();
+
 // Insert path profiling instrumentation
 ModulePass *createPathProfilerPass();
 
+// Keep the profile counters of loops in registers, run after the
+// instrumentation
+FunctionPass *createCounterPromotionPass();
+
+// Put the counters of all profiling passes into one region, started by one
+// init call, run after the instrumentation
+ModulePass *createCounterRegistryPass();
+
 #if 0
 // Insert GCOV profiling instrumentation
 struct GCOVOptions {
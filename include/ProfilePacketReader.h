@@ -0,0 +1,72 @@
+//===- ProfilePacketReader.h - Index the packets of a profile ---*- C++ -*-===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The ProfilePacketReader class maps a profile file into memory and finds
+// its packets in one pass over their headers, for ProfileInfoLoader and the
+// path profile loader.  The words of a counter packet are read in place, as
+// a view of the mapping, when the file has the byte order of this host.
+// The other packets are read through a stream over the mapping.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_PROFILEPACKETREADER_H
+#define LLVM_ANALYSIS_PROFILEPACKETREADER_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// ProfileWord - A 64 bit word of a packet.  The packets follow a 32 bit
+// type word, so their words are only 4 byte aligned.
+typedef uint64_t ProfileWord __attribute__((aligned(4)));
+
+// ProfilePacket - A packet of the file, its type word is not included.
+struct ProfilePacket {
+  unsigned Type;
+  bool ShouldByteSwap;
+  uint64_t Offset;
+  uint64_t Size;
+};
+
+class ProfilePacketReader {
+  const char *Data;
+  uint64_t Size;
+  bool Mapped;                // Data is mmap'd, or else it is Buffer
+  std::vector<char> Buffer;
+  std::vector<ProfilePacket> Packets;
+  FILE *Stream;
+
+  ProfilePacketReader(const ProfilePacketReader &) = delete;
+  void operator=(const ProfilePacketReader &) = delete;
+public:
+  // ProfilePacketReader ctor - Map the specified profiling data file, or
+  // copy the counters of a program running with LLVMPROF_SHM for a
+  // shm:<name>, and index its packets.  Exits the program if the file can't
+  // be read or has a truncated or unknown packet.
+  ProfilePacketReader(const char *ToolName, const std::string &Filename);
+  ~ProfilePacketReader();
+
+  uint64_t size() const { return Size; }
+  const std::vector<ProfilePacket> &packets() const { return Packets; }
+  const char *getData(const ProfilePacket &P) const { return Data + P.Offset; }
+
+  // getWords - The words of a packet of a word count and that many 64 bit
+  // words, in place.  Returns false if they have to be byte swapped.
+  bool getWords(const ProfilePacket &P, const ProfileWord *&Words,
+                uint64_t &Count) const;
+  // getStream - A stream of the file positioned at packet P.
+  FILE *getStream(const ProfilePacket &P);
+};
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+//===- ProfileTraceReader.h - Stream a basic block trace from disk -*- C++ -*-===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The BBTraceReader class reads the basic block trace of a profile file, the
+// BBTraceInfo and BBTraceVarintInfo packets written by -trace-basic-blocks,
+// in the order the blocks ran.  The trace is decoded a bounded chunk at a
+// time, so traces larger than memory can be walked to rebuild edge counts,
+// hot sequences or reuse distances.  Other packets are skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_PROFILETRACEREADER_H
+#define LLVM_ANALYSIS_PROFILETRACEREADER_H
+
+#include <cstdio>
+#include <iterator>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class BBTraceReader {
+  const char *ToolName;
+  std::string Filename;
+  FILE *F;
+  std::vector<unsigned> Blocks;        // the decoded chunk
+  size_t Next;                         // next block of the chunk
+  uint64_t Position;                   // blocks returned so far
+
+  // the trace packet being read
+  bool Varint;
+  bool ShouldByteSwap;
+  uint64_t BlocksLeft;                 // not decoded yet
+  uint64_t BytesLeft;                  // encoded bytes not read yet
+  unsigned Padding;                    // behind the encoded bytes
+  unsigned Previous;                   // last decoded block number
+  std::vector<unsigned char> Encoded;  // read but not decoded bytes
+  size_t EncodedBegin, EncodedEnd;
+
+  bool nextPacket();
+  void skipEncoded();
+  void readRaw();
+  void readVarint();
+  bool refill();
+
+  BBTraceReader(const BBTraceReader &) = delete;
+  void operator=(const BBTraceReader &) = delete;
+public:
+  // BBTraceReader ctor - Open the specified profiling data file, exiting the
+  // program if it can't be opened.  A broken trace exits while it is read.
+  BBTraceReader(const char *ToolName, const std::string &Filename);
+  ~BBTraceReader();
+
+  // next - Store the next block number of the trace in Block.  Returns false
+  // at the end of the trace.
+  bool next(unsigned &Block) {
+    if (Next == Blocks.size() && !refill()) return false;
+    Block = Blocks[Next++];
+    ++Position;
+    return true;
+  }
+
+  // getPosition - The number of blocks returned so far.
+  uint64_t getPosition() const { return Position; }
+
+  // iterator - Walks the trace once, every reader has a single pass.
+  class iterator : public std::iterator<std::input_iterator_tag, unsigned> {
+    BBTraceReader *Reader; // 0 at the end
+    unsigned Block;
+  public:
+    explicit iterator(BBTraceReader *R = 0) : Reader(R), Block(0) {
+      ++*this;
+    }
+    unsigned operator*() const { return Block; }
+    iterator &operator++() {
+      if (Reader && !Reader->next(Block)) Reader = 0;
+      return *this;
+    }
+    bool operator==(const iterator &I) const { return Reader == I.Reader; }
+    bool operator!=(const iterator &I) const { return Reader != I.Reader; }
+  };
+
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+};
+
+} // End llvm namespace
+
+#endif
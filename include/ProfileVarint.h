@@ -0,0 +1,164 @@
+/*===-- ProfileVarint.h - Varint coding of profiling packets ---------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file defines the variable length integer coding shared by the
+|* profiling runtimes, which write compressed packets, and the loaders which
+|* read them.  A varint holds 7 bits per byte, low bits first, the high bit
+|* of a byte is set when another byte follows.  Signed numbers are zigzag
+|* mapped first, so small negative ones stay short.
+|*
+|* A sparse counter array is coded as the counters which are not zero, each
+|* the varint of the zeros skipped since the one before and the varint of
+|* its count.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#ifndef LLVM_ANALYSIS_PROFILEVARINT_H
+#define LLVM_ANALYSIS_PROFILEVARINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* the longest encoding of a 32 and a 64 bit number */
+#define PROFILE_VARINT_MAX32 5
+#define PROFILE_VARINT_MAX64 10
+
+static inline uint32_t profile_zigzag32(int32_t Value) {
+  return ((uint32_t)Value << 1) ^ (uint32_t)(Value >> 31);
+}
+
+static inline int32_t profile_unzigzag32(uint32_t Value) {
+  return (int32_t)(Value >> 1) ^ -(int32_t)(Value & 1);
+}
+
+/* profile_varint_put - Write Value at Out, return the bytes written. */
+static inline size_t profile_varint_put(uint64_t Value, unsigned char *Out) {
+  size_t Length = 0;
+  while (Value >= 0x80) {
+    Out[Length++] = (unsigned char)(Value | 0x80);
+    Value >>= 7;
+  }
+  Out[Length++] = (unsigned char)Value;
+  return Length;
+}
+
+/* profile_varint_size - The bytes profile_varint_put writes for Value. */
+static inline size_t profile_varint_size(uint64_t Value) {
+  size_t Length = 1;
+  while (Value >= 0x80) {
+    Value >>= 7;
+    ++Length;
+  }
+  return Length;
+}
+
+/* profile_varint_get - Read a varint at *In, not past End, and move *In
+ * behind it.  Returns 0 if it is truncated or too long.
+ */
+static inline int profile_varint_get(const unsigned char **In,
+                                     const unsigned char *End,
+                                     uint64_t *Value) {
+  const unsigned char *P = *In;
+  uint64_t Result = 0;
+  unsigned Shift = 0;
+  while (P != End && Shift < 64) {
+    unsigned char Byte = *P++;
+    Result |= (uint64_t)(Byte & 0x7f) << Shift;
+    if (!(Byte & 0x80)) {
+      *In = P;
+      *Value = Result;
+      return 1;
+    }
+    Shift += 7;
+  }
+  return 0;
+}
+
+/* profile_encode_trace - Write the zigzag varint of the difference of every
+ * block number to the one before it, the first to 0, so each packet decodes
+ * on its own.  Out must hold Count * PROFILE_VARINT_MAX32 bytes.  Returns
+ * the bytes written.
+ */
+static inline size_t profile_encode_trace(const unsigned *Blocks,
+                                          size_t Count, unsigned char *Out) {
+  unsigned Previous = 0;
+  size_t Length = 0, i;
+  for (i = 0; i < Count; ++i) {
+    uint32_t Value = profile_zigzag32((int32_t)(Blocks[i] - Previous));
+    /* most steps are to a nearby block */
+    if (Value < 0x80)
+      Out[Length++] = (unsigned char)Value;
+    else
+      Length += profile_varint_put(Value, Out + Length);
+    Previous = Blocks[i];
+  }
+  return Length;
+}
+
+/* profile_decode_trace - Decode Count block numbers from [In, End) into
+ * Blocks.  Previous is the block before them, 0 at the start of a packet,
+ * and is updated.  Returns the bytes read, 0 if the data is broken.
+ */
+static inline size_t profile_decode_trace(const unsigned char *In,
+                                          const unsigned char *End,
+                                          unsigned *Blocks, size_t Count,
+                                          unsigned *Previous) {
+  const unsigned char *Begin = In;
+  size_t i;
+  for (i = 0; i < Count; ++i) {
+    uint64_t Value;
+    if (!profile_varint_get(&In, End, &Value) || Value > 0xffffffffu)
+      return 0;
+    *Previous += (unsigned)profile_unzigzag32((uint32_t)Value);
+    Blocks[i] = *Previous;
+  }
+  return In - Begin;
+}
+
+/* profile_sparse_size - The bytes profile_encode_sparse writes for the
+ * Count counters at Counts.  *Used is set to the number which are not zero.
+ */
+static inline uint64_t profile_sparse_size(const uint64_t *Counts,
+                                           uint64_t Count, uint64_t *Used) {
+  uint64_t Bytes = 0, Next = 0, i;
+  *Used = 0;
+  for (i = 0; i < Count; ++i) {
+    if (!Counts[i]) continue;
+    Bytes += profile_varint_size(i - Next) + profile_varint_size(Counts[i]);
+    Next = i + 1;
+    ++*Used;
+  }
+  return Bytes;
+}
+
+/* profile_encode_sparse - Write the counters at Counts which are not zero,
+ * Out must hold the profile_sparse_size of them.  Returns the bytes written.
+ */
+static inline size_t profile_encode_sparse(const uint64_t *Counts,
+                                           uint64_t Count, unsigned char *Out) {
+  uint64_t Next = 0, i;
+  size_t Length = 0;
+  for (i = 0; i < Count; ++i) {
+    if (!Counts[i]) continue;
+    Length += profile_varint_put(i - Next, Out + Length);
+    Length += profile_varint_put(Counts[i], Out + Length);
+    Next = i + 1;
+  }
+  return Length;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* LLVM_ANALYSIS_PROFILEVARINT_H */
@@ -0,0 +1,266 @@
+//===- BlockProfiling.cpp - Insert the fewest counters for block counts ---===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program with counters for block
+// profiling.  Only as many blocks get a counter as needed to calculate the
+// execution counts of all the others from the flow through the function
+// (Knuth and Stevenson, "Optimal measurement points for program frequency
+// counts").
+//
+// The count of a block is the sum of the edges into it, and the sum of the
+// edges out of it.  Blocks whose edges are tied together this way form a
+// graph: its nodes are the groups of blocks joined by edges from the ones to
+// the others, every block is an arc from the node of its outgoing edges to
+// the node of its incoming edges, and the counts are a flow on it.  The
+// blocks outside a maximum spanning tree of that graph, weighted by
+// ProfileEstimator, are counted and the tree follows from them.  Control
+// equivalent blocks are parallel arcs through a node with no other arcs, at
+// most one of them is outside the tree, so they share its counter.
+//
+// As in optimal edge profiling, a virtual block stands for the callers of the
+// function: its edges go to the entry block and come from the blocks with no
+// successors.
+//
+// The counters are written as a BlockMapInfo64 packet together with the
+// equations which solve the others, ProfileInfoLoader expands it into block
+// counts.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-block-profiling"
+#include "preheader.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include "FunctionFilter.h"
+#include "ProfilingUtils.h"
+#include "ProfileInfo.h"
+#include "ProfileInstrumentations.h"
+#include <algorithm>
+#include <deque>
+using namespace llvm;
+
+STATISTIC(NumBlocksProfiled, "The # of blocks whose count is profiled.");
+STATISTIC(NumBlockCounters, "The # of block counters inserted.");
+
+static cl::opt<bool> BlockProfilingReport("block-profiling-report",
+      cl::desc("Print how many counters -insert-block-profiling saved in "
+               "each module"));
+
+namespace {
+  class BlockProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    BlockProfiler() : ModulePass(ID) {}
+
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequiredID(ProfileEstimatorPassID);
+      AU.addRequired<ProfileInfo>();
+    }
+
+    virtual const char *getPassName() const {
+      return "Block Profiler";
+    }
+  };
+
+  // UnionFind - Disjoint sets of the numbers 0..N-1.
+  class UnionFind {
+    std::vector<unsigned> Parent;
+  public:
+    explicit UnionFind(unsigned N) : Parent(N) {
+      for (unsigned i = 0; i != N; ++i) Parent[i] = i;
+    }
+    unsigned find(unsigned X) {
+      while (Parent[X] != X) X = Parent[X] = Parent[Parent[X]];
+      return X;
+    }
+    // join - Merge the sets of A and B, false if they were the same.
+    bool join(unsigned A, unsigned B) {
+      A = find(A); B = find(B);
+      if (A == B) return false;
+      Parent[A] = B;
+      return true;
+    }
+  };
+}
+
+char BlockProfiler::ID = 0;
+
+static RegisterPass<BlockProfiler> X("insert-block-profiling",
+                "Insert the fewest counters for block profiling",
+                false, false);
+
+ModulePass *llvm::createBlockProfilerPass() {
+  return new BlockProfiler();
+}
+
+// placeCounters - Choose the blocks of F to count.  Block i of F is the slot
+// FirstSlot + i of the packet, the virtual block the slot Virtual.  The
+// chosen blocks are appended to Counted and their slots to Slots, the
+// equations of the others to Rules: the slot to solve, the number of terms
+// and the slot of each term shifted left by one, the low bit set if it is
+// subtracted.
+static void placeCounters(Function &F, ProfileInfo &PI, unsigned FirstSlot,
+                          unsigned Virtual,
+                          std::vector<BasicBlock*> &Counted,
+                          std::vector<uint64_t> &Slots,
+                          std::vector<uint64_t> &Rules) {
+  std::vector<BasicBlock*> Blocks;
+  DenseMap<BasicBlock*, unsigned> Index;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    Index[BB] = Blocks.size();
+    Blocks.push_back(BB);
+  }
+  const unsigned N = Blocks.size(); // the virtual block is N
+  std::vector<unsigned> SlotOf(N + 1);
+  for (unsigned i = 0; i != N; ++i) SlotOf[i] = FirstSlot + i;
+  SlotOf[N] = Virtual;
+
+  // Block i leaves through the half 2i and is entered through 2i+1, an edge
+  // joins the half of its source with the one of its target.
+  UnionFind Halves(2 * (N + 1));
+  Halves.join(2 * N, 2 * 0 + 1);
+  for (unsigned i = 0; i != N; ++i) {
+    TerminatorInst *TI = Blocks[i]->getTerminator();
+    if (TI->getNumSuccessors() == 0)
+      Halves.join(2 * i, 2 * N + 1);
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+      Halves.join(2 * i, 2 * Index[TI->getSuccessor(s)] + 1);
+  }
+  std::vector<unsigned> Out(N + 1), In(N + 1);
+  for (unsigned i = 0; i <= N; ++i) {
+    Out[i] = Halves.find(2 * i);
+    In[i] = Halves.find(2 * i + 1);
+  }
+
+  // Keep the hottest blocks in the tree, the virtual one first.  It can't
+  // close a cycle, the entry block has no predecessors.
+  std::vector<std::pair<double, unsigned> > Order;
+  for (unsigned i = 0; i != N; ++i)
+    Order.push_back(std::make_pair(-PI.getExecutionCount(Blocks[i]), i));
+  std::stable_sort(Order.begin(), Order.end());
+  Order.insert(Order.begin(), std::make_pair(0.0, N));
+  UnionFind Tree(2 * (N + 1));
+  std::vector<bool> Known(N + 1);
+  for (unsigned o = 0; o <= N; ++o) {
+    unsigned i = Order[o].second;
+    if (Tree.join(Out[i], In[i])) continue;
+    assert(i != N && "the virtual block closes a cycle");
+    Known[i] = true;
+    Counted.push_back(Blocks[i]);
+    Slots.push_back(SlotOf[i]);
+  }
+
+  // The flow out of a node is the flow into it.  Solve the tree from its
+  // leaves: a node with a single unknown block gives it as the sum of the
+  // others.  A block whose edges end in its own node cancels out.
+  std::vector<std::vector<unsigned> > Arcs(2 * (N + 1));
+  std::vector<unsigned> Unknown(2 * (N + 1));
+  for (unsigned i = 0; i <= N; ++i) {
+    if (Out[i] == In[i]) continue;
+    Arcs[Out[i]].push_back(i);
+    Arcs[In[i]].push_back(i);
+    if (!Known[i]) ++Unknown[Out[i]], ++Unknown[In[i]];
+  }
+  std::deque<unsigned> Leaves;
+  for (unsigned n = 0; n != Arcs.size(); ++n)
+    if (Unknown[n] == 1) Leaves.push_back(n);
+  while (!Leaves.empty()) {
+    unsigned Node = Leaves.front();
+    Leaves.pop_front();
+    if (Unknown[Node] != 1) continue;
+    const std::vector<unsigned> &A = Arcs[Node];
+    unsigned u = 0;
+    while (Known[A[u]]) ++u;
+    u = A[u];
+    // u leaving Node: u = in - (out - u), entering: u = out - (in - u)
+    bool UOut = Out[u] == Node;
+    Rules.push_back(SlotOf[u]);
+    Rules.push_back(A.size() - 1);
+    for (unsigned a = 0; a != A.size(); ++a)
+      if (A[a] != u)
+        Rules.push_back((uint64_t)SlotOf[A[a]] << 1 |
+                        ((Out[A[a]] == Node) == UOut));
+    Known[u] = true;
+    --Unknown[Out[u]];
+    --Unknown[In[u]];
+    unsigned Other = UOut ? In[u] : Out[u];
+    if (Unknown[Other] == 1) Leaves.push_back(Other);
+  }
+  assert(std::find(Known.begin(), Known.end(), false) == Known.end() &&
+         "a block count is left unsolved");
+
+  DEBUG(dbgs() << F.getName() << ": " << Counted.size() << " of " << N
+               << " blocks counted\n");
+}
+
+bool BlockProfiler::runOnModule(Module &M) {
+  Function *Main = M.getFunction("main");
+
+  // The loader reads block counts in this order.
+  unsigned NumBlocks = 0, NumFunctions = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isProfiledFunction(*F)) continue;
+    NumBlocks += F->size();
+    ++NumFunctions;
+  }
+
+  std::vector<BasicBlock*> Counted;
+  std::vector<uint64_t> Slots, Rules;
+  unsigned FirstSlot = 0, Virtual = NumBlocks;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isProfiledFunction(*F)) continue;
+    placeCounters(*F, getAnalysis<ProfileInfo>(*F), FirstSlot, Virtual++,
+                  Counted, Slots, Rules);
+    FirstSlot += F->size();
+  }
+
+  // The packet is the map, then the counters: the number of blocks, of
+  // slots (the blocks and a virtual block of each function), of counters
+  // and of rule words, the slot of each counter and the rules.
+  const unsigned NumCounters = Counted.size();
+  std::vector<uint64_t> Map;
+  Map.push_back(NumBlocks);
+  Map.push_back(NumBlocks + NumFunctions);
+  Map.push_back(NumCounters);
+  Map.push_back(Rules.size());
+  Map.insert(Map.end(), Slots.begin(), Slots.end());
+  Map.insert(Map.end(), Rules.begin(), Rules.end());
+  const unsigned FirstCounter = Map.size();
+
+  Type *Int64 = Type::getInt64Ty(M.getContext());
+  std::vector<Constant*> Initializer;
+  for (unsigned i = 0; i != Map.size(); ++i)
+    Initializer.push_back(ConstantInt::get(Int64, Map[i]));
+  Initializer.resize(FirstCounter + NumCounters, ConstantInt::get(Int64, 0));
+  ArrayType *ATy = ArrayType::get(Int64, Initializer.size());
+  GlobalVariable *Counters =
+    new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                       ConstantArray::get(ATy, Initializer),
+                       "BlockProfCounters");
+
+  for (unsigned i = 0; i != NumCounters; ++i)
+    IncrementCounterInBlock(Counted[i], FirstCounter + i, Counters);
+
+  NumBlocksProfiled += NumBlocks;
+  NumBlockCounters += NumCounters;
+  if (BlockProfilingReport)
+    errs() << M.getModuleIdentifier() << ": " << NumCounters
+           << " block counters for " << NumBlocks << " blocks, "
+           << NumBlocks - NumCounters << " saved\n";
+
+  // Add the initialization call to main.
+  InsertProfilingInitCall(Main, "llvm_start_block_profiling", Counters);
+  return true;
+}
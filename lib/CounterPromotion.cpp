@@ -0,0 +1,372 @@
+//===- CounterPromotion.cpp - Keep profile counters of loops in registers -===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass runs after the profiling instrumentation.  The increments the
+// instrumentation emits inside a loop, a load/add/store or a relaxed
+// atomicrmw of a counter, are replaced by an add to a register which starts
+// at zero in the loop preheader.  The register is added to the counter in
+// every exit block of the loop.  Loops are promoted innermost first, so the
+// flush of an inner loop is promoted again by the loop around it.
+//
+// Only counters of the profiling runtime are promoted: arrays whose address
+// is used by nothing but counter increments and calls to the runtime, and
+// the per thread shards of -edge-profiling-sharded.  A counter of a shard is
+// addressed in each block with a getelementptr of its own, so counters are
+// told apart by their base and constant index.  The program can't see
+// them, so keeping them in registers changes nothing but when the runtime
+// sees the counts.  A loop which calls other functions keeps its counters in
+// memory unless -promote-counters-across-calls is given, because the counts
+// of a call which never returns (exit, longjmp, an exception) would be lost.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "promote-profile-counters"
+
+#include "preheader.h"
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+#include "ProfileInstrumentations.h"
+#include <map>
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumCountersPromoted, "The # of counters kept in registers in loops.");
+STATISTIC(NumIncrementsPromoted, "The # of counter increments promoted.");
+STATISTIC(NumLoopsPromoted, "The # of loops with promoted counters.");
+
+static cl::opt<bool> PromoteAcrossCalls("promote-counters-across-calls",
+      cl::desc("Also promote the counters of loops which call functions, "
+               "their counts are lost if a call doesn't return"));
+static cl::opt<unsigned> PromoteMaxExits("promote-counters-max-exits",
+      cl::init(8),
+      cl::desc("Keep the counters of loops with more exit blocks in memory"));
+
+namespace {
+  // Increment - A counter increment: the load, add and store of
+  // IncrementCounter, or its atomicrmw.
+  struct Increment {
+    Instruction *Update; // the add, or the atomicrmw
+    Instruction *Load;   // 0 for an atomicrmw
+    Instruction *Store;  // 0 for an atomicrmw
+    Value *Inc;
+  };
+
+  // CounterKey - The address of a counter: a pointer invariant in the loop
+  // and 0, or the invariant base and constant index of a getelementptr in
+  // the loop.
+  typedef std::pair<Value *, int64_t> CounterKey;
+
+  // Counter - The increments of one counter in a loop, in block order.
+  struct Counter {
+    std::vector<Increment> Increments;
+    bool Atomic;
+    bool Rejected;
+    Counter() : Atomic(false), Rejected(false) {}
+  };
+
+  class CounterPromotion : public FunctionPass {
+    // whether each counter array seen so far is used by the runtime only
+    std::map<const GlobalVariable *, bool> RuntimeArrays;
+
+    bool isCounterArray(Value *Base);
+    bool promoteLoop(Loop *L);
+    void promoteCounter(Loop *L, const CounterKey &Key, Counter &C,
+                        const SmallVectorImpl<BasicBlock *> &Exits);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    CounterPromotion() : FunctionPass(ID) {}
+
+    bool runOnFunction(Function &F);
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequiredID(LoopSimplifyID);
+      AU.addRequired<LoopInfo>();
+      AU.addPreservedID(LoopSimplifyID);
+      AU.addPreserved<LoopInfo>();
+      AU.setPreservesCFG();
+    }
+
+    virtual const char *getPassName() const {
+      return "Profile Counter Promotion";
+    }
+  };
+}
+
+char CounterPromotion::ID = 0;
+static RegisterPass<CounterPromotion> X("promote-profile-counters",
+		"Keep the profile counters of loops in registers",false,false);
+
+FunctionPass *llvm::createCounterPromotionPass() {
+  return new CounterPromotion();
+}
+
+// CounterBase - The array a counter address points into.
+static Value *CounterBase(Value *Ptr) {
+  Ptr = Ptr->stripPointerCasts();
+  while (GEPOperator *GEP = dyn_cast<GEPOperator>(Ptr))
+    Ptr = GEP->getPointerOperand()->stripPointerCasts();
+  return Ptr;
+}
+
+static bool IsRuntimeCall(const Value *V, const char *Suffix = "") {
+  const CallInst *CI = dyn_cast<CallInst>(V);
+  const Function *Callee = CI ? CI->getCalledFunction() : 0;
+  return Callee && Callee->getName().startswith("llvm_") &&
+         Callee->getName().endswith(Suffix);
+}
+
+// OnlyIncremented - Whether the address V is only loaded, stored to, added
+// to atomically, offset, or passed to the profiling runtime.
+static bool OnlyIncremented(Value *V) {
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+  for (Value::use_iterator U = V->use_begin(), E = V->use_end(); U != E; ++U) {
+#else
+  for (Value::user_iterator U = V->user_begin(), E = V->user_end(); U != E;
+       ++U) {
+#endif
+    User *User = *U;
+    if (isa<LoadInst>(User) || isa<AtomicRMWInst>(User) || IsRuntimeCall(User))
+      continue;
+    if (StoreInst *SI = dyn_cast<StoreInst>(User)) {
+      if (SI->getValueOperand() == V) return false;
+      continue;
+    }
+    if (isa<GEPOperator>(User) || isa<BitCastOperator>(User)) {
+      if (!OnlyIncremented(User)) return false;
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+// isCounterArray - Whether Base is a counter array only the profiling runtime
+// knows about, so no other memory access of the program can touch it.
+bool CounterPromotion::isCounterArray(Value *Base) {
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Base)) {
+    if (!GV->hasLocalLinkage()) return false;
+    std::map<const GlobalVariable *, bool>::iterator Found =
+        RuntimeArrays.find(GV);
+    if (Found == RuntimeArrays.end())
+      Found = RuntimeArrays.insert(
+          std::make_pair(GV, OnlyIncremented(GV))).first;
+    return Found->second;
+  }
+  // the thread's shard of a counter array
+  return IsRuntimeCall(Base, "_shard") && OnlyIncremented(Base);
+}
+
+// GetCounterKey - The key of the counter at Ptr, false if its address is
+// not known before the loop L.
+static bool GetCounterKey(Loop *L, Value *Ptr, CounterKey &Key) {
+  if (L->isLoopInvariant(Ptr)) {
+    Key = CounterKey(Ptr, 0);
+    return true;
+  }
+  GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(Ptr);
+  ConstantInt *Idx = GEP && GEP->getNumIndices() == 1 ?
+                     dyn_cast<ConstantInt>(GEP->getOperand(1)) : 0;
+  if (!Idx || !L->isLoopInvariant(GEP->getPointerOperand())) return false;
+  Key = CounterKey(GEP->getPointerOperand(), Idx->getSExtValue());
+  return true;
+}
+
+// MatchIncrement - Match the store of a load/add/store increment.
+static bool MatchIncrement(StoreInst *SI, Increment &I) {
+  BinaryOperator *Add = dyn_cast<BinaryOperator>(SI->getValueOperand());
+  if (!SI->isSimple() || !Add || Add->getOpcode() != Instruction::Add ||
+      !Add->hasOneUse())
+    return false;
+  for (unsigned Op = 0; Op != 2; ++Op) {
+    LoadInst *LI = dyn_cast<LoadInst>(Add->getOperand(Op));
+    if (LI && LI->isSimple() && LI->hasOneUse() &&
+        LI->getPointerOperand() == SI->getPointerOperand() &&
+        LI->getParent() == SI->getParent()) {
+      I.Update = Add;
+      I.Load = LI;
+      I.Store = SI;
+      I.Inc = Add->getOperand(1 - Op);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CounterPromotion::runOnFunction(Function &F) {
+  LoopInfo &LI = getAnalysis<LoopInfo>();
+  bool Changed = false;
+  for (LoopInfo::iterator L = LI.begin(), E = LI.end(); L != E; ++L)
+    Changed |= promoteLoop(*L);
+  return Changed;
+}
+
+// promoteLoop - Promote the counters of L's sub loops, then those of L.
+bool CounterPromotion::promoteLoop(Loop *L) {
+  bool Changed = false;
+  for (Loop::iterator Sub = L->begin(), E = L->end(); Sub != E; ++Sub)
+    Changed |= promoteLoop(*Sub);
+
+  SmallVector<BasicBlock *, 8> Exits;
+  L->getUniqueExitBlocks(Exits);
+  if (!L->getLoopPreheader() || !L->hasDedicatedExits() || Exits.empty() ||
+      Exits.size() > PromoteMaxExits)
+    return Changed;
+
+  // Every access of a counter in the loop must belong to an increment, and
+  // those of a block must not overlap.
+  std::map<CounterKey, Counter> Counters;
+  std::vector<CounterKey> Order; // of the counters, for a stable output
+  SmallPtrSet<Value *, 8> PassedToCalls;
+  for (Loop::block_iterator BB = L->block_begin(), BE = L->block_end();
+       BB != BE; ++BB) {
+    // loads of unfinished increments
+    std::map<CounterKey, Instruction *> Pending;
+    for (BasicBlock::iterator I = (*BB)->begin(), E = (*BB)->end(); I != E;
+         ++I) {
+      Value *Ptr;
+      if (LoadInst *LI = dyn_cast<LoadInst>(I))
+        Ptr = LI->getPointerOperand();
+      else if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        Ptr = SI->getPointerOperand();
+      else if (AtomicRMWInst *RMW = dyn_cast<AtomicRMWInst>(I))
+        Ptr = RMW->getPointerOperand();
+      else {
+        CallSite CS(I);
+        if (!CS || isa<IntrinsicInst>(I)) continue;
+        if (!PromoteAcrossCalls && !CS.onlyReadsMemory()) return Changed;
+        for (CallSite::arg_iterator A = CS.arg_begin(), AE = CS.arg_end();
+             A != AE; ++A)
+          if ((*A)->getType()->isPointerTy())
+            PassedToCalls.insert(CounterBase(*A));
+        continue;
+      }
+      CounterKey Key;
+      if (!GetCounterKey(L, Ptr, Key) || !isCounterArray(CounterBase(Ptr)))
+        continue;
+
+      if (!Counters.count(Key)) Order.push_back(Key);
+      Counter &C = Counters[Key];
+      Increment Inc;
+      if (isa<LoadInst>(I)) {
+        C.Rejected |= Pending.count(Key) != 0;
+        Pending[Key] = I;
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        if (MatchIncrement(SI, Inc) && Pending[Key] == Inc.Load) {
+          C.Increments.push_back(Inc);
+          C.Rejected |= C.Atomic;
+        } else
+          C.Rejected = true;
+        Pending.erase(Key);
+      } else {
+        AtomicRMWInst *RMW = cast<AtomicRMWInst>(I);
+        if (RMW->getOperation() != AtomicRMWInst::Add ||
+            RMW->getOrdering() != Monotonic || RMW->isVolatile() ||
+            !RMW->use_empty() || Pending.count(Key) ||
+            (!C.Atomic && !C.Increments.empty())) {
+          C.Rejected = true;
+          continue;
+        }
+        Inc.Update = RMW;
+        Inc.Load = Inc.Store = 0;
+        Inc.Inc = RMW->getValOperand();
+        C.Increments.push_back(Inc);
+        C.Atomic = true;
+      }
+    }
+    for (std::map<CounterKey, Instruction *>::iterator P = Pending.begin(),
+         PE = Pending.end(); P != PE; ++P)
+      Counters[P->first].Rejected = true;
+  }
+
+  unsigned Promoted = 0;
+  for (unsigned i = 0, e = Order.size(); i != e; ++i) {
+    Counter &C = Counters[Order[i]];
+    if (C.Rejected || C.Increments.empty() ||
+        PassedToCalls.count(CounterBase(Order[i].first)) ||
+        !C.Increments[0].Update->getType()->isIntegerTy())
+      continue;
+    promoteCounter(L, Order[i], C, Exits);
+    ++Promoted;
+  }
+  if (Promoted == 0) return Changed;
+
+  DEBUG(dbgs() << "promoted " << Promoted << " counters of the loop at "
+               << L->getHeader()->getName() << "\n");
+  NumCountersPromoted += Promoted;
+  ++NumLoopsPromoted;
+  return true;
+}
+
+// promoteCounter - Count the increments of the counter Key in L in a
+// register, starting at zero in the preheader, and add it to the counter in
+// the exit blocks.
+void CounterPromotion::promoteCounter(Loop *L, const CounterKey &Key,
+                                      Counter &C,
+                               const SmallVectorImpl<BasicBlock *> &Exits) {
+  IntegerType *Ty = cast<IntegerType>(C.Increments[0].Update->getType());
+  SSAUpdater SSA;
+  SSA.Initialize(Ty, "promoted");
+  SSA.AddAvailableValue(L->getLoopPreheader(), ConstantInt::get(Ty, 0));
+
+  // Chain the increments of each block, the first of a block adds to the
+  // value coming in, which is only known once all the blocks are chained.
+  std::vector<BinaryOperator *> Firsts;
+  BinaryOperator *Last = 0;
+  for (unsigned i = 0, e = C.Increments.size(); i != e; ++i) {
+    Increment &Inc = C.Increments[i];
+    BasicBlock *BB = Inc.Update->getParent();
+    bool First = !Last || Last->getParent() != BB;
+    BinaryOperator *Sum = BinaryOperator::CreateAdd(
+        First ? (Value *)UndefValue::get(Ty) : Last, Inc.Inc, "promoted.inc",
+        Inc.Update);
+    if (First) Firsts.push_back(Sum);
+    if (Last && First) SSA.AddAvailableValue(Last->getParent(), Last);
+    Last = Sum;
+  }
+  SSA.AddAvailableValue(Last->getParent(), Last);
+  for (unsigned i = 0, e = Firsts.size(); i != e; ++i)
+    Firsts[i]->setOperand(0, SSA.GetValueInMiddleOfBlock(Firsts[i]->getParent()));
+
+  for (unsigned i = 0, e = C.Increments.size(); i != e; ++i) {
+    Increment &Inc = C.Increments[i];
+    Instruction *Ptr = dyn_cast<Instruction>(Inc.Store ?
+        cast<StoreInst>(Inc.Store)->getPointerOperand() :
+        cast<AtomicRMWInst>(Inc.Update)->getPointerOperand());
+    if (Inc.Store) Inc.Store->eraseFromParent();
+    Inc.Update->eraseFromParent();
+    if (Inc.Load) Inc.Load->eraseFromParent();
+    // the getelementptr of the block
+    if (Ptr && Ptr->use_empty() && L->contains(Ptr->getParent()))
+      Ptr->eraseFromParent();
+  }
+  NumIncrementsPromoted += C.Increments.size();
+
+  for (unsigned i = 0, e = Exits.size(); i != e; ++i) {
+    Value *Delta = SSA.GetValueInMiddleOfBlock(Exits[i]);
+    IRBuilder<> Builder(Exits[i], Exits[i]->getFirstInsertionPt());
+    Value *Ptr = Key.first;
+    if (Key.second)
+      Ptr = Builder.CreateConstGEP1_64(Key.first, Key.second, "Counter");
+    if (C.Atomic) {
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, Ptr, Delta, Monotonic);
+      continue;
+    }
+    Value *OldVal = Builder.CreateLoad(Ptr, "OldCounter");
+    Builder.CreateStore(Builder.CreateAdd(OldVal, Delta, "NewCounter"), Ptr);
+  }
+}
@@ -0,0 +1,290 @@
+//===- CounterRegistry.cpp - One counter region and init call per module --===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass runs after all the profiling instrumentation of a module.  Every
+// profiling pass puts its counters into an array of its own and starts its
+// runtime from main with an llvm_start_* call, which saves the arguments and
+// registers an exit handler.  This pass hands out ranges of one cache line
+// aligned counter region instead: each counter array is moved into the
+// region, starting at a cache line, and the llvm_start_* calls are replaced
+// by a single llvm_start_profile_registry call.  It gets a table of the
+// runtimes and their counters, starts them, and writes all their packets in
+// one buffered append when the program exits.
+//
+// The path profiling table holds pointers to its counter arrays, they are
+// moved into the region too.  Counters which are not plain 64 bit arrays of
+// the module keep their place and are only passed in the table.
+//
+// Each module of a program, and each shared library, registers its own
+// table, the one without main from its constructor.  The first entry names
+// the module and gives its getProfileModuleHash, which the runtime writes in
+// a ModuleInfo64 packet before the packets of the module, so the loader
+// finds the counters of the bitcode it is given.
+//
+// Path and value profiling count in tables of the first module which starts
+// them.  The calls of their runtimes in every module go through a guard with
+// a flag of the module, which the runtime sets if it ignores the module.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "profile-counter-registry"
+#include "preheader.h"
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ProfilingUtils.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileInstrumentations.h"
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumRuntimesRegistered, "The # of runtimes started by the registry.");
+STATISTIC(NumRegionCounters, "The # of counters moved into the region.");
+
+// The runtimes which export an llvm_<name>_runtime for their
+// llvm_start_<name>.
+static const char *const Runtimes[] = {
+  "edge_profiling", "sampled_edge_profiling", "opt_edge_profiling",
+  "block_profiling", "pred_block_profiling", "value_profiling",
+  "mpi_profiling", "path_profiling"
+};
+
+// Counters per cache line.
+static const unsigned LineCounters = 8;
+
+// The runtime calls which index the tables of the runtime's first module.
+// A further module makes them through a guard, which the runtime turns off
+// if it ignores the module.
+static const struct { const char *Runtime, *Call; } ModuleCalls[] = {
+  { "path_profiling", "llvm_increment_path_count" },
+  { "path_profiling", "llvm_decrement_path_count" },
+  { "path_profiling", "llvm_path_cache_fill" },
+  { "value_profiling", "llvm_profiling_trap_value" }
+};
+
+namespace {
+  class CounterRegistry : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    CounterRegistry() : ModulePass(ID) {}
+
+    virtual const char *getPassName() const {
+      return "Profile Counter Registry";
+    }
+  };
+}
+
+char CounterRegistry::ID = 0;
+
+static RegisterPass<CounterRegistry> X("profile-counter-registry",
+                "Put the profile counters into one region with one init call",
+                false, false);
+
+ModulePass *llvm::createCounterRegistryPass() {
+  return new CounterRegistry();
+}
+
+// RuntimeOf - The runtime started by Call, or 0 if it is no llvm_start_*
+// call of a runtime with a registry entry.
+static const char *RuntimeOf(CallInst *Call) {
+  Function *Callee = Call->getCalledFunction();
+  if (!Callee || Call->getNumArgOperands() != 4 ||
+      !Callee->getName().startswith("llvm_start_"))
+    return 0;
+  StringRef Name = Callee->getName().substr(strlen("llvm_start_"));
+  for (unsigned i = 0; i != array_lengthof(Runtimes); ++i)
+    if (Name == Runtimes[i]) return Runtimes[i];
+  return 0;
+}
+
+// isMovable - Whether GV is a counter array the region can take over.
+static bool isMovable(GlobalVariable *GV) {
+  ArrayType *ATy = dyn_cast<ArrayType>(GV->getType()->getElementType());
+  return GV->hasLocalLinkage() && GV->hasInitializer() && !GV->isConstant() &&
+         ATy && ATy->getElementType()->isIntegerTy(64);
+}
+
+// collectArrays - Add the movable counter arrays C points to, through
+// constant structs and arrays, to Arrays.
+static void collectArrays(Constant *C, SetVector<GlobalVariable*> &Arrays) {
+  if (GlobalVariable *GV =
+        dyn_cast<GlobalVariable>(C->stripPointerCasts())) {
+    if (isMovable(GV)) Arrays.insert(GV);
+    return;
+  }
+  if (isa<ConstantStruct>(C) || isa<ConstantArray>(C))
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i)
+      collectArrays(cast<Constant>(C->getOperand(i)), Arrays);
+}
+
+// GuardModuleCalls - Make the calls of Runtime which index the tables of one
+// module return at once when Ignored is set, and return Ignored, or 0 if the
+// module makes none.
+static GlobalVariable *GuardModuleCalls(Module &M, const char *Runtime) {
+  LLVMContext &Context = M.getContext();
+  Type *Int8 = Type::getInt8Ty(Context);
+  GlobalVariable *Ignored = 0;
+  for (unsigned i = 0; i != array_lengthof(ModuleCalls); ++i) {
+    Function *Callee = M.getFunction(ModuleCalls[i].Call);
+    if (strcmp(ModuleCalls[i].Runtime, Runtime) || !Callee ||
+        Callee->use_empty() || !Callee->getReturnType()->isVoidTy())
+      continue;
+    if (!Ignored)
+      Ignored = new GlobalVariable(M, Int8, false,
+                                   GlobalValue::InternalLinkage,
+                                   ConstantInt::get(Int8, 0),
+                                   "ProfileModuleIgnored");
+    Function *Guard =
+      Function::Create(Callee->getFunctionType(),
+                       GlobalValue::InternalLinkage,
+                       Callee->getName() + ".guard", &M);
+    Callee->replaceAllUsesWith(Guard);
+    BasicBlock *Entry = BasicBlock::Create(Context, "entry", Guard);
+    BasicBlock *Call = BasicBlock::Create(Context, "call", Guard);
+    BasicBlock *Return = BasicBlock::Create(Context, "return", Guard);
+    Value *Flag = new LoadInst(Ignored, "ignored", Entry);
+    Value *IsIgnored = new ICmpInst(*Entry, ICmpInst::ICMP_NE, Flag,
+                                    ConstantInt::get(Int8, 0));
+    BranchInst::Create(Return, Call, IsIgnored, Entry);
+    std::vector<Value*> Args;
+    for (Function::arg_iterator A = Guard->arg_begin(), E = Guard->arg_end();
+         A != E; ++A)
+      Args.push_back(A);
+    CallInst::Create(Callee, Args, "", Call);
+    BranchInst::Create(Return, Call);
+    ReturnInst::Create(Context, Return);
+  }
+  return Ignored;
+}
+
+bool CounterRegistry::runOnModule(Module &M) {
+  // The init calls are at the top of main, or of the profiling constructor
+  // of a module without main, the last one inserted first.
+  static const char *const Hosts[] = {
+    "main", "MAIN__", "llvm_profiling_init"
+  };
+  std::vector<CallInst*> Starts;
+  for (unsigned h = 0; h != array_lengthof(Hosts); ++h) {
+    Function *Host = M.getFunction(Hosts[h]);
+    if (!Host || Host->isDeclaration()) continue;
+    for (BasicBlock::iterator I = Host->begin()->begin(),
+         E = Host->begin()->end(); I != E; ++I)
+      if (CallInst *Call = dyn_cast<CallInst>(I))
+        if (RuntimeOf(Call)) Starts.push_back(Call);
+  }
+  if (Starts.empty()) return false;
+
+  // The counters of each runtime, and the ones its table points to.
+  SetVector<GlobalVariable*> Arrays;
+  for (unsigned i = 0; i != Starts.size(); ++i) {
+    Value *Start = Starts[i]->getArgOperand(2)->stripPointerCasts();
+    GlobalVariable *GV = dyn_cast<GlobalVariable>(Start);
+    if (!GV) continue;
+    if (isMovable(GV)) Arrays.insert(GV);
+    else if (GV->hasInitializer()) collectArrays(GV->getInitializer(), Arrays);
+  }
+
+  LLVMContext &Context = M.getContext();
+  Type *Int32 = Type::getInt32Ty(Context);
+  Type *Int64 = Type::getInt64Ty(Context);
+  Type *Int8Ptr = Type::getInt8PtrTy(Context);
+  Constant *Zero64 = ConstantInt::get(Int64, 0);
+
+  // Every array starts on a cache line of the region.
+  std::vector<Constant*> Initializer;
+  std::vector<unsigned> Offsets;
+  for (unsigned i = 0; i != Arrays.size(); ++i) {
+    Initializer.resize(RoundUpToAlignment(Initializer.size(), LineCounters),
+                       Zero64);
+    Offsets.push_back(Initializer.size());
+    Constant *Init = Arrays[i]->getInitializer();
+    unsigned N = cast<ArrayType>(Init->getType())->getNumElements();
+    for (unsigned e = 0; e != N; ++e)
+      Initializer.push_back(Init->getAggregateElement(e));
+  }
+  GlobalVariable *Region = 0;
+  if (!Arrays.empty()) {
+    ArrayType *ATy = ArrayType::get(Int64, Initializer.size());
+    Region = new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                                ConstantArray::get(ATy, Initializer),
+                                "ProfileCounters");
+    Region->setAlignment(LineCounters * sizeof(uint64_t));
+    NumRegionCounters += Initializer.size();
+  }
+  for (unsigned i = 0; i != Arrays.size(); ++i) {
+    Constant *Idx[] = { ConstantInt::get(Int32, 0),
+                        ConstantInt::get(Int32, Offsets[i]) };
+    Constant *Range = ConstantExpr::getGetElementPtr(Region, Idx);
+    Arrays[i]->replaceAllUsesWith(
+        ConstantExpr::getBitCast(Range, Arrays[i]->getType()));
+    DEBUG(dbgs() << "registry: " << Arrays[i]->getName() << " at "
+                 << Offsets[i] << "\n");
+    Arrays[i]->eraseFromParent();
+  }
+
+  // The table: the runtime, its counters, their number and the guard of its
+  // calls, after the module entry with no runtime, the module name and its
+  // hash.
+  StructType *EntryTy =
+    StructType::get(Int8Ptr, Int8Ptr, Int64, Int8Ptr, (Type*)0);
+  Constant *NameInit =
+    ConstantDataArray::getString(Context, M.getModuleIdentifier());
+  GlobalVariable *Name =
+    new GlobalVariable(M, NameInit->getType(), true,
+                       GlobalValue::PrivateLinkage, NameInit,
+                       "ProfileModuleName");
+  Constant *ModuleEntry[] = {
+    Constant::getNullValue(Int8Ptr),
+    ConstantExpr::getBitCast(Name, Int8Ptr),
+    ConstantInt::get(Int64, getProfileModuleHash(M)),
+    Constant::getNullValue(Int8Ptr)
+  };
+  std::vector<Constant*> Table(1, ConstantStruct::get(EntryTy, ModuleEntry));
+  for (unsigned i = 0; i != Starts.size(); ++i) {
+    std::string Symbol = std::string("llvm_") + RuntimeOf(Starts[i]) +
+                         "_runtime";
+    Constant *Runtime = M.getOrInsertGlobal(Symbol, Type::getInt8Ty(Context));
+    Constant *Counters = cast<Constant>(Starts[i]->getArgOperand(2));
+    uint64_t N = cast<ConstantInt>(Starts[i]->getArgOperand(3))
+                   ->getZExtValue();
+    GlobalVariable *Ignored = GuardModuleCalls(M, RuntimeOf(Starts[i]));
+    Constant *Entry[] = { ConstantExpr::getBitCast(Runtime, Int8Ptr),
+                          ConstantExpr::getBitCast(Counters, Int8Ptr),
+                          ConstantInt::get(Int64, N),
+                          Ignored ? cast<Constant>(Ignored)
+                                  : Constant::getNullValue(Int8Ptr) };
+    Table.push_back(ConstantStruct::get(EntryTy, Entry));
+    ++NumRuntimesRegistered;
+  }
+  ArrayType *TableTy = ArrayType::get(EntryTy, Table.size());
+  GlobalVariable *Registry =
+    new GlobalVariable(M, TableTy, true, GlobalValue::InternalLinkage,
+                       ConstantArray::get(TableTy, Table),
+                       "ProfileCounterRegistry");
+
+  // Each call passes on the argc it was given, drop them from the last.
+  for (unsigned i = Starts.size(); i-- != 0;) {
+    Function *Callee = Starts[i]->getCalledFunction();
+    Starts[i]->replaceAllUsesWith(Starts[i]->getArgOperand(0));
+    Starts[i]->eraseFromParent();
+    if (Callee->use_empty()) Callee->eraseFromParent();
+  }
+  InsertProfilingInitCall(M.getFunction("main"), "llvm_start_profile_registry",
+                          Registry);
+  return true;
+}
@@ -15,16 +15,33 @@
 // edge in the program, instead of using control flow information to prune the
 // number of counters inserted.
 //
+// The -insert-edge-profiling-sampled variant lowers the cost with bursty
+// sampling (Arnold and Ryder, "A Framework for Reducing the Cost of
+// Instrumented Code").  Every function gets a counting copy of its blocks,
+// and the original blocks are left without counters.  Check points at the
+// function entry and on every loop back edge tick a thread local countdown,
+// which sends the thread into the counting copy for -edge-profiling-sample-
+// burst of every -edge-profiling-sample-period check points.  The loader
+// scales the counts up by period / burst.
+//
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "insert-edge-profiling"
 
 #include "preheader.h"
 #include <llvm/Transforms/Instrumentation.h>
 #include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 #include "InitializeProfilerPass.h"
 #include "ProfileInstrumentations.h"
@@ -32,6 +49,16 @@
 using namespace llvm;
 
 STATISTIC(NumEdgesInserted, "The # of edges inserted.");
+STATISTIC(NumCheckPoints, "The # of sampling check points inserted.");
+
+static cl::opt<unsigned> SamplePeriod("edge-profiling-sample-period",
+      cl::init(1000),
+      cl::desc("With -insert-edge-profiling-sampled, the check points of "
+               "one sampling period"));
+static cl::opt<unsigned> SampleBurst("edge-profiling-sample-burst",
+      cl::init(10),
+      cl::desc("With -insert-edge-profiling-sampled, the check points of "
+               "each period which run the counting code"));
 
 namespace {
   class EdgeProfiler : public ModulePass {
@@ -46,6 +73,19 @@ namespace {
       return "Edge Profiler";
     }
   };
+
+  class SampledEdgeProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+    bool sampleFunction(Function &F, GlobalVariable *Tick,
+                        GlobalVariable *Counters, unsigned &i);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    SampledEdgeProfiler() : ModulePass(ID) {}
+
+    virtual const char *getPassName() const {
+      return "Sampled Edge Profiler";
+    }
+  };
 }
 
 char EdgeProfiler::ID = 0;
@@ -58,18 +98,46 @@ static RegisterPass<EdgeProfiler> X("insert-edge-profiling",
 
 ModulePass *llvm::createEdgeProfilerPass() { return new EdgeProfiler(); }
 
+char SampledEdgeProfiler::ID = 0;
+static RegisterPass<SampledEdgeProfiler> Y("insert-edge-profiling-sampled",
+		"Insert bursty sampled edge profiling instrumentation",false,false);
+
+ModulePass *llvm::createSampledEdgeProfilerPass() {
+  return new SampledEdgeProfiler();
+}
+
+// CountSuccessorEdges - Add a counter to each outgoing edge of BB, numbered
+// from i on.
+static void CountSuccessorEdges(BasicBlock *BB, Value *Base, unsigned &i,
+                                Pass *P) {
+  // Okay, we have to add a counter of each outgoing edge.  If the outgoing
+  // edge is not critical don't split it, just insert the counter in the
+  // source or destination of the edge.
+  TerminatorInst *TI = BB->getTerminator();
+  for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
+    // If the edge is critical, split it.
+    SplitCriticalEdge(TI, s, P);
+
+    // Okay, we are guaranteed that the edge is no longer critical.  If we
+    // only have a single successor, insert the counter in this block,
+    // otherwise insert it in the successor block.
+    if (TI->getNumSuccessors() == 1) {
+      // Insert counter at the end of the block
+      IncrementCounterInBlock(BB, i++, Base, false);
+    } else {
+      // Insert counter at the start of the block
+      IncrementCounterInBlock(TI->getSuccessor(s), i++, Base);
+    }
+  }
+}
+
 bool EdgeProfiler::runOnModule(Module &M) {
   Function *Main = M.getFunction("main");
-  if (Main == 0) {
-    errs() << "WARNING: cannot insert edge profiling into a module"
-           << " with no main function!\n";
-    return false;  // No main, no instrumentation!
-  }
 
   std::set<BasicBlock*> BlocksToInstrument;
   unsigned NumEdges = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (F->isDeclaration()) continue;
+    if (!isProfiledFunction(*F)) continue;
     // Reserve space for (0,entry) edge.
     ++NumEdges;
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -90,35 +158,227 @@ bool EdgeProfiler::runOnModule(Module &M) {
   // Instrument all of the edges...
   unsigned i = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (F->isDeclaration()) continue;
+    if (!isProfiledFunction(*F)) continue;
+    Value *Base = GetCounterBase(F, Counters, "llvm_edge_profiling_shard");
     // Create counter for (0,entry) edge.
-    IncrementCounterInBlock(&F->getEntryBlock(), i++, Counters);
+    IncrementCounterInBlock(&F->getEntryBlock(), i++, Base);
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
-      if (BlocksToInstrument.count(BB)) {  // Don't instrument inserted blocks
-        // Okay, we have to add a counter of each outgoing edge.  If the
-        // outgoing edge is not critical don't split it, just insert the counter
-        // in the source or destination of the edge.
-        TerminatorInst *TI = BB->getTerminator();
-        for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
-          // If the edge is critical, split it.
-          SplitCriticalEdge(TI, s, this);
-
-          // Okay, we are guaranteed that the edge is no longer critical.  If we
-          // only have a single successor, insert the counter in this block,
-          // otherwise insert it in the successor block.
-          if (TI->getNumSuccessors() == 1) {
-            // Insert counter at the end of the block
-            IncrementCounterInBlock(BB, i++, Counters, false);
-          } else {
-            // Insert counter at the start of the block
-            IncrementCounterInBlock(TI->getSuccessor(s), i++, Counters);
-          }
-        }
-      }
+      if (BlocksToInstrument.count(BB))  // Don't instrument inserted blocks
+        CountSuccessorEdges(BB, Base, i, this);
   }
 
   // Add the initialization call to main.
   InsertProfilingInitCall(Main, "llvm_start_edge_profiling", Counters);
+  MakeCountersLazy(Main, Counters);
+  return true;
+}
+
+
+// DemoteCrossBlockValues - Move the PHI nodes, and the values used outside
+// their block, to the stack like -reg2mem does.  Then the blocks of F only
+// share memory, and control can move between the two copies of a block at
+// any edge.
+static void DemoteCrossBlockValues(Function &F) {
+  BasicBlock *Entry = &F.getEntryBlock();
+  BasicBlock::iterator I = Entry->begin();
+  while (isa<AllocaInst>(I)) ++I;
+  Type *Int32Ty = Type::getInt32Ty(F.getContext());
+  Instruction *AllocaPoint =
+    new BitCastInst(Constant::getNullValue(Int32Ty), Int32Ty,
+                    "sample alloca point", I);
+
+  std::vector<Instruction*> Escaping;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+      if (isa<AllocaInst>(I) && BB == Entry) continue;
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+      for (Value::use_iterator U = I->use_begin(), UE = I->use_end();
+#else
+      for (Value::user_iterator U = I->user_begin(), UE = I->user_end();
+#endif
+           U != UE; ++U) {
+        Instruction *User = cast<Instruction>(*U);
+        if (User->getParent() != BB || isa<PHINode>(User)) {
+          Escaping.push_back(I);
+          break;
+        }
+      }
+    }
+  for (unsigned j = 0, e = Escaping.size(); j != e; ++j)
+    DemoteRegToStack(*Escaping[j], false, AllocaPoint);
+
+  std::vector<PHINode*> Phis;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    for (BasicBlock::iterator I = BB->begin(); isa<PHINode>(I); ++I)
+      Phis.push_back(cast<PHINode>(I));
+  for (unsigned j = 0, e = Phis.size(); j != e; ++j)
+    DemotePHIToStack(Phis[j], AllocaPoint);
+
+  AllocaPoint->eraseFromParent();
+}
+
+// CreateCheck - Return a new check point block of F.  It ticks the countdown
+// of the thread, starting a new period when it runs out, and goes on to
+// Counting for the last SampleBurst check points of each period and to
+// Checking otherwise.
+static BasicBlock *CreateCheck(Function &F, GlobalVariable *Tick,
+                               BasicBlock *Checking, BasicBlock *Counting) {
+  LLVMContext &Context = F.getContext();
+  BasicBlock *Check = BasicBlock::Create(Context, "sample.check", &F);
+  IRBuilder<> Builder(Check);
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Value *Left = Builder.CreateSub(Builder.CreateLoad(Tick),
+                                  ConstantInt::get(Int32Ty, 1));
+  Value *Over = Builder.CreateICmpEQ(Left, ConstantInt::get(Int32Ty, 0));
+  Left = Builder.CreateSelect(Over, ConstantInt::get(Int32Ty, SamplePeriod),
+                              Left);
+  Builder.CreateStore(Left, Tick);
+  Value *Sample = Builder.CreateICmpULE(Left,
+                                        ConstantInt::get(Int32Ty, SampleBurst));
+  Builder.CreateCondBr(Sample, Counting, Checking,
+                       MDBuilder(Context).createBranchWeights(
+                           SampleBurst, SamplePeriod - SampleBurst));
+  ++NumCheckPoints;
+  return Check;
+}
+
+// sampleFunction - Build the counting copy of F, with a counter on each of
+// its edges numbered from i on, and the check points which switch between
+// the copies.  Returns false, leaving F alone, if it can't be copied.
+bool SampledEdgeProfiler::sampleFunction(Function &F, GlobalVariable *Tick,
+                                         GlobalVariable *Counters,
+                                         unsigned &i) {
+  // A block address would still lead into the original blocks.
+  std::vector<BasicBlock*> Blocks;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    if (BB->hasAddressTaken()) return false;
+    Blocks.push_back(BB);
+  }
+
+  DemoteCrossBlockValues(F);
+
+  // The allocas stay in an entry block of their own, which both copies
+  // share, with the check point of the function entry behind them.  The rest
+  // of the entry block, with its terminator, takes its place in Blocks.
+  BasicBlock *Entry = &F.getEntryBlock();
+  BasicBlock::iterator Body = Entry->begin();
+  while (isa<AllocaInst>(Body)) ++Body;
+  BasicBlock *Start = Entry->splitBasicBlock(Body, "sample.start");
+  Blocks[0] = Start;
+
+  // Copy every other block, the copies are wired among themselves.
+  ValueToValueMapTy VMap;
+  std::vector<BasicBlock*> Originals;
+  for (Function::iterator BB = Start, E = F.end(); BB != E; ++BB)
+    Originals.push_back(BB);
+  for (unsigned j = 0, e = Originals.size(); j != e; ++j)
+    VMap[Originals[j]] = CloneBasicBlock(Originals[j], VMap, ".count", &F);
+  for (unsigned j = 0, e = Originals.size(); j != e; ++j) {
+    BasicBlock *Copy = cast<BasicBlock>(VMap[Originals[j]]);
+    for (BasicBlock::iterator I = Copy->begin(), E = Copy->end(); I != E; ++I)
+      RemapInstruction(I, VMap, RF_IgnoreMissingEntries);
+  }
+
+  // The retreating edges of a depth first walk are the loop back edges, so
+  // irreducible loops get a check point too.  Unwind edges can't be
+  // redirected, a loop closed by one has no check point.
+  std::vector<std::pair<BasicBlock*, unsigned> > BackEdges, Stack;
+  std::set<BasicBlock*> Visited, OnStack;
+  Stack.push_back(std::make_pair(Start, 0u));
+  Visited.insert(Start);
+  OnStack.insert(Start);
+  while (!Stack.empty()) {
+    BasicBlock *BB = Stack.back().first;
+    unsigned s = Stack.back().second++;
+    TerminatorInst *TI = BB->getTerminator();
+    if (s == TI->getNumSuccessors()) {
+      OnStack.erase(BB);
+      Stack.pop_back();
+      continue;
+    }
+    BasicBlock *Succ = TI->getSuccessor(s);
+    if (OnStack.count(Succ)) {
+      if (!Succ->isLandingPad())
+        BackEdges.push_back(std::make_pair(BB, s));
+    } else if (Visited.insert(Succ).second) {
+      OnStack.insert(Succ);
+      Stack.push_back(std::make_pair(Succ, 0u));
+    }
+  }
+
+  // Check points on the back edges of both copies, and at the entry.
+  for (unsigned j = 0, e = BackEdges.size(); j != e; ++j) {
+    BasicBlock *BB = BackEdges[j].first;
+    unsigned s = BackEdges[j].second;
+    BasicBlock *Header = BB->getTerminator()->getSuccessor(s);
+    BasicBlock *CountingHeader = cast<BasicBlock>(VMap[Header]);
+    BB->getTerminator()->setSuccessor(s,
+        CreateCheck(F, Tick, Header, CountingHeader));
+    cast<BasicBlock>(VMap[BB])->getTerminator()->setSuccessor(s,
+        CreateCheck(F, Tick, Header, CountingHeader));
+  }
+  Entry->getTerminator()->setSuccessor(0,
+      CreateCheck(F, Tick, Start, cast<BasicBlock>(VMap[Start])));
+
+  // Count the edges of the counting copy, in the order of EdgeProfiler.
+  Value *Base = GetCounterBase(&F, Counters, "llvm_edge_profiling_shard");
+  IncrementCounterInBlock(cast<BasicBlock>(VMap[Start]), i++, Base);
+  for (unsigned j = 0, e = Blocks.size(); j != e; ++j)
+    CountSuccessorEdges(cast<BasicBlock>(VMap[Blocks[j]]), Base, i, this);
   return true;
 }
 
+bool SampledEdgeProfiler::runOnModule(Module &M) {
+  Function *Main = M.getFunction("main");
+  if (SampleBurst == 0 || SampleBurst >= SamplePeriod) {
+    errs() << "ERROR: -edge-profiling-sample-burst must be at least 1 and"
+           << " less than -edge-profiling-sample-period!\n";
+    return false;
+  }
+
+  unsigned NumEdges = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isProfiledFunction(*F)) continue;
+    // Reserve space for (0,entry) edge.
+    ++NumEdges;
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+      NumEdges += BB->getTerminator()->getNumSuccessors();
+  }
+
+  // The runtime finds the period and the burst behind the counters.
+  LLVMContext &Context = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  std::vector<Constant*> Init(NumEdges + 2, ConstantInt::get(Int64Ty, 0));
+  Init[NumEdges] = ConstantInt::get(Int64Ty, SamplePeriod);
+  Init[NumEdges + 1] = ConstantInt::get(Int64Ty, SampleBurst);
+  ArrayType *ATy = ArrayType::get(Int64Ty, NumEdges + 2);
+  GlobalVariable *Counters =
+    new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                       ConstantArray::get(ATy, Init), "EdgeProfCounters");
+  NumEdgesInserted = NumEdges;
+
+  // The check points the thread has left in the current period.
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  GlobalVariable *Tick =
+    new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage,
+                       ConstantInt::get(Int32Ty, SamplePeriod),
+                       "EdgeProfSampleTick", 0,
+                       GlobalVariable::GeneralDynamicTLSModel);
+
+  unsigned i = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isProfiledFunction(*F)) continue;
+    unsigned First = i;
+    if (sampleFunction(*F, Tick, Counters, i)) continue;
+
+    errs() << "WARNING: " << F->getName() << " takes block addresses,"
+           << " its edges are not profiled!\n";
+    i = First + 1;
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+      i += BB->getTerminator()->getNumSuccessors();
+  }
+
+  // Add the initialization call to main.
+  InsertProfilingInitCall(Main, "llvm_start_sampled_edge_profiling", Counters);
+  return true;
+}
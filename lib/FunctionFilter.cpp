@@ -0,0 +1,184 @@
+//===- FunctionFilter.cpp - Choose the functions to profile ---------------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the function filter shared by the profiling passes and
+// the profile loader, so one hot library of a huge program can be profiled
+// without paying for the rest.  A function is profiled if it matches an allow
+// pattern (all do without any), no deny pattern, and took enough of the run
+// time of a previous profile.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "profile-function-filter"
+#include "preheader.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/raw_ostream.h>
+#include "FunctionFilter.h"
+#include "ProfileInfo.h"
+#include <fnmatch.h>
+#include <fstream>
+#include <map>
+#include <set>
+using namespace llvm;
+
+STATISTIC(NumFunctionsSkipped, "The # of functions left out of profiling.");
+
+static cl::list<std::string> AllowPatterns("profile-functions",
+      cl::value_desc("pattern"),
+      cl::desc("Only profile the functions matching one of these patterns: "
+               "a glob, re:<regex> or @<file> of patterns, one per line"));
+static cl::list<std::string> DenyPatterns("profile-skip-functions",
+      cl::value_desc("pattern"),
+      cl::desc("Don't profile the functions matching one of these patterns, "
+               "written like -profile-functions"));
+static cl::opt<std::string> HotProfile("profile-hot-functions",
+      cl::value_desc("filename"),
+      cl::desc("Only profile the functions which took at least "
+               "-profile-hot-threshold percent of the run time in this "
+               "profile of the whole program"));
+static cl::opt<double> HotThreshold("profile-hot-threshold", cl::init(1.0),
+      cl::value_desc("percent"),
+      cl::desc("The run time share below which -profile-hot-functions "
+               "skips a function (default 1)"));
+
+namespace {
+  // FunctionPatterns - The globs and regular expressions of a pattern list.
+  class FunctionPatterns {
+    std::vector<std::string> Globs;
+    std::vector<Regex*> Regexes;
+    void add(const std::string &Pattern);
+  public:
+    explicit FunctionPatterns(const cl::list<std::string> &List);
+    ~FunctionPatterns();
+    bool empty() const { return Globs.empty() && Regexes.empty(); }
+    bool match(StringRef Name) const;
+  };
+
+  // Selection - The functions of the module last asked about which are not
+  // profiled.
+  struct Selection {
+    const Module *M;
+    std::set<const Function*> Skipped;
+    bool Loading; // the hot profile is being read, the whole program counts
+  };
+}
+
+static Selection Cache = { 0, std::set<const Function*>(), false };
+
+FunctionPatterns::FunctionPatterns(const cl::list<std::string> &List) {
+  for (unsigned i = 0, e = List.size(); i != e; ++i) {
+    if (List[i].empty() || List[i][0] != '@') {
+      add(List[i]);
+      continue;
+    }
+    std::ifstream File(List[i].substr(1).c_str());
+    if (!File) {
+      errs() << "ERROR: cannot read the function list '"
+             << List[i].substr(1) << "'!\n";
+      exit(1);
+    }
+    std::string Line;
+    while (std::getline(File, Line)) {
+      StringRef Pattern = StringRef(Line).trim();
+      if (!Pattern.empty() && Pattern[0] != '#') add(Pattern.str());
+    }
+  }
+}
+
+FunctionPatterns::~FunctionPatterns() {
+  for (unsigned i = 0, e = Regexes.size(); i != e; ++i)
+    delete Regexes[i];
+}
+
+void FunctionPatterns::add(const std::string &Pattern) {
+  if (Pattern.compare(0, 3, "re:")) {
+    Globs.push_back(Pattern);
+    return;
+  }
+  // the whole name has to match, like a glob
+  Regex *R = new Regex("^(" + Pattern.substr(3) + ")$");
+  std::string Error;
+  if (!R->isValid(Error)) {
+    errs() << "ERROR: bad function pattern '" << Pattern << "': " << Error
+           << "\n";
+    exit(1);
+  }
+  Regexes.push_back(R);
+}
+
+bool FunctionPatterns::match(StringRef Name) const {
+  std::string N = Name.str();
+  for (unsigned i = 0, e = Globs.size(); i != e; ++i)
+    if (fnmatch(Globs[i].c_str(), N.c_str(), 0) == 0) return true;
+  for (unsigned i = 0, e = Regexes.size(); i != e; ++i)
+    if (Regexes[i]->match(Name)) return true;
+  return false;
+}
+
+// RunTimeShares - The share in percent of each function of M in the run time
+// of HotProfile, estimated as the instructions executed in its blocks.
+static void RunTimeShares(const Module &M,
+                          std::map<const Function*, double> &Shares) {
+  Cache.Loading = true;
+  ModulePass *Loader =
+    static_cast<ModulePass*>(createProfileLoaderPass(HotProfile));
+  Loader->runOnModule(const_cast<Module&>(M));
+  ProfileInfo *PI = static_cast<ProfileInfo*>(
+      Loader->getAdjustedAnalysisPointer(&ProfileInfo::ID));
+  double Total = 0;
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    double Weight = 0;
+    for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E;
+         ++BB) {
+      double Count = PI->getExecutionCount(BB);
+      if (Count > 0) Weight += Count * BB->size();
+    }
+    Shares[F] = Weight;
+    Total += Weight;
+  }
+  for (std::map<const Function*, double>::iterator I = Shares.begin(),
+       E = Shares.end(); I != E; ++I)
+    I->second = Total > 0 ? 100 * I->second / Total : 0;
+  delete Loader;
+  Cache.Loading = false;
+}
+
+// Select - Fill the cache with the functions of M which are not profiled.
+static void Select(const Module &M) {
+  Cache.M = &M;
+  Cache.Skipped.clear();
+  FunctionPatterns Allow(AllowPatterns), Deny(DenyPatterns);
+  std::map<const Function*, double> Shares;
+  if (!HotProfile.empty()) RunTimeShares(M, Shares);
+
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    bool Profiled = (Allow.empty() || Allow.match(F->getName())) &&
+                    !Deny.match(F->getName()) &&
+                    (HotProfile.empty() || Shares[F] >= HotThreshold);
+    if (Profiled) continue;
+    DEBUG(dbgs() << "not profiled: " << F->getName() << "\n");
+    Cache.Skipped.insert(F);
+    ++NumFunctionsSkipped;
+  }
+}
+
+bool llvm::isProfiledFunction(const Function &F) {
+  if (F.isDeclaration()) return false;
+  if (Cache.Loading) return true;
+  if (AllowPatterns.empty() && DenyPatterns.empty() && HotProfile.empty())
+    return true;
+  if (Cache.M != F.getParent()) Select(*F.getParent());
+  return !Cache.Skipped.count(&F);
+}
@@ -6,6 +6,7 @@
 #include <unordered_map>
 
 #include "ValueUtils.h"
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 #include "ProfileInstrumentations.h"
 #include "ProfileDataTypes.h"
@@ -37,23 +38,16 @@ static void IncrementMPICounter(Value* Inc, unsigned Index, GlobalVariable* Coun
    Constant *ElementPtr =
       ConstantExpr::getGetElementPtr(Counters, Indices);
 
-   // Load, increment and store the value back.
-   Value* OldVal = Builder.CreateLoad(ElementPtr, "OldMPICounter");
-   Value* NewVal = Builder.CreateAdd(OldVal, Inc, "NewMPICounter");
-   Builder.CreateStore(NewVal, ElementPtr);
+   IncrementCounter(Builder, ElementPtr, Inc);
 }
 
 bool MPIProfiler::runOnModule(llvm::Module &M)
 {
   Function *Main = M.getFunction("main");
-  if (Main == 0) {
-    errs() << "WARNING: cannot insert edge profiling into a module"
-           << " with no main function!\n";
-    return false;  // No main, no instrumentation!
-  }
 
   std::vector<std::pair<CallInst*,unsigned> > Traped;
   for(auto F = M.begin(), E = M.end(); F!=E; ++F){
+     if(!isProfiledFunction(*F)) continue;
      for(auto I = inst_begin(*F), IE = inst_end(*F); I!=IE; ++I){
         CallInst* CI = dyn_cast<CallInst>(&*I);
         if(CI == NULL) continue;
@@ -64,14 +58,15 @@ bool MPIProfiler::runOnModule(llvm::Module &M)
 
   IRBuilder<> Builder(M.getContext());
   Type* I32Ty = Type::getInt32Ty(M.getContext());
+  Type* I64Ty = Type::getInt64Ty(M.getContext());
   // 128位的映射表
   // 128位的访问表
-  Type*ATy = ArrayType::get(I32Ty, Traped.size() + FORTRAN_DATATYPE_MAP_SIZE * 2);
+  Type*ATy = ArrayType::get(I64Ty, Traped.size() + FORTRAN_DATATYPE_MAP_SIZE * 2);
   GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
         GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
         "MPICounters");
   Value* Zero = ConstantInt::get(I32Ty, 0);
-  Value* One = ConstantInt::get(I32Ty, 0);
+  Value* One = ConstantInt::get(I64Ty, 1);
   Value* MapTableBegin = ConstantInt::get(I32Ty, Traped.size());
   Value* VisitTableBegin = ConstantInt::get(I32Ty, Traped.size() + FORTRAN_DATATYPE_MAP_SIZE);
 
@@ -83,7 +78,8 @@ bool MPIProfiler::runOnModule(llvm::Module &M)
      Builder.CreateStore(One, Builder.CreateGEP(Counters, Idx));
      Idx[1] = Builder.CreateAdd(MapTableBegin, FortranDT);
      Value* DataSize = Builder.CreateLoad(Builder.CreateGEP(Counters, Idx));
-     Value* Count = Builder.CreateLoad(P.first->getArgOperand(P.second));
+     Value* Count = Builder.CreateZExtOrBitCast(
+           Builder.CreateLoad(P.first->getArgOperand(P.second)), I64Ty);
      //trap for count * datasize
      IncrementMPICounter(Builder.CreateMul(Count, DataSize), I++, Counters, Builder);
   }
@@ -11,6 +11,11 @@
 // Edge profiling can give a reasonable approximation of the hot paths through a
 // program, and is used for a wide variety of program transformations.
 //
+// Only the edges outside a maximum spanning tree of each function get a
+// counter.  The tree is weighted by ProfileEstimator, or with
+// -optimal-edge-profiling-training by the counts of a training run, which
+// puts the really hot edges into the tree.
+//
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "insert-optimal-edge-profiling"
 using namespace std;
@@ -22,9 +27,11 @@ using namespace std;
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
@@ -34,6 +41,12 @@ using namespace std;
 using namespace llvm;
 
 STATISTIC(NumEdgesInserted, "The # of edges inserted.");
+STATISTIC(NumTrainedFunctions, "The # of functions weighted by the training profile.");
+
+static cl::opt<std::string> TrainingProfile("optimal-edge-profiling-training",
+      cl::value_desc("filename"),
+      cl::desc("Weight the spanning trees of -insert-optimal-edge-profiling "
+               "with the edge counts of this profile of a training run"));
 
 namespace {
   class OptimalEdgeProfiler : public ModulePass {
@@ -84,11 +97,6 @@ inline static void printEdgeCounter(ProfileInfo::Edge e,
 
 bool OptimalEdgeProfiler::runOnModule(Module &M) {
   Function *Main = M.getFunction("main");
-  if (Main == 0) {
-    errs() << "WARNING: cannot insert edge profiling into a module"
-           << " with no main function!\n";
-    return false;  // No main, no instrumentation!
-  }
 
   // NumEdges counts all the edges that may be instrumented. Later on its
   // decided which edges to actually instrument, to achieve optimal profiling.
@@ -99,7 +107,7 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   unsigned NumEdges = 0;
 
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (F->isDeclaration()) continue;
+    if (!isProfiledFunction(*F)) continue;
     // Reserve space for (0,entry) edge.
     ++NumEdges;
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -122,21 +130,34 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   // be calculated from other edge counters on reading the profile info back
   // in.
 
-  Type *Int32 = Type::getInt32Ty(M.getContext());
-  ArrayType *ATy = ArrayType::get(Int32, NumEdges);
+  Type *Int64 = Type::getInt64Ty(M.getContext());
+  ArrayType *ATy = ArrayType::get(Int64, NumEdges);
   GlobalVariable *Counters =
     new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
                        Constant::getNullValue(ATy), "OptEdgeProfCounters");
   NumEdgesInserted = 0;
 
   std::vector<Constant*> Initializer(NumEdges);
-  Constant *Zero = ConstantInt::get(Int32, 0);
-  Constant *Uncounted = ConstantInt::get(Int32, ProfileInfoLoader::Uncounted);
+  Constant *Zero = ConstantInt::get(Int64, 0);
+  Constant *Uncounted = ConstantInt::get(Int64, ProfileInfoLoader::Uncounted);
+
+  // The training profile is read by a loader of our own, the ProfileInfo of
+  // the pass manager is the estimator.  It has no analysis to ask for, so it
+  // can run without a pass manager.
+  ModulePass *Training = 0;
+  ProfileInfo *TrainingPI = 0;
+  if (!TrainingProfile.empty()) {
+    Training = static_cast<ModulePass*>(
+        createProfileLoaderPass(TrainingProfile));
+    Training->runOnModule(M);
+    TrainingPI = static_cast<ProfileInfo*>(
+        Training->getAdjustedAnalysisPointer(&ProfileInfo::ID));
+  }
 
   // Instrument all of the edges not in MST...
   unsigned i = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (F->isDeclaration()) continue;
+    if (!isProfiledFunction(*F)) continue;
     DEBUG(dbgs() << "Working on " << F->getName() << "\n");
 
     // Calculate a Maximum Spanning Tree with the edge weights determined by
@@ -146,8 +167,22 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
     // The third parameter of MaximumSpanningTree() has the effect that not the
     // actual MST is returned but the edges _not_ in the MST.
 
-    ProfileInfo::EdgeWeights ECs =
-      getAnalysis<ProfileInfo>(*F).getEdgeWeights(F);
+    ProfileInfo::EdgeWeights ECs;
+    if (TrainingPI && !TrainingPI->getEdgeWeights(F).empty()) {
+      // A function which didn't run in training keeps the estimated weights.
+      // An edge profile has no counters for the virtual (BB,0) edges, they
+      // get the count of their block.
+      ECs = TrainingPI->getEdgeWeights(F);
+      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+        ProfileInfo::Edge edge = ProfileInfo::getEdge(BB, 0);
+        if (BB->getTerminator()->getNumSuccessors() == 0 && !ECs.count(edge)) {
+          double w = TrainingPI->getExecutionCount(BB);
+          if (w != ProfileInfo::MissingValue) ECs[edge] = w;
+        }
+      }
+      ++NumTrainedFunctions;
+    } else
+      ECs = getAnalysis<ProfileInfo>(*F).getEdgeWeights(F);
     std::vector<ProfileInfo::EdgeWeight> EdgeVector(ECs.begin(), ECs.end());
     MaximumSpanningTree<BasicBlock> MST(EdgeVector);
     std::stable_sort(MST.begin(), MST.end());
@@ -223,6 +258,7 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   // Check if the number of edges counted at first was the number of edges we
   // considered for instrumentation.
   assert(i == NumEdges && "the number of edges in counting array is wrong");
+  delete Training;
 
   // Assign the now completely defined initialiser to the array.
   Constant *init = ConstantArray::get(ATy, Initializer);
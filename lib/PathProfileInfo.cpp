@@ -20,11 +20,15 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
+#include "ProfilePacketReader.h"
 #include "PathProfileInfo.h"
 #include "InitializeProfilerPass.h"
 #include "ProfileInstrumentations.h"
 #include <cstdio>
+#include <cstring>
+#include <unistd.h>
 
 using namespace llvm;
 
@@ -68,17 +72,16 @@ namespace {
     void buildFunctionRefs(Module &M);
 
     // process argument info of a program from the input file
-    void handleArgumentInfo();
+    void handleArgumentInfo(const char* data);
 
-    // process path number information from the input file
-    void handlePathInfo();
+    // process path number information from the input file, EntryT is the
+    // table entry of a PathInfo or a PathInfo64 packet
+    template<class EntryT> void handlePathInfo(const char* data,
+                                               const char* end);
 
     // array of references to the functions in the module
     std::vector<Function*> _functions;
 
-    // path profile file handle
-    FILE* _file;
-
     // path profile file name
     std::string _filename;
   };
@@ -113,7 +116,7 @@ ProfilePathEdge::ProfilePathEdge (BasicBlock* source, BasicBlock* target,
 // Path implementation
 //
 
-ProfilePath::ProfilePath (unsigned int number, unsigned int count,
+ProfilePath::ProfilePath (unsigned int number, uint64_t count,
                           double countStdDev,   PathProfileInfo* ppi)
   : _number(number) , _count(count), _countStdDev(countStdDev), _ppi(ppi) {}
 
@@ -296,30 +299,49 @@ bool PathProfileLoaderPass::runOnModule(Module &M) {
   _filename = PathProfileInfoFilename;
   buildFunctionRefs (M);
 
-  if (!(_file = fopen(_filename.c_str(), "rb"))) {
+  if (access(_filename.c_str(), R_OK) != 0) {
     errs () << "error: input '" << _filename << "' file does not exist.\n";
     return false;
   }
 
-  ProfilingType profType;
+  // the packets are read in place, the ones of other profiles and of other
+  // modules of the process are skipped
+  ProfilePacketReader reader("path-profile-loader", _filename);
+  uint64_t moduleHash = getProfileModuleHash(M);
+  bool otherModule = false;
+  const std::vector<ProfilePacket>& packets = reader.packets();
+  for (size_t i = 0; i < packets.size(); i++) {
+    const ProfilePacket& packet = packets[i];
+    const char* data = reader.getData(packet);
+    if (packet.ShouldByteSwap) {
+      errs() << "error: path profile of another byte order\n";
+      return false;
+    }
 
-  while( fread(&profType, sizeof(ProfilingType), 1, _file) ) {
-    switch (profType) {
+    switch (packet.Type) {
     case ArgumentInfo:
-      handleArgumentInfo ();
+      otherModule = false;
+      handleArgumentInfo (data);
       break;
+    case ModuleInfo64: {
+      uint64_t hash;
+      memcpy(&hash, data + sizeof(uint64_t), sizeof(hash));
+      otherModule = hash != moduleHash;
+      break;
+    }
     case PathInfo:
-      handlePathInfo ();
+      if (!otherModule)
+        handlePathInfo<PathProfileTableEntry> (data, data + packet.Size);
+      break;
+    case PathInfo64:
+      if (!otherModule)
+        handlePathInfo<PathProfileTableEntry64> (data, data + packet.Size);
       break;
     default:
-      errs () << "error: bad path profiling file syntax, " << profType << "\n";
-      fclose (_file);
-      return false;
+      break;
     }
   }
 
-  fclose (_file);
-
   return true;
 }
 
@@ -335,71 +357,49 @@ void PathProfileLoaderPass::buildFunctionRefs (Module &M) {
 }
 
 // handle command like argument infor in the output file
-void PathProfileLoaderPass::handleArgumentInfo() {
-  // get the argument list's length
+void PathProfileLoaderPass::handleArgumentInfo(const char* data) {
+  // the argument list's length, then the arguments
   unsigned savedArgsLength;
-  if( fread(&savedArgsLength, sizeof(unsigned), 1, _file) != 1 ) {
-    errs() << "warning: argument info header/data mismatch\n";
-    return;
-  }
-
-  // allocate a buffer, and get the arguments
-  char* args = new char[savedArgsLength+1];
-  if( fread(args, 1, savedArgsLength, _file) != savedArgsLength )
-    errs() << "warning: argument info header/data mismatch\n";
-
-  args[savedArgsLength] = '\0';
-  argList = std::string(args);
-  delete [] args; // cleanup dynamic string
-
-  // byte alignment
-  if (savedArgsLength & 3)
-    fseek(_file, 4-(savedArgsLength&3), SEEK_CUR);
+  memcpy(&savedArgsLength, data, sizeof(unsigned));
+  argList = std::string(data + sizeof(unsigned), savedArgsLength);
 }
 
 // Handle path profile information in the output file
-void PathProfileLoaderPass::handlePathInfo () {
+template<class EntryT>
+void PathProfileLoaderPass::handlePathInfo (const char* data,
+                                            const char* end) {
   // get the number of functions in this profile
   unsigned functionCount;
-  if( fread(&functionCount, sizeof(functionCount), 1, _file) != 1 ) {
-    errs() << "warning: path info header/data mismatch\n";
-    return;
-  }
+  memcpy(&functionCount, data, sizeof(functionCount));
+  data += sizeof(functionCount);
 
-  // gather path information for each function
+  // gather path information for each function, the entries are read in
+  // place
   for (unsigned i = 0; i < functionCount; i++) {
     PathProfileHeader pathHeader;
-    if( fread(&pathHeader, sizeof(pathHeader), 1, _file) != 1 ) {
+    memcpy(&pathHeader, data, sizeof(pathHeader));
+    data += sizeof(pathHeader);
+    if (pathHeader.fnNumber >= _functions.size()) {
       errs() << "warning: bad header for path function info\n";
-      break;
+      return;
     }
 
     Function* f = _functions[pathHeader.fnNumber];
 
-    // dynamically allocate a table to store path numbers
-    PathProfileTableEntry* pathTable =
-      new PathProfileTableEntry[pathHeader.numEntries];
-
-    if( fread(pathTable, sizeof(PathProfileTableEntry),
-              pathHeader.numEntries, _file) != pathHeader.numEntries) {
-      delete [] pathTable;
-      errs() << "warning: path function info header/data mismatch\n";
-      return;
-    }
-
     // Build a new path for the current function
-    unsigned int totalPaths = 0;
+    uint64_t totalPaths = 0;
     for (unsigned int j = 0; j < pathHeader.numEntries; j++) {
-      totalPaths += pathTable[j].pathCounter;
-      _functionPaths[f][pathTable[j].pathNumber]
-        = new ProfilePath(pathTable[j].pathNumber, pathTable[j].pathCounter,
-                          0, this);
+      EntryT entry;
+      memcpy(&entry, data, sizeof(entry));
+      data += sizeof(entry);
+      totalPaths += entry.pathCounter;
+      _functionPaths[f][entry.pathNumber]
+        = new ProfilePath(entry.pathNumber, entry.pathCounter, 0, this);
     }
 
     _functionPathCounts[f] = totalPaths;
-
-    delete [] pathTable;
   }
+  assert(data <= end && "the packet index checked the path tables");
 }
 
 //===----------------------------------------------------------------------===//
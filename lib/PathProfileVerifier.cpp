@@ -109,7 +109,7 @@ bool PathProfileVerifier::runOnModule (Module &M) {
     }
   }
 
-  std::vector<unsigned> edgeArray(i);
+  std::vector<uint64_t> edgeArray(i);
 
   // iterate through each path and increment the edge counters as needed
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
@@ -197,15 +197,15 @@ bool PathProfileVerifier::runOnModule (Module &M) {
   if (num&3)
     fwrite(&zeros, 1, 4-(num&3), edgeFile);
 
-  type = EdgeInfo;
-  num = edgeArray.size();
+  type = EdgeInfo64;
+  uint64_t num64 = edgeArray.size();
   fwrite(&type,sizeof(unsigned),1,edgeFile);
-  fwrite(&num,sizeof(unsigned),1,edgeFile);
+  fwrite(&num64,sizeof(uint64_t),1,edgeFile);
 
   // write each edge to the file
-  for( std::vector<unsigned>::iterator s = edgeArray.begin(),
+  for( std::vector<uint64_t>::iterator s = edgeArray.begin(),
          e = edgeArray.end(); s != e; s++)
-    fwrite(&*s, sizeof (unsigned), 1, edgeFile);
+    fwrite(&*s, sizeof (uint64_t), 1, edgeFile);
 
   fclose (edgeFile);
 
@@ -61,6 +61,7 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Support/FileSystem.h>
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 #include "PathNumbering.h"
 #include "InitializeProfilerPass.h"
@@ -275,6 +276,14 @@ private:
   Constant* llvmIncrementHashFunction;
   Constant* llvmDecrementHashFunction;
 
+  // The runtime function called when a path misses the inline path cache.
+  Constant* llvmFillCacheFunction;
+
+  // The path cache of the current function, if it is hashed and cached, and
+  // the runtime hash calls to replace by cache lookups.
+  GlobalVariable* currentPathCache;
+  std::vector<CallInst*> hashIncrements;
+
   // Instruments each function with path profiling.  'main' is instrumented
   // with code to save the profile to disk.
   bool runOnModule(Module &M);
@@ -318,6 +327,13 @@ private:
     BLInstrumentationDag* dag,
     bool increment = true);
 
+  // Creates the path cache of a hashed function.
+  GlobalVariable* createPathCache(Module &M);
+
+  // Replaces a runtime hash call with a lookup in the function's path
+  // cache, which only calls the runtime on a miss.
+  void insertCachedIncrement(CallInst* hashCall);
+
   // A PHINode is created in the node, and its values initialized to -1U.
   void preparePHI(BLInstrumentationNode* node);
 
@@ -361,6 +377,12 @@ public:
 static cl::opt<bool> DotPathDag("path-profile-pathdag", cl::Hidden,
         cl::desc("Output the path profiling DAG for each function."));
 
+// Size of the inline cache in front of hashed path counters
+static cl::opt<unsigned> PathCacheSlots("path-profile-cache-slots",
+        cl::init(16), cl::value_desc("N"),
+        cl::desc("Slots of the inline cache of recent path numbers in front "
+                 "of hashed path counters, a power of two, 0 disables it"));
+
 // Register the path profiler as a pass
 char PathProfiler::ID = 0;
 INITIALIZE_PASS(PathProfiler, "insert-path-profiling",
@@ -905,7 +927,7 @@ int BLInstrumentationDag::calculateChordIncrementsDir(BallLarusEdge* e,
 // Creates an increment constant representing incr.
 ConstantInt* PathProfiler::createIncrementConstant(long incr,
                                                    int bitsize) {
-  return(ConstantInt::get(IntegerType::get(*Context, 32), incr));
+  return(ConstantInt::get(IntegerType::get(*Context, bitsize), incr));
 }
 
 // Creates an increment constant representing the value in
@@ -1047,21 +1069,11 @@ void PathProfiler::insertCounterIncrement(Value* incValue,
     // Load from the array - call it oldPC
     LoadInst* oldPc = new LoadInst(pcPointer, "oldPC", insertPoint);
 
-    // Test to see whether adding 1 will overflow the counter
-    ICmpInst* isMax = new ICmpInst(insertPoint, CmpInst::ICMP_ULT, oldPc,
-                                   createIncrementConstant(0xffffffff, 32),
-                                   "isMax");
-
-    // Select increment for the path counter based on overflow
-    SelectInst* inc =
-      SelectInst::Create( isMax, createIncrementConstant(increment?1:-1,32),
-                          createIncrementConstant(0,32),
-                          "pathInc", insertPoint);
-
-    // newPc = oldPc + inc
+    // newPc = oldPc + inc, the 64 bit counters don't saturate
     BinaryOperator* newPc = BinaryOperator::Create(Instruction::Add,
-                                                   oldPc, inc, "newPC",
-                                                   insertPoint);
+                                   oldPc,
+                                   createIncrementConstant(increment?1:-1,64),
+                                   "newPC", insertPoint);
 
     // Store back in to the array
     new StoreInst(newPc, pcPointer, insertPoint);
@@ -1071,12 +1083,76 @@ void PathProfiler::insertCounterIncrement(Value* incValue,
                                currentFunctionNumber);
     args[1] = incValue;
 
-    CallInst::Create(
+    CallInst* hashCall = CallInst::Create(
       increment ? llvmIncrementHashFunction : llvmDecrementHashFunction,
       args, "", insertPoint);
+
+    // expanded once the whole function is instrumented, because it splits
+    // blocks the dag still refers to
+    if( currentPathCache )
+      hashIncrements.push_back(hashCall);
   }
 }
 
+// The path cache is { i8* hash table, i32 slot count, i32 padding,
+// [slots x { i64 pathNumber + 1, i64 delta }] }, see pathCache_t in the
+// runtime.  The tag of the last path number doesn't wrap to 0, the tag of
+// an unused slot.
+GlobalVariable* PathProfiler::createPathCache(Module &M) {
+  Type* int32 = Type::getInt32Ty(*Context);
+  Type* int64 = Type::getInt64Ty(*Context);
+  Type* voidPtr = TypeBuilder<types::i<8>*, true>::get(*Context);
+  ArrayType* slotsType = ArrayType::get(
+    StructType::get(int64, int64, NULL), PathCacheSlots);
+  StructType* cacheType =
+    StructType::get(voidPtr, int32, int32, slotsType, NULL);
+
+  std::vector<Constant*> cacheInit(4);
+  cacheInit[0] = Constant::getNullValue(voidPtr);
+  cacheInit[1] = createIncrementConstant(PathCacheSlots, 32);
+  cacheInit[2] = createIncrementConstant(0, 32);
+  cacheInit[3] = Constant::getNullValue(slotsType);
+
+  return new GlobalVariable(M, cacheType, false, GlobalValue::InternalLinkage,
+                            ConstantStruct::get(cacheType, cacheInit),
+                            "pathCache");
+}
+
+// Probes the slot pathNumber % slots of the path cache.  On a hit only the
+// slot's delta is updated, on a miss llvm_path_cache_fill first evicts the
+// slot's path to the hash table and gives the slot to pathNumber.
+void PathProfiler::insertCachedIncrement(CallInst* hashCall) {
+  bool increment = hashCall->getCalledValue() == llvmIncrementHashFunction;
+  Value* pathNumber = hashCall->getArgOperand(1);
+  IRBuilder<> Builder(hashCall);
+
+  Value* slot = Builder.CreateAnd(pathNumber, PathCacheSlots - 1, "cacheSlot");
+  Value* indices[] = { Builder.getInt32(0), Builder.getInt32(3), slot,
+                       Builder.getInt32(0) };
+  Value* tag = Builder.CreateLoad(
+    Builder.CreateInBoundsGEP(currentPathCache, indices), "cacheTag");
+  Value* wanted = Builder.CreateAdd(
+    Builder.CreateZExt(pathNumber, Builder.getInt64Ty()), Builder.getInt64(1));
+  Value* miss = Builder.CreateICmpNE(tag, wanted, "cacheMiss");
+
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+  TerminatorInst* fill =
+    SplitBlockAndInsertIfThen(cast<Instruction>(miss), false);
+#else
+  TerminatorInst* fill = SplitBlockAndInsertIfThen(miss, hashCall, false);
+#endif
+  Value* args[] = { hashCall->getArgOperand(0), pathNumber };
+  CallInst::Create(llvmFillCacheFunction, args, "", fill);
+
+  Builder.SetInsertPoint(hashCall);
+  indices[3] = Builder.getInt32(1);
+  Value* deltaPtr = Builder.CreateInBoundsGEP(currentPathCache, indices);
+  Value* delta = Builder.CreateLoad(deltaPtr, "cacheDelta");
+  Builder.CreateStore(
+    Builder.CreateAdd(delta, Builder.getInt64(increment ? 1 : -1)), deltaPtr);
+  hashCall->eraseFromParent();
+}
+
 // Inserts instrumentation for the given edge
 //
 // Pre: The edge's source node has pathNumber set if edge is non zero
@@ -1300,22 +1376,31 @@ void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
 
   // Should we store the information in an array or hash
   if( dag.getNumberOfPaths() <= HASH_THRESHHOLD ) {
-    Type* t = ArrayType::get(Type::getInt32Ty(*Context),
+    Type* t = ArrayType::get(Type::getInt64Ty(*Context),
                                    dag.getNumberOfPaths());
 
     dag.setCounterArray(new GlobalVariable(M, t, false,
                                            GlobalValue::InternalLinkage,
                                            Constant::getNullValue(t), ""));
-  }
+    currentPathCache = NULL;
+  } else
+    currentPathCache = PathCacheSlots ? createPathCache(M) : NULL;
 
   insertInstrumentation(dag, M);
 
+  for( std::vector<CallInst*>::iterator I = hashIncrements.begin(),
+         E = hashIncrements.end(); I != E; ++I )
+    insertCachedIncrement(*I);
+  hashIncrements.clear();
+
   // Add to global function reference table
   unsigned type;
   Type* voidPtr = TypeBuilder<types::i<8>*, true>::get(*Context);
 
   if( dag.getNumberOfPaths() <= HASH_THRESHHOLD )
     type = ProfilingArray;
+  else if( currentPathCache )
+    type = ProfilingCachedHash;
   else
     type = ProfilingHash;
 
@@ -1324,6 +1409,7 @@ void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
   entryArray[1] = createIncrementConstant(dag.getNumberOfPaths(),32);
   entryArray[2] = dag.getCounterArray() ?
     ConstantExpr::getBitCast(dag.getCounterArray(), voidPtr) :
+    currentPathCache ? ConstantExpr::getBitCast(currentPathCache, voidPtr) :
     Constant::getNullValue(voidPtr);
 
   StructType* at = ftEntryTypeBuilder::get(*Context);
@@ -1349,19 +1435,12 @@ bool PathProfiler::runOnModule(Module &M) {
         << "****************************************\n"
         << "****************************************\n");
 
-  // No main, no instrumentation!
   Function *Main = M.getFunction("main");
 
   // Using fortran? ... this kind of works
   if (!Main)
     Main = M.getFunction("MAIN__");
 
-  if (!Main) {
-    errs() << "WARNING: cannot insert path profiling into a module"
-           << " with no main function!\n";
-    return false;
-  }
-
   llvmIncrementHashFunction = M.getOrInsertFunction(
     "llvm_increment_path_count",
     Type::getVoidTy(*Context), // return type
@@ -1376,6 +1455,19 @@ bool PathProfiler::runOnModule(Module &M) {
     Type::getInt32Ty(*Context), // path number
     NULL );
 
+  llvmFillCacheFunction = M.getOrInsertFunction(
+    "llvm_path_cache_fill",
+    Type::getVoidTy(*Context), // return type
+    Type::getInt32Ty(*Context), // function number
+    Type::getInt32Ty(*Context), // path number
+    NULL );
+
+  if( PathCacheSlots & (PathCacheSlots - 1) ) {
+    errs() << "WARNING: -path-profile-cache-slots is not a power of two,"
+           << " the path cache is disabled\n";
+    PathCacheSlots = 0;
+  }
+
   std::vector<Constant*> ftInit;
   unsigned functionNumber = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
@@ -1387,6 +1479,18 @@ bool PathProfiler::runOnModule(Module &M) {
 
     // set function number
     currentFunctionNumber = functionNumber;
+    if (!isProfiledFunction(*F)) {
+      // The runtime finds a function by its number, a function which is not
+      // profiled keeps its place with an empty table.
+      std::vector<Constant*> entryArray(3);
+      entryArray[0] = createIncrementConstant(ProfilingArray,32);
+      entryArray[1] = createIncrementConstant(0,32);
+      entryArray[2] = Constant::getNullValue(
+          TypeBuilder<types::i<8>*, true>::get(*Context));
+      ftInit.push_back(ConstantStruct::get(ftEntryTypeBuilder::get(*Context),
+                                           entryArray));
+      continue;
+    }
     runOnFunction(ftInit, *F, M);
   }
 
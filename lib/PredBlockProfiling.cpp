@@ -1,5 +1,6 @@
 #include "preheader.h"
 #include "PredBlockProfiling.h"
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 
 #include <llvm/IR/Module.h>
@@ -23,23 +24,23 @@ PredBlockProfiler::PredBlockProfiler():ModulePass(ID)
 }
 
 
-static void IncrementBlockCounters(llvm::Value* Inc, unsigned Index, GlobalVariable* Counters, IRBuilder<>& Builder)
+static void IncrementBlockCounters(llvm::Value* Inc, unsigned Index, Value* Counters, IRBuilder<>& Builder)
 {
    LLVMContext &Context = Inc->getContext();
 
-   // Create the getelementptr constant expression
-   std::vector<Constant*> Indices(2);
-   Indices[0] = Constant::getNullValue(Type::getInt32Ty(Context));
-   Indices[1] = ConstantInt::get(Type::getInt32Ty(Context), Index);
-   Constant *ElementPtr =
-      ConstantExpr::getGetElementPtr(Counters, Indices);
+   Value *ElementPtr;
+   if (GlobalVariable* Array = dyn_cast<GlobalVariable>(Counters)) {
+      // Create the getelementptr constant expression
+      std::vector<Constant*> Indices(2);
+      Indices[0] = Constant::getNullValue(Type::getInt32Ty(Context));
+      Indices[1] = ConstantInt::get(Type::getInt32Ty(Context), Index);
+      ElementPtr = ConstantExpr::getGetElementPtr(Array, Indices);
+   } else // the thread's shard
+      ElementPtr = Builder.CreateConstGEP1_32(Counters, Index);
 
-   // Load, increment and store the value back.
-   Value* OldVal = Builder.CreateLoad(ElementPtr, "OldBlockCounter");
-   Value* NewVal = Builder.CreateAdd(
-       OldVal, Builder.CreateZExtOrBitCast(Inc, Type::getInt64Ty(Context)),
-       "NewBlockCounter");
-   Builder.CreateStore(NewVal, ElementPtr);
+   IncrementCounter(
+       Builder, ElementPtr,
+       Builder.CreateZExtOrBitCast(Inc, Type::getInt64Ty(Context)));
 }
 
 bool PredBlockProfiler::runOnModule(Module& M)
@@ -49,7 +50,7 @@ bool PredBlockProfiler::runOnModule(Module& M)
 
    unsigned NumBlocks = 0;
    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) 
-      NumBlocks += F->size();
+      if (isProfiledFunction(*F)) NumBlocks += F->size();
 
 	Type*ATy = ArrayType::get(Type::getInt64Ty(M.getContext()),NumBlocks);
 	GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
@@ -57,11 +58,16 @@ bool PredBlockProfiler::runOnModule(Module& M)
 			"BlockPredCounters");
 
    for(auto F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(!isProfiledFunction(*F)) continue;
+      Value* Base = NULL; // fetched once per function which has traps
       for(auto BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
          auto Found = BlockTraps.find(BB);
          if(Found == BlockTraps.end()){
             Idx++;
          }else{
+            if(Base == NULL)
+               Base = GetCounterBase(F, Counters,
+                                     "llvm_pred_block_profiling_shard");
             Value* Inc = Found->second.first;
             Value* InsertPos = Found->second.second;
             if(BasicBlock* InsertBB = dyn_cast<BasicBlock>(InsertPos))
@@ -69,12 +75,13 @@ bool PredBlockProfiler::runOnModule(Module& M)
             else if(Instruction* InsertI = dyn_cast<Instruction>(InsertPos))
                Builder.SetInsertPoint(InsertI);
             else assert(0 && "unknow insert position type");
-            IncrementBlockCounters(Inc, Idx++, Counters, Builder);
+            IncrementBlockCounters(Inc, Idx++, Base, Builder);
          }
       }
    }
 
 	Function* Main = M.getFunction("main");
 	InsertProfilingInitCall(Main, "llvm_start_pred_block_profiling", Counters);
+	MakeCountersLazy(Main, Counters);
 	return true;
 }
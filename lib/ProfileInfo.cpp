@@ -119,6 +119,18 @@ ProfileInfoT<Function,BasicBlock>::getValueContents(const CallInst* V) {
 	return MissingContent;
 }
 
+template<> const std::vector<ValueSummaryEntry>&
+ProfileInfoT<Function,BasicBlock>::getValueTopK(const CallInst* V,
+                                                uint64_t* Others) {
+	static std::vector<ValueSummaryEntry> MissingTopK;
+	std::map<const CallInst*,ValueCounts>::iterator J =
+		ValueInformation.find(V);
+	if(Others) *Others = 0;
+	if(J == ValueInformation.end()) return MissingTopK;
+	if(Others) *Others = J->second.Others;
+	return J->second.TopK;
+}
+
 template<> unsigned
 ProfileInfoT<Function,BasicBlock>::getTrapedIndex(const Instruction* V) 
 {
@@ -18,9 +18,16 @@
 #include <llvm/Support/raw_ostream.h>
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
+#include "ProfilePacketReader.h"
+#include "ProfileVarint.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <map>
 #include <vector>
 using namespace llvm;
 
@@ -66,15 +73,30 @@ static inline uint64_t ByteSwap(uint64_t Var, bool Really)
           ((Var & (255UL << 56U)) >> 56U);
 }
 
-static uint64_t AddCounts(uint64_t A, uint64_t B) {
-  // If either value is undefined, use the other.
-  if (A == ProfileInfoLoader::Uncounted) return B;
-  if (B == ProfileInfoLoader::Uncounted) return A;
+template<class IntT>
+static IntT AddCounts(IntT A, IntT B) {
+  // If either value is undefined, use the other.  Uncounted is all ones in
+  // the width of the packet.
+  const IntT Undefined = (IntT)ProfileInfoLoader::Uncounted;
+  if (A == Undefined) return B;
+  if (B == Undefined) return A;
   return A + B;
 }
 
+// AddCounts32 - Accumulate the counters of a 32 bit packet into Data.
+static void AddCounts32(const std::vector<unsigned> &Counts,
+                        std::vector<uint64_t> &Data) {
+  if (Data.size() < Counts.size())
+    Data.resize(Counts.size(), ProfileInfoLoader::Uncounted);
+  for (size_t i = 0, e = Counts.size(); i != e; ++i)
+    Data[i] = AddCounts<uint64_t>(
+        Counts[i] == ~0u ? ProfileInfoLoader::Uncounted : Counts[i], Data[i]);
+}
+
+// ReadProfilingBlock - Accumulate a packet of counters into Data, returning
+// the number of counters in the packet.
 template<class IntT>
-static void ReadProfilingBlock(const char *ToolName, FILE *F,
+static IntT ReadProfilingBlock(const char *ToolName, FILE *F,
                                bool ShouldByteSwap,
                                std::vector<IntT> &Data) {
   // Read the number of entries...
@@ -104,15 +126,97 @@ static void ReadProfilingBlock(const char *ToolName, FILE *F,
   // Accumulate the data we just read into the data.
   if (!ShouldByteSwap) {
     for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(TempSpace[i], Data[i]);
+      Data[i] = AddCounts<IntT>(TempSpace[i], Data[i]);
     }
   } else {
     for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(ByteSwap(TempSpace[i], true), Data[i]);
+      Data[i] = AddCounts<IntT>(ByteSwap(TempSpace[i], true), Data[i]);
     }
   }
+  return NumEntries;
+}
+
+// AccumulateCounts - Add Count counters into Data, like ReadProfilingBlock.
+// With SSE2 two counters are added at a time: a counter is Uncounted when
+// both of its 32 bit halves compare equal to ~0, so the 64 bit mask is the
+// 32 bit mask and'ed with its halves swapped.
+static void AccumulateCounts(const ProfileWord *Counts, uint64_t Count,
+                             std::vector<uint64_t> &Data) {
+  const uint64_t Undefined = ProfileInfoLoader::Uncounted;
+  if (Data.size() < Count) Data.resize(Count, Undefined);
+  uint64_t *Sum = Data.data();
+  uint64_t i = 0;
+#ifdef __SSE2__
+  const __m128i Ones = _mm_set1_epi32(-1);
+  for (; i + 2 <= Count; i += 2) {
+    __m128i A = _mm_loadu_si128((const __m128i *)(Counts + i));
+    __m128i B = _mm_loadu_si128((const __m128i *)(Sum + i));
+    __m128i UndefA = _mm_cmpeq_epi32(A, Ones);
+    UndefA = _mm_and_si128(UndefA,
+        _mm_shuffle_epi32(UndefA, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128i UndefB = _mm_cmpeq_epi32(B, Ones);
+    UndefB = _mm_and_si128(UndefB,
+        _mm_shuffle_epi32(UndefB, _MM_SHUFFLE(2, 3, 0, 1)));
+    // B if A is Uncounted, else A if B is, else A + B
+    __m128i R = _mm_or_si128(_mm_and_si128(UndefB, A),
+                             _mm_andnot_si128(UndefB, _mm_add_epi64(A, B)));
+    R = _mm_or_si128(_mm_and_si128(UndefA, B), _mm_andnot_si128(UndefA, R));
+    _mm_storeu_si128((__m128i *)(Sum + i), R);
+  }
+#endif
+  for (; i != Count; ++i)
+    Sum[i] = AddCounts<uint64_t>(Counts[i], Sum[i]);
+}
+
+// ReadCounters - Accumulate a packet of 64 bit counters into Data, in place
+// from the mapping unless it has to be byte swapped.
+static void ReadCounters(const char *ToolName, ProfilePacketReader &Reader,
+                         const ProfilePacket &Packet,
+                         std::vector<uint64_t> &Data) {
+  const ProfileWord *Counts;
+  uint64_t Count;
+  if (Reader.getWords(Packet, Counts, Count))
+    AccumulateCounts(Counts, Count, Data);
+  else
+    ReadProfilingBlock<uint64_t>(ToolName, Reader.getStream(Packet),
+                                 Packet.ShouldByteSwap, Data);
 }
 
+// ReadSparseProfilingBlock - Accumulate an EdgeInfo64Sparse or
+// BlockInfo64Sparse packet into Data, the varints are decoded straight from
+// the mapping.  The counters the packet leaves out are zero.
+static void ReadSparseProfilingBlock(const char *ToolName,
+                                     const ProfilePacketReader &Reader,
+                                     const ProfilePacket &Packet,
+                                     std::vector<uint64_t> &Data) {
+  const ProfileWord *Header = // counters, encoded bytes
+    (const ProfileWord *)Reader.getData(Packet);
+  uint64_t NumEntries = ByteSwap((uint64_t)Header[0], Packet.ShouldByteSwap);
+  uint64_t Bytes = ByteSwap((uint64_t)Header[1], Packet.ShouldByteSwap);
+
+  if (Data.size() < NumEntries)
+    Data.resize(NumEntries, ProfileInfoLoader::Uncounted);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    if (Data[i] == ProfileInfoLoader::Uncounted) Data[i] = 0;
+  const unsigned char *In = (const unsigned char *)(Header + 2);
+  const unsigned char *End = In + Bytes;
+  uint64_t Next = 0;
+  while (In != End) {
+    uint64_t Skip, Count;
+    if (!profile_varint_get(&In, End, &Skip) ||
+        !profile_varint_get(&In, End, &Count) ||
+        Skip >= NumEntries - Next) {
+      errs() << ToolName << ": sparse counter packet broken!\n";
+      exit(1);
+    }
+    Next += Skip;
+    Data[Next] = AddCounts<uint64_t>(Count, Data[Next]);
+    ++Next;
+  }
+}
+
+// Read the value contents of each site straight into Data, a bounded
+// segment at a time, without a temporary copy of the whole log.
 static void ReadValueProfilingContents(const char* ToolName, FILE* F, 
 		bool ShouldByteSwap, const size_t Counts, 
 		std::vector<std::vector<int> >& Data)
@@ -121,62 +225,355 @@ static void ReadValueProfilingContents(const char* ToolName, FILE* F,
     errs() << ToolName << ": data packet truncated!\n";\
     perror(0);\
     exit(1);}
+   const size_t SegmentSize = 1<<20;
 
 	if(Data.size() < Counts)
 		Data.resize(Counts);
-   std::vector<int> TempSpace;
    for(unsigned i=0;i<Counts;++i){
 		unsigned count = 0;
 		if(fread(&count,sizeof(unsigned),1,F) != 1) EXIT_IF_ERROR;
 		count = ByteSwap(count, ShouldByteSwap);
 		if(count==0) continue;
-		TempSpace.clear();
-		TempSpace.resize(count);
-		if(fread(&TempSpace[0],sizeof(int)*count,1,F) != 1){
-			EXIT_IF_ERROR;
+		std::vector<int>& Content = Data[i];
+		Content.resize(count);
+		for(size_t Done = 0; Done < count; Done += SegmentSize){
+			size_t N = std::min<size_t>(SegmentSize, count - Done);
+			if(fread(&Content[Done],sizeof(int)*N,1,F) != 1) EXIT_IF_ERROR;
+			if(ShouldByteSwap)
+				for(size_t j = Done; j < Done + N; ++j)
+					Content[j] = ByteSwap((unsigned)Content[j], true);
 		}
-		Data[i].resize(TempSpace.size());
-      uint64_t (*BS)(uint64_t, bool) = ByteSwap;
-
-		//tranverse TempSpace with ByteSwap and write to Data[i]
-		std::transform(TempSpace.begin(), TempSpace.end(), Data[i].begin(),
-				std::bind(BS, std::placeholders::_1, ShouldByteSwap));
 	}
 #undef EXIT_IF_ERROR
 }
 
-const uint64_t ProfileInfoLoader::Uncounted = ~0U;
+static bool CountGreater(const ValueSummaryEntry& L, const ValueSummaryEntry& R)
+{
+  return L.count > R.count;
+}
+
+// Read K and the per site top-K tables, the tables of several runs are
+// merged by adding up the entries of the same value.  The merged table keeps
+// the K highest counts, K being the largest K of the runs; the counts it
+// drops are added to the missed observations, and as any kept value may have
+// been counted as low as the largest dropped count in a run it was missing
+// from, that count is added to the error of each kept entry.
+static void ReadValueSummaries(const char* ToolName, FILE* F,
+    bool ShouldByteSwap, const size_t Counts, std::vector<ValueSummary>& Data)
+{
+#define EXIT_IF_ERROR {\
+    errs() << ToolName << ": data packet truncated!\n";\
+    perror(0);\
+    exit(1);}
+
+  unsigned K;
+  if(fread(&K,sizeof(unsigned),1,F) != 1) EXIT_IF_ERROR;
+  K = ByteSwap(K, ShouldByteSwap);
+  if(Data.size() < Counts)
+    Data.resize(Counts);
+  std::vector<ValueSummaryEntry> TempSpace;
+  std::map<int, size_t> Index;
+  for(unsigned i=0;i<Counts;++i){
+    unsigned Used;
+    int Flags;
+    uint64_t Others;
+    if(fread(&Used,sizeof(unsigned),1,F) != 1) EXIT_IF_ERROR;
+    if(fread(&Flags,sizeof(int),1,F) != 1) EXIT_IF_ERROR;
+    if(fread(&Others,sizeof(uint64_t),1,F) != 1) EXIT_IF_ERROR;
+    Used = ByteSwap(Used, ShouldByteSwap);
+    Data[i].Flags |= ByteSwap((unsigned)Flags, ShouldByteSwap);
+    Data[i].Others += ByteSwap(Others, ShouldByteSwap);
+    if(K > Data[i].Capacity)
+      Data[i].Capacity = K;
+    if(Used == 0) continue;
+
+    TempSpace.resize(Used);
+    if(fread(&TempSpace[0],sizeof(ValueSummaryEntry)*Used,1,F) != 1)
+      EXIT_IF_ERROR;
+    std::vector<ValueSummaryEntry>& TopK = Data[i].TopK;
+    Index.clear();
+    for(size_t j=0;j<TopK.size();++j)
+      Index[TopK[j].value] = j;
+    for(unsigned j=0;j<Used;++j){
+      ValueSummaryEntry E = TempSpace[j];
+      E.value = ByteSwap((unsigned)E.value, ShouldByteSwap);
+      E.count = ByteSwap(E.count, ShouldByteSwap);
+      E.error = ByteSwap(E.error, ShouldByteSwap);
+      std::map<int, size_t>::iterator Found = Index.find(E.value);
+      if(Found == Index.end()){
+        Index[E.value] = TopK.size();
+        TopK.push_back(E);
+      }else{
+        TopK[Found->second].count += E.count;
+        TopK[Found->second].error += E.error;
+      }
+    }
+    std::stable_sort(TopK.begin(), TopK.end(), CountGreater);
+    if(TopK.size() <= Data[i].Capacity) continue;
+    uint64_t Dropped = TopK[Data[i].Capacity].count;
+    for(size_t j = Data[i].Capacity; j < TopK.size(); ++j)
+      Data[i].Others += TopK[j].count;
+    TopK.resize(Data[i].Capacity);
+    for(size_t j = 0; j < TopK.size(); ++j)
+      TopK[j].error += Dropped;
+  }
+#undef EXIT_IF_ERROR
+}
+
+// ExpandBlockMap - Calculate the block counts of a BlockMapInfo64 packet of
+// -insert-block-profiling: the number of blocks, of slots, of counters and of
+// rule words, the slot of each counter, the rules and the counters.  A rule
+// is a slot, its number of terms and the terms, the slot of a term shifted
+// left by one and the low bit set if it is subtracted.  The first blocks are
+// the slots of the same number.  Returns false if the packet is broken.
+static bool ExpandBlockMap(const std::vector<uint64_t> &Packet,
+                           std::vector<uint64_t> &Counts) {
+  if (Packet.size() < 4) return false;
+  uint64_t NumBlocks = Packet[0], NumSlots = Packet[1];
+  uint64_t NumCounters = Packet[2], RuleWords = Packet[3];
+  if (NumBlocks > NumSlots || NumCounters > Packet.size() ||
+      RuleWords > Packet.size() ||
+      Packet.size() != 4 + 2 * NumCounters + RuleWords)
+    return false;
+  const uint64_t *Slots = &Packet[4];
+  const uint64_t *Rule = Slots + NumCounters, *End = Rule + RuleWords;
+  const uint64_t *Counters = End;
+
+  // the counts are calculated modulo 2^64, the result is exact
+  std::vector<uint64_t> Values(NumSlots);
+  for (uint64_t i = 0; i != NumCounters; ++i) {
+    if (Slots[i] >= NumSlots) return false;
+    Values[Slots[i]] = Counters[i];
+  }
+  while (Rule != End) {
+    if (End - Rule < 2 || Rule[0] >= NumSlots ||
+        Rule[1] > (uint64_t)(End - Rule - 2))
+      return false;
+    uint64_t Sum = 0;
+    for (uint64_t t = 0; t != Rule[1]; ++t) {
+      uint64_t Term = Rule[2 + t];
+      if ((Term >> 1) >= NumSlots) return false;
+      Sum += Term & 1 ? -Values[Term >> 1] : Values[Term >> 1];
+    }
+    Values[Rule[0]] = Sum;
+    Rule += 2 + Rule[1];
+  }
+  Counts.assign(Values.begin(), Values.begin() + NumBlocks);
+  return true;
+}
+
+// ExpandPages - Unpack a PagedInfo64 packet of -profile-counters-mmap: the
+// type of the packet it stands for, its number of counters and the runs of
+// counters which are not all zero, each the index of its first counter, its
+// length and the counters.  Returns false if the packet is broken.
+static bool ExpandPages(const std::vector<uint64_t> &Packet, unsigned &Type,
+                        std::vector<uint64_t> &Counts) {
+  if (Packet.size() < 2) return false;
+  Type = Packet[0];
+  uint64_t NumCounters = Packet[1];
+  Counts.assign(NumCounters, 0);
+  for (size_t i = 2, e = Packet.size(); i != e;) {
+    if (e - i < 2) return false;
+    uint64_t First = Packet[i], Length = Packet[i + 1];
+    if (First > NumCounters || Length > NumCounters - First ||
+        Length > e - i - 2)
+      return false;
+    std::copy(Packet.begin() + i + 2, Packet.begin() + i + 2 + Length,
+              Counts.begin() + First);
+    i += 2 + Length;
+  }
+  return true;
+}
+
+// SkipBytes - Move F Bytes ahead.  Running past the end is caught by the
+// next read.
+static bool SkipBytes(FILE *F, uint64_t Bytes) {
+  return fseeko(F, Bytes, SEEK_CUR) == 0;
+}
+
+template<class IntT>
+static bool ReadWord(FILE *F, bool ShouldByteSwap, IntT &Word) {
+  if (fread(&Word, sizeof(IntT), 1, F) != 1) return false;
+  Word = ByteSwap(Word, ShouldByteSwap);
+  return true;
+}
+
+bool llvm::SkipProfilingPacket(FILE *F, unsigned PacketType,
+                               bool ShouldByteSwap) {
+  unsigned Count;
+  uint64_t Count64;
+  switch (PacketType) {
+  case ArgumentInfo:
+    return ReadWord(F, ShouldByteSwap, Count) &&
+           SkipBytes(F, (Count + 3) & ~3u);
+
+  case FunctionInfo:
+  case BlockInfo:
+  case EdgeInfo:
+  case OptEdgeInfo:
+  case BBTraceInfo:
+  case SLGInfo:
+  case MPInfo:
+  case MPIFullInfo:
+    return ReadWord(F, ShouldByteSwap, Count) &&
+           SkipBytes(F, (uint64_t)Count * sizeof(unsigned));
+
+  case BlockInfo64:
+  case EdgeInfo64:
+  case ThreadEdgeInfo64:
+  case ThreadBlockInfo64:
+  case SampledEdgeInfo64:
+  case OptEdgeInfo64:
+  case MPIFullInfo64:
+  case BlockMapInfo64:
+  case ModuleInfo64:
+  case PagedInfo64:
+    return ReadWord(F, ShouldByteSwap, Count64) &&
+           SkipBytes(F, Count64 * sizeof(uint64_t));
+
+  case PathInfo:
+  case PathInfo64:
+    if (!ReadWord(F, ShouldByteSwap, Count)) return false;
+    for (unsigned i = 0; i != Count; ++i) {
+      PathProfileHeader Header;
+      if (fread(&Header, sizeof(Header), 1, F) != 1 ||
+          !SkipBytes(F, (uint64_t)ByteSwap(Header.numEntries, ShouldByteSwap) *
+                            (PacketType == PathInfo64
+                                 ? sizeof(PathProfileTableEntry64)
+                                 : sizeof(PathProfileTableEntry))))
+        return false;
+    }
+    return true;
+
+  case ValueInfo:
+  case ValueInfo64:
+    if (PacketType == ValueInfo64) {
+      if (!ReadWord(F, ShouldByteSwap, Count64) ||
+          !SkipBytes(F, Count64 * sizeof(uint64_t)))
+        return false;
+      Count = Count64;
+    } else if (!ReadWord(F, ShouldByteSwap, Count) ||
+               !SkipBytes(F, (uint64_t)Count * sizeof(unsigned)))
+      return false;
+    for (unsigned i = 0; i != Count; ++i) {
+      unsigned Values;
+      if (!ReadWord(F, ShouldByteSwap, Values) ||
+          !SkipBytes(F, (uint64_t)Values * sizeof(int)))
+        return false;
+    }
+    return true;
+
+  case ValueSummaryInfo:
+  case ValueSummaryInfo64:
+    if (PacketType == ValueSummaryInfo64) {
+      if (!ReadWord(F, ShouldByteSwap, Count64) ||
+          !SkipBytes(F, Count64 * sizeof(uint64_t)))
+        return false;
+      Count = Count64;
+    } else if (!ReadWord(F, ShouldByteSwap, Count) ||
+               !SkipBytes(F, (uint64_t)Count * sizeof(unsigned)))
+      return false;
+    if (!SkipBytes(F, sizeof(unsigned))) // K
+      return false;
+    for (unsigned i = 0; i != Count; ++i) {
+      unsigned Used; // followed by the flags and the others count
+      if (!ReadWord(F, ShouldByteSwap, Used) ||
+          !SkipBytes(F, sizeof(int) + sizeof(uint64_t) +
+                            (uint64_t)Used * sizeof(ValueSummaryEntry)))
+        return false;
+    }
+    return true;
+
+  case SnapshotInfo:
+    return SkipBytes(F, sizeof(SnapshotHeader));
+
+  case BBTraceVarintInfo: {
+    unsigned Header[2]; // block count, encoded bytes
+    if (fread(Header, sizeof(Header), 1, F) != 1) return false;
+    return SkipBytes(F, (ByteSwap(Header[1], ShouldByteSwap) + 3) & ~3u);
+  }
+
+  case EdgeInfo64Sparse:
+  case BlockInfo64Sparse: {
+    uint64_t Header[2]; // counters, encoded bytes
+    if (fread(Header, sizeof(Header), 1, F) != 1) return false;
+    return SkipBytes(F, (ByteSwap(Header[1], ShouldByteSwap) + 3) &
+                        ~(uint64_t)3);
+  }
+
+  default:
+    return false;
+  }
+}
+
+uint64_t llvm::getProfileModuleHash(const Module &M) {
+  // FNV-1a of the names of the defined functions, the constructor of the
+  // profiling runtimes and the like left out.
+  uint64_t Hash = 14695981039346656037ULL;
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->getName().startswith("llvm_")) continue;
+    StringRef Name = F->getName();
+    for (unsigned i = 0, e = Name.size(); i <= e; ++i) {
+      Hash ^= i != e ? (unsigned char)Name[i] : 0;
+      Hash *= 1099511628211ULL;
+    }
+  }
+  return Hash;
+}
+
+const uint64_t ProfileInfoLoader::Uncounted = ~0ULL;
 
 // ProfileInfoLoader ctor - Read the specified profiling data file, exiting the
 // program if the file is invalid or broken.
 //
 ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
-                                     const std::string &Filename)
-  : Filename(Filename) {
-  FILE *F = fopen(Filename.c_str(), "rb");
-  if (F == 0) {
-    errs() << ToolName << ": Error opening '" << Filename << "': ";
-    perror(0);
-    exit(1);
-  }
-  if (0 == (fseek(F, 0, SEEK_END), ftell(F))) { 
-    // end == begin == 0, then it is empty
+                                     const std::string &Filename,
+                                     uint64_t ModuleHash)
+  : Filename(Filename), EdgeSampleScale(0) {
+  // shm:<name> reads the counters of a program running with LLVMPROF_SHM
+  ProfilePacketReader Reader(ToolName, Filename);
+  if (Reader.size() == 0) {
     errs() << " Warnning '" << Filename << "' seems empty\n";
   }
-  fseek(F, 0, SEEK_SET);
   std::vector<unsigned> TempCounters32;
-
-  // Keep reading packets until we run out of them.
-  unsigned PacketType;
-  while (fread(&PacketType, sizeof(unsigned), 1, F) == 1) {
-    // If the low eight bits of the packet are zero, we must be dealing with an
-    // endianness mismatch.  Byteswap all words read from the profiling
-    // information.
-    bool ShouldByteSwap = (char)PacketType == 0;
-    PacketType = ByteSwap(PacketType, ShouldByteSwap);
+  // The packets of a process belong to the module of its last ModuleInfo64,
+  // to all of them before the first one.
+  bool OtherModule = false;
+  uint64_t FirstModule = 0;
+  bool MixedModules = false, Matched = false;
+
+  const std::vector<ProfilePacket> &Packets = Reader.packets();
+  for (size_t p = 0, pe = Packets.size(); p != pe; ++p) {
+    const ProfilePacket &Packet = Packets[p];
+    unsigned PacketType = Packet.Type;
+    bool ShouldByteSwap = Packet.ShouldByteSwap;
+    if (OtherModule && PacketType != ArgumentInfo &&
+        PacketType != ModuleInfo64)
+      continue;
+    FILE *F = Reader.getStream(Packet);
 
     switch (PacketType) {
+    case ModuleInfo64: {
+      uint64_t Count, Hash;
+      if (!ReadWord(F, ShouldByteSwap, Count) || Count != 1 ||
+          !ReadWord(F, ShouldByteSwap, Hash)) {
+        errs() << ToolName << ": bad module packet in '" << Filename
+               << "'!\n";
+        exit(1);
+      }
+      OtherModule = ModuleHash && Hash != ModuleHash;
+      Matched |= ModuleHash && !OtherModule;
+      if (!FirstModule) FirstModule = Hash;
+      if (!ModuleHash && Hash != FirstModule && !MixedModules) {
+        errs() << "WARNING: '" << Filename << "' has the counters of several"
+               << " modules, they are added up!\n";
+        MixedModules = true;
+      }
+      break;
+    }
+
     case ArgumentInfo: {
+      OtherModule = false;
       unsigned ArgLength;
       if (fread(&ArgLength, sizeof(unsigned), 1, F) != 1) {
         errs() << ToolName << ": arguments packet truncated!\n";
@@ -205,35 +602,62 @@ ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
 
     case BlockInfo:
        ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (BlockCounts.size() < TempCounters32.size())
-          BlockCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      BlockCounts.begin(), BlockCounts.begin(),
-                      AddCounts);
+       AddCounts32(TempCounters32, BlockCounts);
        TempCounters32.clear();
       break;
 
     case EdgeInfo:
       ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (EdgeCounts.size() < TempCounters32.size())
-          EdgeCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      EdgeCounts.begin(), EdgeCounts.begin(),
-                      AddCounts);
+       AddCounts32(TempCounters32, EdgeCounts);
        TempCounters32.clear();
       break;
 
     case OptEdgeInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, OptimalEdgeCounts);
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
+      AddCounts32(TempCounters32, OptimalEdgeCounts);
+      TempCounters32.clear();
+      break;
+
+    case OptEdgeInfo64:
+      ReadCounters(ToolName, Reader, Packet, OptimalEdgeCounts);
       break;
 
     case BBTraceInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, BBTrace);
+    case BBTraceVarintInfo:
+      // traces can be larger than memory, BBTraceReader streams them
+      if (!SkipProfilingPacket(F, PacketType, ShouldByteSwap)) {
+        errs() << ToolName << ": trace packet truncated!\n";
+        exit(1);
+      }
       break;
 
 	case ValueInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, ValueCounts);
-      ReadValueProfilingContents(ToolName, F, ShouldByteSwap, ValueCounts.size(), ValueContents);
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
+      AddCounts32(TempCounters32, ValueCounts);
+      ReadValueProfilingContents(ToolName, F, ShouldByteSwap, TempCounters32.size(), ValueContents);
+      TempCounters32.clear();
+      break;
+
+	case ValueInfo64:
+      ReadValueProfilingContents(ToolName, F, ShouldByteSwap,
+            ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap,
+                                         ValueCounts),
+            ValueContents);
+      break;
+
+   case ValueSummaryInfo:
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
+      AddCounts32(TempCounters32, ValueCounts);
+      ReadValueSummaries(ToolName, F, ShouldByteSwap, TempCounters32.size(),
+                         ValueSummaries);
+      TempCounters32.clear();
+      break;
+
+   case ValueSummaryInfo64:
+      ReadValueSummaries(ToolName, F, ShouldByteSwap,
+            ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap,
+                                         ValueCounts),
+            ValueSummaries);
       break;
 
    case SLGInfo:
@@ -245,26 +669,116 @@ ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
       break;
 
    case MPIFullInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, MPIFullCounters);
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
+      AddCounts32(TempCounters32, MPIFullCounters);
+      TempCounters32.clear();
+      break;
+
+   case MPIFullInfo64:
+      ReadCounters(ToolName, Reader, Packet, MPIFullCounters);
       break;
 
    case BlockInfo64:
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, BlockCounts);
+      ReadCounters(ToolName, Reader, Packet, BlockCounts);
       break;
 
    case EdgeInfo64:
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, EdgeCounts);
+      ReadCounters(ToolName, Reader, Packet, EdgeCounts);
+      break;
+
+   case BlockInfo64Sparse:
+      ReadSparseProfilingBlock(ToolName, Reader, Packet, BlockCounts);
+      break;
+
+   case EdgeInfo64Sparse:
+      ReadSparseProfilingBlock(ToolName, Reader, Packet, EdgeCounts);
+      break;
+
+   case BlockMapInfo64: {
+      std::vector<uint64_t> Packet, Counts;
+      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, Packet);
+      if (!ExpandBlockMap(Packet, Counts)) {
+         errs() << ToolName << ": block map packet broken!\n";
+         exit(1);
+      }
+      if (BlockCounts.size() < Counts.size())
+         BlockCounts.resize(Counts.size(), Uncounted);
+      for (size_t i = 0, e = Counts.size(); i != e; ++i)
+         BlockCounts[i] = AddCounts(Counts[i], BlockCounts[i]);
+      break;
+   }
+
+   case PagedInfo64: {
+      std::vector<uint64_t> Packet, Counts;
+      unsigned Type;
+      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, Packet);
+      if (!ExpandPages(Packet, Type, Counts) ||
+          (Type != EdgeInfo64 && Type != BlockInfo64)) {
+         errs() << ToolName << ": paged counter packet broken!\n";
+         exit(1);
+      }
+      std::vector<uint64_t> &Data =
+         Type == EdgeInfo64 ? EdgeCounts : BlockCounts;
+      if (Data.size() < Counts.size())
+         Data.resize(Counts.size(), Uncounted);
+      for (size_t i = 0, e = Counts.size(); i != e; ++i)
+         Data[i] = AddCounts(Counts[i], Data[i]);
+      break;
+   }
+
+   case SampledEdgeInfo64: {
+      std::vector<uint64_t> Sampled;
+      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, Sampled);
+      if (Sampled.size() < 2 || Sampled.back() == 0) {
+         errs() << ToolName << ": sampled edge packet broken!\n";
+         exit(1);
+      }
+      uint64_t Burst = Sampled.back(); Sampled.pop_back();
+      uint64_t Period = Sampled.back(); Sampled.pop_back();
+      // every counted burst stands for period / burst times its counts
+      if (EdgeCounts.size() < Sampled.size())
+         EdgeCounts.resize(Sampled.size(), Uncounted);
+      for (size_t i = 0, e = Sampled.size(); i != e; ++i)
+         EdgeCounts[i] = AddCounts((Sampled[i] * Period + Burst / 2) / Burst,
+                                   EdgeCounts[i]);
+      EdgeSampleScale = (double)Period / Burst;
+      break;
+   }
+
+   case ThreadBlockInfo64:
+      // every packet is a separate thread, they are not accumulated
+      ThreadBlockCounts.push_back(std::vector<uint64_t>());
+      ReadCounters(ToolName, Reader, Packet, ThreadBlockCounts.back());
+      break;
+
+   case ThreadEdgeInfo64:
+      ThreadEdgeCounts.push_back(std::vector<uint64_t>());
+      ReadCounters(ToolName, Reader, Packet, ThreadEdgeCounts.back());
+      break;
+
+   case SnapshotInfo: {
+      SnapshotHeader Header;
+      if (fread(&Header, sizeof(Header), 1, F) != 1) {
+         errs() << ToolName << ": snapshot packet truncated!\n";
+         perror(0);
+         exit(1);
+      }
+      Header.flags = ByteSwap(Header.flags, ShouldByteSwap);
+      Header.sequence = ByteSwap(Header.sequence, ShouldByteSwap);
+      Header.time = ByteSwap(Header.time, ShouldByteSwap);
+      Snapshots.push_back(Header);
       break;
+   }
 
    default:
       errs() << ToolName << ": Unknown packet type #" << PacketType << "!\n";
-      errs() << "at position "<<ftell(F) <<"/";
-      fseek(F,0,SEEK_END);
-      errs() << ftell(F) <<"\n";
-      fclose(F);
+      errs() << "at position " << Packet.Offset - sizeof(unsigned) << "/"
+             << Reader.size() << "\n";
       exit(1);
     }
   }
 
-  fclose(F);
+  if (ModuleHash && FirstModule && !Matched)
+    errs() << "WARNING: '" << Filename << "' has no counters of this module,"
+           << " was it changed after the instrumentation?\n";
 }
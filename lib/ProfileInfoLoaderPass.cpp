@@ -24,6 +24,7 @@
 #include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/Constants.h>
+#include "FunctionFilter.h"
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
 #include "InitializeProfilerPass.h"
@@ -46,7 +47,6 @@ namespace {
   class LoaderPass : public ModulePass, public ProfileInfo {
     std::string Filename;
     std::set<Edge> SpanningTree;
-    std::set<const BasicBlock*> BBisUnvisited;
     unsigned ReadCount;
   public:
     static char ID; // Class identification, replacement for typeinfo
@@ -64,9 +64,9 @@ namespace {
       return "Profiling information loader";
     }
 
-    // recurseBasicBlock() - Calculates the edge weights for as much basic
-    // blocks as possbile.
-    virtual void recurseBasicBlock(const BasicBlock *BB);
+    // solveMissingEdges() - Calculates the weights of as much edges of F
+    // left out by optimal edge profiling as possible.
+    virtual void solveMissingEdges(const Function *F);
     virtual void readEdgeOrRemember(Edge, Edge&, unsigned &, double &);
     virtual void readEdge(ProfileInfo::Edge, std::vector<uint64_t>&);
 
@@ -115,34 +115,31 @@ void LoaderPass::readEdgeOrRemember(Edge edge, Edge &tocalc,
   }
 }
 
-// recurseBasicBlock - Visits all neighbours of a block and then tries to
-// calculate the missing edge values.
-void LoaderPass::recurseBasicBlock(const BasicBlock *BB) {
-
-  // break recursion if already visited
-  if (BBisUnvisited.find(BB) == BBisUnvisited.end()) return;
-  BBisUnvisited.erase(BB);
-  if (!BB) return;
-
-  for (succ_const_iterator bbi = succ_begin(BB), bbe = succ_end(BB);
-       bbi != bbe; ++bbi) {
-    recurseBasicBlock(*bbi);
-  }
-  for (const_pred_iterator bbi = pred_begin(BB), bbe = pred_end(BB);
-       bbi != bbe; ++bbi) {
-    recurseBasicBlock(*bbi);
-  }
-
-  Edge tocalc;
-  if (CalculateMissingEdge(BB, tocalc)) {
-    SpanningTree.erase(tocalc);
+// solveMissingEdges - The flow into a block equals the flow out of it, so a
+// block with a single edge of unknown weight gets it calculated.  That may
+// leave the block at the other end of the edge with a single unknown edge,
+// so it goes back to the worklist.  Unlike a recursion over the neighbours
+// this doesn't run out of stack on functions with many blocks.
+void LoaderPass::solveMissingEdges(const Function *F) {
+  std::vector<const BasicBlock*> Worklist;
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    Worklist.push_back(BB);
+
+  while (!Worklist.empty()) {
+    const BasicBlock *BB = Worklist.back();
+    Worklist.pop_back();
+    Edge Solved;
+    if (!CalculateMissingEdge(BB, Solved) || !SpanningTree.erase(Solved))
+      continue;
+    if (Solved.first) Worklist.push_back(Solved.first);
+    if (Solved.second) Worklist.push_back(Solved.second);
   }
 }
 
 void LoaderPass::readEdge(ProfileInfo::Edge e,
                           std::vector<uint64_t> &ECs) {
   if (ReadCount < ECs.size()) {
-    double weight = ECs[ReadCount++];
+    uint64_t weight = ECs[ReadCount++];
     if (weight != ProfileInfoLoader::Uncounted) {
       // Here the data realm changes from the unsigned of the file to the
       // double of the ProfileInfo. This conversion is save because we know
@@ -152,7 +149,7 @@ void LoaderPass::readEdge(ProfileInfo::Edge e,
 
       DEBUG(dbgs() << "--Read Edge Counter for " << e
                    << " (# "<< (ReadCount-1) << "): "
-                   << (unsigned)getEdgeWeight(e) << "\n");
+                   << (uint64_t)getEdgeWeight(e) << "\n");
     } else {
       // This happens only if reading optimal profiling information, not when
       // reading regular profiling information.
@@ -170,7 +167,7 @@ inline unsigned sig_max(unsigned acc, unsigned b)
 }
 
 bool LoaderPass::runOnModule(Module &M) {
-  ProfileInfoLoader PIL("profile-loader", Filename);
+  ProfileInfoLoader PIL("profile-loader", Filename, getProfileModuleHash(M));
 
   EdgeInformation.clear();
   std::vector<uint64_t> Counters64 = PIL.getRawEdgeCounts();
@@ -178,7 +175,7 @@ bool LoaderPass::runOnModule(Module &M) {
     ReadCount = 0;
     std::vector<uint64_t>& Counters = Counters64;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-      if (F->isDeclaration()) continue;
+      if (!isProfiledFunction(*F)) continue;
       DEBUG(dbgs() << "Working on " << F->getName() << "\n");
       readEdge(getEdge(0,&F->getEntryBlock()), Counters);
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -195,12 +192,12 @@ bool LoaderPass::runOnModule(Module &M) {
     NumEdgesRead = ReadCount;
   }
 
-#if 0
-  std::vector<unsigned> Counters = PIL.getRawOptimalEdgeCounts();
-  if (Counters.size() > 0) {
+  Counters64 = PIL.getRawOptimalEdgeCounts();
+  if (Counters64.size() > 0) {
+    std::vector<uint64_t>& Counters = Counters64;
     ReadCount = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-      if (F->isDeclaration()) continue;
+      if (!isProfiledFunction(*F)) continue;
       DEBUG(dbgs() << "Working on " << F->getName() << "\n");
       readEdge(getEdge(0,&F->getEntryBlock()), Counters);
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -212,38 +209,27 @@ bool LoaderPass::runOnModule(Module &M) {
           readEdge(getEdge(BB,TI->getSuccessor(s)), Counters);
         }
       }
-      while (SpanningTree.size() > 0) {
-
-        unsigned size = SpanningTree.size();
-
-        BBisUnvisited.clear();
-        for (std::set<Edge>::iterator ei = SpanningTree.begin(),
-             ee = SpanningTree.end(); ei != ee; ++ei) {
-          BBisUnvisited.insert(ei->first);
-          BBisUnvisited.insert(ei->second);
-        }
-        while (BBisUnvisited.size() > 0) {
-          recurseBasicBlock(*BBisUnvisited.begin());
-        }
-
-        if (SpanningTree.size() == size) {
-          DEBUG(dbgs()<<"{");
-          for (std::set<Edge>::iterator ei = SpanningTree.begin(),
-               ee = SpanningTree.end(); ei != ee; ++ei) {
-            DEBUG(dbgs()<< *ei <<",");
-          }
-          assert(0 && "No edge calculated!");
-        }
-
-      }
+      solveMissingEdges(F);
     }
     if (ReadCount != Counters.size()) {
       errs() << "WARNING: profile information is inconsistent with "
              << "the current program!\n";
     }
+    // an exit edge may be known from the block count without being solved
+    unsigned Unsolved = 0;
+    for (std::set<Edge>::iterator ei = SpanningTree.begin(),
+         ee = SpanningTree.end(); ei != ee; ++ei)
+      if (getEdgeWeight(*ei) == MissingValue) {
+        DEBUG(dbgs() << "--Edge " << *ei << " not calculated\n");
+        ++Unsolved;
+      }
+    if (Unsolved) {
+      errs() << "WARNING: " << Unsolved << " edges missing in the optimal "
+             << "edge profile could not be calculated!\n";
+    }
+    SpanningTree.clear();
     NumEdgesRead = ReadCount;
   }
-#endif
 
   BlockInformation.clear();
   Counters64 = PIL.getRawBlockCounts();
@@ -251,7 +237,7 @@ bool LoaderPass::runOnModule(Module &M) {
     std::vector<uint64_t>& Counters = Counters64;
     ReadCount = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-      if (F->isDeclaration()) continue;
+      if (!isProfiledFunction(*F)) continue;
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
         if (ReadCount < Counters.size())
           // Here the data realm changes from the unsigned of the file to the
@@ -271,7 +257,7 @@ bool LoaderPass::runOnModule(Module &M) {
   if (Counters.size() > 0) {
     ReadCount = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-      if (F->isDeclaration()) continue;
+      if (!isProfiledFunction(*F)) continue;
       if (ReadCount < Counters.size())
         // Here the data realm changes from the unsigned of the file to the
         // double of the ProfileInfo. This conversion is save because we know
@@ -286,8 +272,9 @@ bool LoaderPass::runOnModule(Module &M) {
   }
 
   ValueInformation.clear();
-  Counters = PIL.getRawValueCounts();
-  if(Counters.size() > 0) {
+  Counters64 = PIL.getRawValueCounts();
+  if(Counters64.size() > 0) {
+	  std::vector<uint64_t>& Counters = Counters64;
 	  ReadCount = 0;
 	  for(Module::iterator F = M.begin(),E = M.end(); F!= E; ++F) {
 		  if (F->isDeclaration()) continue;
@@ -298,6 +285,15 @@ bool LoaderPass::runOnModule(Module &M) {
 			  unsigned index = getTrapedIndex(Call);
 			  ValueCounts Ins;
 			  Ins.Nums = Counters[index];
+			  Ins.Others = 0;
+			  if(index < PIL.getRawValueSummaries().size()){
+				  const ValueSummary& Summary = PIL.getRawValueSummaries()[index];
+				  Ins.flags = (ProfilingFlags)Summary.Flags;
+				  Ins.Others = Summary.Others;
+				  Ins.TopK = Summary.TopK;
+				  ValueInformation[Call] = Ins;
+				  continue;
+			  }
 			  const std::vector<int>& content = PIL.getRawValueContent(index);
 			  Ins.flags = (ProfilingFlags)content.front();
 			  Ins.Contents.resize(content.size()-1);
@@ -349,6 +345,7 @@ bool LoaderPass::runOnModule(Module &M) {
   if(Counters.size() > 0) {
      ReadCount = 0;
      for(auto F = M.begin(), E = M.end(); F!=E; ++F){
+        if(!isProfiledFunction(*F)) continue;
         for(auto I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
            CallInst* CI = dyn_cast<CallInst>(&*I);
            if(CI == NULL) continue;
@@ -361,10 +358,12 @@ bool LoaderPass::runOnModule(Module &M) {
   }
 
   MPIFullInformation.clear();
-  Counters = PIL.getRawMPIFullCounts();
-  if(Counters.size() > 0) {
+  Counters64 = PIL.getRawMPIFullCounts();
+  if(Counters64.size() > 0) {
+     std::vector<uint64_t>& Counters = Counters64;
      ReadCount = 0;
      for(auto F = M.begin(), E = M.end(); F!=E; ++F){
+        if(!isProfiledFunction(*F)) continue;
         for(auto I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
            CallInst* CI = dyn_cast<CallInst>(&*I);
            if(CI == NULL) continue;
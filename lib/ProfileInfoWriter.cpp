@@ -49,3 +49,12 @@ void ProfileInfoWriter::write(ProfilingType Type, const std::vector<unsigned int
      // errs()<<"store over!\n";
 }
 
+void ProfileInfoWriter::write(ProfilingType Type, const std::vector<uint64_t> &Counter)
+{
+   uint64_t NumEntries = Counter.size();
+   if(NumEntries <= 0) return;
+   fwrite(&Type, sizeof(unsigned), 1, this->File);
+   fwrite(&NumEntries, sizeof(uint64_t), 1, this->File);
+   fwrite(&Counter[0], sizeof(uint64_t)*NumEntries, 1, this->File);
+}
+
@@ -0,0 +1,173 @@
+//===- ProfilePacketReader.cpp - Index the packets of a profile -----------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The ProfilePacketReader class maps a profile file and finds its packets,
+// the loaders read them in place.
+//
+//===----------------------------------------------------------------------===//
+
+#include "preheader.h"
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoTypes.h"
+#include "ProfilePacketReader.h"
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace llvm;
+
+// CopySharedProfile - Copy the packets which a running program mirrors to
+// the shared memory object Name (see libprofile/SharedCounters.c) into
+// Packets.  The program isn't stopped, the copy is retried until no update
+// ran while it was taken.
+static void CopySharedProfile(const char *ToolName, std::string Name,
+                              std::vector<char> &Packets) {
+  if (Name.empty() || Name[0] != '/') Name = "/" + Name;
+  int Fd = shm_open(Name.c_str(), O_RDONLY, 0);
+  if (Fd == -1) {
+    errs() << ToolName << ": Error opening shared memory '" << Name << "': ";
+    perror(0);
+    exit(1);
+  }
+
+  void *Mem = MAP_FAILED;
+  size_t Mapped = 0;
+  for (unsigned Tries = 0;; ++Tries) {
+    struct stat St;
+    if (Tries == 5000) {
+      errs() << ToolName << ": no counters in '" << Name << "'\n";
+      exit(1);
+    }
+    // the object only grows, remap when it did
+    if (fstat(Fd, &St) == 0 && (size_t)St.st_size > Mapped) {
+      if (Mem != MAP_FAILED) munmap(Mem, Mapped);
+      Mapped = St.st_size;
+      Mem = mmap(0, Mapped, PROT_READ, MAP_SHARED, Fd, 0);
+      if (Mem == MAP_FAILED) {
+        errs() << ToolName << ": Error mapping '" << Name << "': ";
+        perror(0);
+        exit(1);
+      }
+    }
+    const ProfileShmHeader *Header = (const ProfileShmHeader *)Mem;
+    if (Mem == MAP_FAILED || Mapped < sizeof(ProfileShmHeader)) {
+      usleep(1000);
+      continue;
+    }
+    uint64_t Generation = Header->generation;
+    // odd while it is updated, zero before the first update
+    if ((Generation & 1) || Generation == 0 ||
+        Header->magic != PROFILE_SHM_MAGIC) {
+      usleep(1000);
+      continue;
+    }
+    __sync_synchronize();
+    uint64_t Size = Header->size;
+    if (sizeof(ProfileShmHeader) + Size > Mapped) continue;
+    const char *Begin = (const char *)(Header + 1);
+    Packets.assign(Begin, Begin + Size);
+    __sync_synchronize();
+    if (Header->generation == Generation) break;
+  }
+  munmap(Mem, Mapped);
+  close(Fd);
+}
+
+// ReadWholeFile - Read a file which can't be mapped, like a pipe.
+static bool ReadWholeFile(int Fd, std::vector<char> &Data) {
+  char Chunk[64 * 1024];
+  ssize_t Read;
+  while ((Read = read(Fd, Chunk, sizeof(Chunk))) > 0)
+    Data.insert(Data.end(), Chunk, Chunk + Read);
+  return Read == 0;
+}
+
+ProfilePacketReader::ProfilePacketReader(const char *ToolName,
+                                         const std::string &Filename)
+    : Data(0), Size(0), Mapped(false), Stream(0) {
+  if (!Filename.compare(0, 4, "shm:")) {
+    CopySharedProfile(ToolName, Filename.substr(4), Buffer);
+  } else {
+    int Fd = open(Filename.c_str(), O_RDONLY);
+    struct stat St;
+    if (Fd == -1 || fstat(Fd, &St) != 0) {
+      errs() << ToolName << ": Error opening '" << Filename << "': ";
+      perror(0);
+      exit(1);
+    }
+    if (S_ISREG(St.st_mode) && St.st_size > 0) {
+      void *Mem = mmap(0, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+      if (Mem != MAP_FAILED) {
+        Data = (const char *)Mem;
+        Size = St.st_size;
+        Mapped = true;
+      }
+    }
+    if (!Mapped && !ReadWholeFile(Fd, Buffer)) {
+      errs() << ToolName << ": Error reading '" << Filename << "': ";
+      perror(0);
+      exit(1);
+    }
+    close(Fd);
+  }
+  if (!Mapped) {
+    Data = Buffer.data();
+    Size = Buffer.size();
+  }
+  if (Size == 0) return;
+
+  // SkipProfilingPacket knows the length of every packet.
+  Stream = fmemopen(const_cast<char *>(Data), Size, "rb");
+  if (Stream == 0) {
+    errs() << ToolName << ": Error reading '" << Filename << "': ";
+    perror(0);
+    exit(1);
+  }
+  unsigned Type;
+  while (fread(&Type, sizeof(unsigned), 1, Stream) == 1) {
+    // If the low eight bits of the packet are zero, we must be dealing with
+    // an endianness mismatch.
+    ProfilePacket P;
+    P.ShouldByteSwap = (char)Type == 0;
+    P.Type = P.ShouldByteSwap ? __builtin_bswap32(Type) : Type;
+    P.Offset = ftello(Stream);
+    if (!SkipProfilingPacket(Stream, P.Type, P.ShouldByteSwap) ||
+        (uint64_t)ftello(Stream) > Size) {
+      errs() << ToolName << ": packet #" << P.Type << " at position "
+             << P.Offset - sizeof(unsigned) << "/" << Size << " of '"
+             << Filename << "' truncated or unknown!\n";
+      exit(1);
+    }
+    P.Size = ftello(Stream) - P.Offset;
+    Packets.push_back(P);
+  }
+}
+
+ProfilePacketReader::~ProfilePacketReader() {
+  if (Stream) fclose(Stream);
+  if (Mapped) munmap(const_cast<char *>(Data), Size);
+}
+
+bool ProfilePacketReader::getWords(const ProfilePacket &P,
+                                   const ProfileWord *&Words,
+                                   uint64_t &Count) const {
+  if (P.ShouldByteSwap || P.Size < sizeof(uint64_t)) return false;
+  const ProfileWord *Packet = (const ProfileWord *)getData(P);
+  if (Packet[0] != P.Size / sizeof(uint64_t) - 1) return false;
+  Count = Packet[0];
+  Words = Packet + 1;
+  return true;
+}
+
+FILE *ProfilePacketReader::getStream(const ProfilePacket &P) {
+  fseeko(Stream, P.Offset, SEEK_SET);
+  return Stream;
+}
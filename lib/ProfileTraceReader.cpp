@@ -0,0 +1,160 @@
+//===- ProfileTraceReader.cpp - Stream a basic block trace from disk ------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The BBTraceReader class reads the basic block trace of a profile file a
+// bounded chunk at a time.
+//
+//===----------------------------------------------------------------------===//
+
+#include "preheader.h"
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileTraceReader.h"
+#include "ProfileVarint.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+using namespace llvm;
+
+// the most blocks decoded, and encoded bytes read, at a time
+static const size_t ChunkBlocks = 64 * 1024;
+static const size_t ChunkBytes = 64 * 1024;
+
+static inline unsigned ByteSwap(unsigned Var, bool Really) {
+  return Really ? __builtin_bswap32(Var) : Var;
+}
+
+BBTraceReader::BBTraceReader(const char *ToolName, const std::string &Filename)
+    : ToolName(ToolName), Filename(Filename), Next(0), Position(0),
+      Varint(false), ShouldByteSwap(false), BlocksLeft(0), BytesLeft(0),
+      Padding(0), Previous(0), EncodedBegin(0), EncodedEnd(0) {
+  F = fopen(Filename.c_str(), "rb");
+  if (F == 0) {
+    errs() << ToolName << ": Error opening '" << Filename << "': ";
+    perror(0);
+    exit(1);
+  }
+}
+
+BBTraceReader::~BBTraceReader() {
+  fclose(F);
+}
+
+// nextPacket - Skip to the next trace packet and read its header.  Returns
+// false at the end of the file.
+bool BBTraceReader::nextPacket() {
+  unsigned PacketType;
+  while (fread(&PacketType, sizeof(unsigned), 1, F) == 1) {
+    ShouldByteSwap = (char)PacketType == 0;
+    PacketType = ByteSwap(PacketType, ShouldByteSwap);
+
+    if (PacketType == BBTraceInfo || PacketType == BBTraceVarintInfo) {
+      unsigned Header[2]; // block count, and encoded bytes of a varint one
+      Varint = PacketType == BBTraceVarintInfo;
+      if (fread(Header, sizeof(unsigned), Varint ? 2 : 1, F) !=
+          (Varint ? 2u : 1u)) {
+        errs() << ToolName << ": trace packet truncated!\n";
+        exit(1);
+      }
+      BlocksLeft = ByteSwap(Header[0], ShouldByteSwap);
+      if (Varint) {
+        BytesLeft = ByteSwap(Header[1], ShouldByteSwap);
+        Padding = (4 - (BytesLeft & 3)) & 3;
+        Previous = 0;
+        EncodedBegin = EncodedEnd = 0;
+        if (BlocksLeft == 0) skipEncoded();
+      }
+      return true;
+    }
+
+    if (!SkipProfilingPacket(F, PacketType, ShouldByteSwap)) {
+      errs() << ToolName << ": Unknown packet type #" << PacketType
+             << " in '" << Filename << "'!\n";
+      exit(1);
+    }
+  }
+  return false;
+}
+
+// skipEncoded - Skip what is left of a varint packet once all its blocks
+// are decoded.
+void BBTraceReader::skipEncoded() {
+  if (fseeko(F, BytesLeft + Padding, SEEK_CUR)) {
+    errs() << ToolName << ": trace packet truncated!\n";
+    exit(1);
+  }
+  BytesLeft = Padding = 0;
+}
+
+// readRaw - Read the next chunk of a BBTraceInfo packet.
+void BBTraceReader::readRaw() {
+  size_t Count = std::min<uint64_t>(BlocksLeft, ChunkBlocks);
+  Blocks.resize(Count);
+  if (Count && fread(&Blocks[0], sizeof(unsigned), Count, F) != Count) {
+    errs() << ToolName << ": trace packet truncated!\n";
+    exit(1);
+  }
+  if (ShouldByteSwap)
+    for (size_t i = 0; i != Count; ++i)
+      Blocks[i] = ByteSwap(Blocks[i], true);
+  BlocksLeft -= Count;
+}
+
+// readVarint - Decode the next chunk of a BBTraceVarintInfo packet.  The
+// encoded bytes are read ChunkBytes at a time, a number cut by the end of
+// them is moved to the front and completed by the next read.
+void BBTraceReader::readVarint() {
+  Encoded.resize(ChunkBytes);
+  Blocks.clear();
+  while (BlocksLeft && Blocks.size() < ChunkBlocks) {
+    const unsigned char *In = &Encoded[0] + EncodedBegin;
+    const unsigned char *End = &Encoded[0] + EncodedEnd;
+    uint64_t Value;
+    if (profile_varint_get(&In, End, &Value)) {
+      if (Value > 0xffffffffu) break;
+      EncodedBegin = In - &Encoded[0];
+      Previous += (unsigned)profile_unzigzag32((uint32_t)Value);
+      Blocks.push_back(Previous);
+      --BlocksLeft;
+      continue;
+    }
+
+    size_t Kept = EncodedEnd - EncodedBegin;
+    size_t Read = std::min<uint64_t>(BytesLeft, ChunkBytes - Kept);
+    if (Kept >= PROFILE_VARINT_MAX64 || Read == 0) break;
+    memmove(&Encoded[0], &Encoded[0] + EncodedBegin, Kept);
+    if (fread(&Encoded[Kept], 1, Read, F) != Read) {
+      errs() << ToolName << ": trace packet truncated!\n";
+      exit(1);
+    }
+    BytesLeft -= Read;
+    EncodedBegin = 0;
+    EncodedEnd = Kept + Read;
+  }
+  if (BlocksLeft && Blocks.size() < ChunkBlocks) {
+    errs() << ToolName << ": broken trace packet in '" << Filename << "'!\n";
+    exit(1);
+  }
+
+  if (BlocksLeft == 0) skipEncoded();
+}
+
+// refill - Decode the next chunk of the trace.  Returns false at the end.
+bool BBTraceReader::refill() {
+  do {
+    while (BlocksLeft == 0)
+      if (!nextPacket()) return false;
+    if (Varint)
+      readVarint();
+    else
+      readRaw();
+  } while (Blocks.empty());
+  Next = 0;
+  return true;
+}
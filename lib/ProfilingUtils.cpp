@@ -20,19 +20,49 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include "ProfilingUtils.h"
 
 using namespace llvm;
 
+static cl::opt<bool> AtomicCounters("edge-profiling-atomic",
+      cl::desc("Use relaxed atomic increments for edge, optimal edge, "
+               "block, pred block and mpi counters (for multithreaded "
+               "programs)"));
+static cl::opt<bool> ShardedCounters("edge-profiling-sharded",
+      cl::desc("Give each thread its own cache line aligned copy of the edge "
+               "and pred block counters, summed when the program exits"));
+static cl::opt<bool> LazyCounters("profile-counters-mmap",
+      cl::desc("Map the pages of the edge and pred block counters without "
+               "reserving memory, only the touched ones are committed and "
+               "written"));
+
+Function *llvm::GetProfilingConstructor(Module &M) {
+  if (Function *Ctor = M.getFunction("llvm_profiling_init")) return Ctor;
+  LLVMContext &Context = M.getContext();
+  Function *Ctor =
+    Function::Create(FunctionType::get(Type::getVoidTy(Context), false),
+                     GlobalValue::InternalLinkage, "llvm_profiling_init", &M);
+  ReturnInst::Create(Context, BasicBlock::Create(Context, "entry", Ctor));
+  // Before the constructors of the program, which may be profiled.
+  appendToGlobalCtors(M, Ctor, 0);
+  return Ctor;
+}
+
 void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
                                    GlobalValue *Array,
                                    PointerType *arrayType) {
+  if (MainFn == 0 || MainFn->isDeclaration())
+    MainFn = GetProfilingConstructor(*Array->getParent());
   LLVMContext &Context = MainFn->getContext();
   Type *ArgVTy =
     PointerType::getUnqual(Type::getInt8PtrTy(Context));
   Type* NumElemTy
       = cast<ArrayType>(Array->getType()->getElementType())->getElementType();
   PointerType *UIntPtr = arrayType ? arrayType : PointerType::get(NumElemTy, 0);
+  // A table of structs passes its size as an unsigned int.
+  if (!NumElemTy->isIntegerTy()) NumElemTy = Type::getInt32Ty(Context);
   Module &M = *MainFn->getParent();
   Constant *InitFn = M.getOrInsertFunction(FnName, Type::getInt32Ty(Context),
                                            Type::getInt32Ty(Context),
@@ -108,28 +138,79 @@ void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
   }
 }
 
+void llvm::MakeCountersLazy(Function *MainFn, GlobalVariable *Counters) {
+  if (!LazyCounters) return;
+  // Whole pages can be mapped again without moving the counters.
+  Counters->setAlignment(4096);
+  InsertProfilingInitCall(MainFn, "llvm_lazy_profile_counters", Counters);
+}
+
 void llvm::IncrementCounterInBlock(BasicBlock *BB, unsigned CounterNum,
-                                   GlobalValue *CounterArray, bool beginning) {
+                                   Value *CounterArray, bool beginning) {
   // Insert the increment after any alloca or PHI instructions...
   BasicBlock::iterator InsertPos = beginning ? BB->getFirstInsertionPt() :
                                    BB->getTerminator();
+  // ... and after the shard lookup when it lives in this block.
+  Instruction *Base = dyn_cast<Instruction>(CounterArray);
+  if (beginning && Base && Base->getParent() == BB) {
+    InsertPos = Base;
+    ++InsertPos;
+  }
   while (isa<AllocaInst>(InsertPos))
     ++InsertPos;
 
-  // Create the getelementptr constant expression
-  std::vector<Constant*> Indices(2);
-  Type* ETy = cast<ArrayType>(CounterArray->getType()->getElementType())->getElementType();
-  Indices[0] = Constant::getNullValue(ETy);
-  Indices[1] = ConstantInt::get(ETy, CounterNum);
-  Constant *ElementPtr =
-    ConstantExpr::getGetElementPtr(CounterArray, Indices);
+  IRBuilder<> Builder(BB, InsertPos);
+  Value *ElementPtr;
+  Type *ETy;
+  if (GlobalValue *Array = dyn_cast<GlobalValue>(CounterArray)) {
+    // Create the getelementptr constant expression
+    std::vector<Constant*> Indices(2);
+    ETy = cast<ArrayType>(Array->getType()->getElementType())->getElementType();
+    Indices[0] = Constant::getNullValue(ETy);
+    Indices[1] = ConstantInt::get(ETy, CounterNum);
+    ElementPtr = ConstantExpr::getGetElementPtr(Array, Indices);
+  } else {
+    ETy = cast<PointerType>(CounterArray->getType())->getElementType();
+    ElementPtr = Builder.CreateConstGEP1_32(CounterArray, CounterNum);
+  }
+
+  IncrementCounter(Builder, ElementPtr, ConstantInt::get(ETy, 1));
+}
+
+Value* llvm::GetCounterBase(Function *F, GlobalVariable *Counters,
+                            const char *ShardFn) {
+  if (!ShardedCounters) return Counters;
+
+  LLVMContext &Context = F->getContext();
+  ArrayType *ATy = cast<ArrayType>(Counters->getType()->getElementType());
+  PointerType *ElemPtrTy = PointerType::getUnqual(ATy->getElementType());
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  Constant *ShardFunc = F->getParent()->getOrInsertFunction(
+      ShardFn, ElemPtrTy, ElemPtrTy, Int64Ty, (Type *)0);
+
+  // The runtime creates the shard on the first call of each thread, passing
+  // the array lets it do so even before main has started profiling.
+  Value *Args[2] = {
+    ConstantExpr::getBitCast(Counters, ElemPtrTy),
+    ConstantInt::get(Int64Ty, ATy->getNumElements())
+  };
+  BasicBlock *Entry = &F->getEntryBlock();
+  return CallInst::Create(ShardFunc, Args, "CounterShard",
+                          Entry->getFirstInsertionPt());
+}
+
+void llvm::IncrementCounter(IRBuilder<>& Builder, Value* ElementPtr,
+                            Value* Inc) {
+  if (AtomicCounters) {
+    // Only the final sum matters, so no ordering with other memory is needed.
+    Builder.CreateAtomicRMW(AtomicRMWInst::Add, ElementPtr, Inc, Monotonic);
+    return;
+  }
 
   // Load, increment and store the value back.
-  Value *OldVal = new LoadInst(ElementPtr, "OldFuncCounter", InsertPos);
-  Value *NewVal = BinaryOperator::Create(Instruction::Add, OldVal,
-                                 ConstantInt::get(ETy, 1),
-                                         "NewFuncCounter", InsertPos);
-  new StoreInst(NewVal, ElementPtr, InsertPos);
+  Value *OldVal = Builder.CreateLoad(ElementPtr, "OldCounter");
+  Value *NewVal = Builder.CreateAdd(OldVal, Inc, "NewCounter");
+  Builder.CreateStore(NewVal, ElementPtr);
 }
 
 void llvm::InsertProfilingShutdownCall(Function *Callee, Module *Mod) {
@@ -17,6 +17,8 @@
 #ifndef PROFILINGUTILS_H
 #define PROFILINGUTILS_H
 
+#include <llvm/IR/IRBuilder.h>
+
 namespace llvm {
   class BasicBlock;
   class Function;
@@ -27,12 +29,34 @@ namespace llvm {
   class Instruction;
   class GlobalVariable;
 
+  // InsertProfilingInitCall - Start the runtime FnName on Arr at the top of
+  // MainFn.  A module without main, like a library, starts it from
+  // GetProfilingConstructor, with no arguments to save.
   void InsertProfilingInitCall(Function *MainFn, const char *FnName,
                                GlobalValue *Arr = 0,
                                PointerType *arrayType = 0);
+  // GetProfilingConstructor - The constructor llvm_profiling_init of M,
+  // which runs before the program's own.  It is created on first use.
+  Function *GetProfilingConstructor(Module &M);
+  // MakeCountersLazy - With -profile-counters-mmap, have the runtime map the
+  // zero pages of Counters again with MAP_NORESERVE before MainFn starts
+  // counting, and write them without the pages which stayed zero.  Counters
+  // must be a zero initialized array of 64 bit counters.
+  void MakeCountersLazy(Function *MainFn, GlobalVariable *Counters);
+  // CounterArray is either the counter array global or the pointer returned
+  // by GetCounterBase.
   void IncrementCounterInBlock(BasicBlock *BB, unsigned CounterNum,
-                               GlobalValue *CounterArray,
+                               Value *CounterArray,
                                bool beginning = true);
+  // GetCounterBase - With -edge-profiling-sharded, call ShardFn at the entry
+  // of F to fetch the calling thread's private copy of Counters and return
+  // it.  Otherwise return Counters itself.
+  Value* GetCounterBase(Function* F, GlobalVariable* Counters,
+                        const char* ShardFn);
+  // IncrementCounter - Emit '*ElementPtr += Inc' at the insert point of
+  // Builder.  With -edge-profiling-atomic this is a relaxed atomic
+  // read-modify-write, so counters stay exact in multithreaded programs.
+  void IncrementCounter(IRBuilder<>& Builder, Value* ElementPtr, Value* Inc);
   void InsertProfilingShutdownCall(Function *Callee, Module *Mod);
 
 }
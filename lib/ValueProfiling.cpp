@@ -1,5 +1,6 @@
 #include "preheader.h"
 #include "ValueProfiling.h"
+#include "FunctionFilter.h"
 #include "ProfilingUtils.h"
 
 #include <llvm/IR/Module.h>
@@ -47,14 +48,15 @@ static Instruction* insertValueTrap(Value* v,Module* M,int numTrapedValues,Inser
 
 Value* ValueProfiler::insertValueTrap(Value* v, BasicBlock* InsertTail)
 {
-   if(!avaliable) return v;
+   if(!avaliable || !isProfiledFunction(*InsertTail->getParent())) return v;
 	return ::insertValueTrap(v, InsertTail->getParent()->getParent(),
 			numTrapedValues++,InsertTail);
 }
 
 Value* ValueProfiler::insertValueTrap(Value* v,Instruction* InsertBefore)
 {
-   if(!avaliable) return v;
+   if(!avaliable || !isProfiledFunction(*InsertBefore->getParent()->getParent()))
+      return v;
 	return ::insertValueTrap(v,
 			InsertBefore->getParent()->getParent()->getParent(),
 			numTrapedValues++, InsertBefore);
@@ -76,7 +78,7 @@ bool ValueProfiler::runOnModule(Module& M)
          }
    }
 	Function* Main = M.getFunction("main");
-	Type*ATy = ArrayType::get(Type::getInt32Ty(M.getContext()),numTrapedValues);
+	Type*ATy = ArrayType::get(Type::getInt64Ty(M.getContext()),numTrapedValues);
 	Counters = new GlobalVariable(M, ATy, false,
 			GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
 			"ValueProfCounters");
@@ -11,28 +11,144 @@
 |* instrumentation pass.  This should be used with the -trace-basic-blocks
 |* LLVM pass.
 |*
+|* The trace is collected in one of two buffers.  When it is full a writer
+|* thread encodes and writes it while the program goes on in the other one,
+|* the program only waits if the writer is still busy with the previous
+|* buffer.  The buffers are written as BBTraceVarintInfo packets, or as
+|* plain BBTraceInfo with LLVMPROF_TRACE_RAW.
+|*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
+#include "ProfileVarint.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/uio.h>
+
+#define TRACE_BUFFER_SIZE (128 * 1024)
+#define TRACE_BUFFER_BLOCKS (TRACE_BUFFER_SIZE / sizeof (unsigned))
 
 static unsigned *ArrayStart, *ArrayEnd, *ArrayCursor;
+static unsigned *Buffers[2];
+
+/* the full buffer handed to the writer thread, 0 once it is written */
+static unsigned *Pending;
+static unsigned PendingCount;
+static int Stopping;
+static int Threaded;
+static pthread_t Writer;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Changed = PTHREAD_COND_INITIALIZER;
+
+static int Raw;
+static unsigned char *Encoded;
+
+/* WriteBBTracePacket - write Count trace entries as one packet,
+ * |type|count|bytes|varints...| padded to four bytes, unless Raw.  The
+ * packets are appended as they come, even with LLVMPROF_APPEND, so the trace
+ * never has to fit into memory.
+ */
+static void WriteBBTracePacket (unsigned *Start, unsigned Count) {
+  int PTy = BBTraceVarintInfo, Zeros = 0;
+  unsigned Bytes;
+  struct iovec Packet[5];
+  int Parts = 5;
+
+  if (Raw) {
+    PTy = BBTraceInfo;
+    Packet[0].iov_base = &PTy;   Packet[0].iov_len = sizeof(int);
+    Packet[1].iov_base = &Count; Packet[1].iov_len = sizeof(unsigned);
+    Packet[2].iov_base = Start;  Packet[2].iov_len = Count * sizeof(unsigned);
+    Parts = 3;
+  } else {
+    Bytes = profile_encode_trace(Start, Count, Encoded);
+    Packet[0].iov_base = &PTy;    Packet[0].iov_len = sizeof(int);
+    Packet[1].iov_base = &Count;  Packet[1].iov_len = sizeof(unsigned);
+    Packet[2].iov_base = &Bytes;  Packet[2].iov_len = sizeof(unsigned);
+    Packet[3].iov_base = Encoded; Packet[3].iov_len = Bytes;
+    Packet[4].iov_base = &Zeros;  Packet[4].iov_len = (4 - (Bytes & 3)) & 3;
+  }
+  if (write_profiling_stream(Packet, Parts) < 0) {
+    fprintf(stderr, "error: unable to write to output file.");
+    exit(0);
+  }
+}
+
+static void *BBTraceWriter (void *Arg) {
+  pthread_mutex_lock(&Lock);
+  for (;;) {
+    unsigned *Start;
+    unsigned Count;
+    while (!Pending && !Stopping)
+      pthread_cond_wait(&Changed, &Lock);
+    if (!Pending) break;
 
-/* WriteAndFlushBBTraceData - write out the currently accumulated trace data
- * and reset the cursor to point to the beginning of the buffer.
+    Start = Pending;
+    Count = PendingCount;
+    pthread_mutex_unlock(&Lock);
+    WriteBBTracePacket(Start, Count);
+    pthread_mutex_lock(&Lock);
+    Pending = 0;
+    pthread_cond_broadcast(&Changed);
+  }
+  pthread_mutex_unlock(&Lock);
+  return 0;
+}
+
+/* WriteAndFlushBBTraceData - hand the currently accumulated trace data to
+ * the writer and reset the cursor to point to the beginning of the other
+ * buffer.
  */
 static void WriteAndFlushBBTraceData () {
-  write_profiling_data(BBTraceInfo, ArrayStart, (ArrayCursor - ArrayStart));
+  unsigned Count = ArrayCursor - ArrayStart;
+  if (Count == 0) return;
+  if (!Threaded) {
+    WriteBBTracePacket(ArrayStart, Count);
+    ArrayCursor = ArrayStart;
+    return;
+  }
+
+  pthread_mutex_lock(&Lock);
+  /* the writer is still busy with the other buffer */
+  while (Pending)
+    pthread_cond_wait(&Changed, &Lock);
+  Pending = ArrayStart;
+  PendingCount = Count;
+  pthread_cond_broadcast(&Changed);
+  pthread_mutex_unlock(&Lock);
+
+  ArrayStart = ArrayStart == Buffers[0] ? Buffers[1] : Buffers[0];
+  ArrayEnd = ArrayStart + TRACE_BUFFER_BLOCKS;
   ArrayCursor = ArrayStart;
 }
 
 /* BBTraceAtExitHandler - When the program exits, just write out any remaining 
- * data and free the trace buffer.
+ * data and free the trace buffers.
  */
 static void BBTraceAtExitHandler(void) {
   WriteAndFlushBBTraceData ();
-  free (ArrayStart);
+  if (Threaded) {
+    pthread_mutex_lock(&Lock);
+    Stopping = 1;
+    pthread_cond_broadcast(&Changed);
+    pthread_mutex_unlock(&Lock);
+    pthread_join(Writer, 0);
+  }
+  free (Buffers[0]);
+  free (Buffers[1]);
+  free (Encoded);
+}
+
+/* BBTraceChild - A forked child traces from the fork on.  The writer thread
+ * isn't forked, the child writes its buffers itself.
+ */
+static void BBTraceChild(void) {
+  ArrayCursor = ArrayStart;
+  Pending = 0;
+  Threaded = 0;
+  pthread_mutex_init(&Lock, 0);
+  pthread_cond_init(&Changed, 0);
 }
 
 /* llvm_trace_basic_block - called upon hitting a new basic block. */
@@ -44,24 +160,33 @@ void llvm_trace_basic_block (unsigned BBNum) {
 
 /* llvm_start_basic_block_tracing - This is the main entry point of the basic
  * block tracing library.  It is responsible for setting up the atexit
- * handler and allocating the trace buffer.
+ * handler, allocating the trace buffers and starting the writer.
  */
 int llvm_start_basic_block_tracing(int argc, const char **argv,
                               unsigned *arrayStart, unsigned numElements) {
   int Ret;
-  const unsigned BufferSize = 128 * 1024;
-  unsigned ArraySize;
 
   Ret = save_arguments(argc, argv);
+  Raw = getenv("LLVMPROF_TRACE_RAW") != 0;
 
-  /* Allocate a buffer to contain BB tracing data */
-  ArraySize = BufferSize / sizeof (unsigned);
-  ArrayStart = malloc (ArraySize * sizeof (unsigned));
-  ArrayEnd = ArrayStart + ArraySize;
+  /* Allocate the buffers to contain BB tracing data */
+  Buffers[0] = malloc (TRACE_BUFFER_SIZE);
+  Buffers[1] = malloc (TRACE_BUFFER_SIZE);
+  Encoded = malloc (TRACE_BUFFER_BLOCKS * PROFILE_VARINT_MAX32);
+  if (!Buffers[0] || !Buffers[1] || !Encoded) {
+    fprintf(stderr, "error: unable to allocate trace buffers.\n");
+    exit(1);
+  }
+  ArrayStart = Buffers[0];
+  ArrayEnd = ArrayStart + TRACE_BUFFER_BLOCKS;
   ArrayCursor = ArrayStart;
 
+  /* without the thread every full buffer is written in place */
+  Threaded = pthread_create(&Writer, 0, BBTraceWriter, 0) == 0;
+
   /* Set up the atexit handler. */
   atexit (BBTraceAtExitHandler);
+  pthread_atfork (0, 0, BBTraceChild);
 
   return Ret;
 }
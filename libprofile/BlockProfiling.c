@@ -0,0 +1,69 @@
+/*===-- BlockProfiling.c - Support library for block profiling ------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the block profiling
+|* instrumentation pass.  This should be used with the -insert-block-profiling
+|* LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+/* BlockProfAtExitHandler - Write out the counters, behind the map which the
+ * loader needs to calculate the blocks without a counter.
+ */
+static void BlockProfAtExitHandler(void) {
+  write_profiling_data_long(BlockMapInfo64, ArrayStart, NumElements);
+}
+
+/* BlockProfResetCounters - Zero the counters behind the map.  The third
+ * word of the map is the number of counters, they are at the end.
+ */
+static void BlockProfResetCounters(void *Counters, uint64_t N) {
+  uint64_t *Map = Counters;
+  uint64_t NumCounters = Map[2];
+  memset(Map + N - NumCounters, 0, NumCounters * sizeof(uint64_t));
+}
+
+static void BlockProfWriteCounters(void *Counters, uint64_t N) {
+  write_profiling_data_long(BlockMapInfo64, Counters, N);
+}
+
+/* BlockProfChild - A forked child counts its own blocks from zero. */
+static void BlockProfChild(void) {
+  BlockProfResetCounters(ArrayStart, NumElements);
+}
+
+static void BlockProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("block", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  pthread_atfork(0, 0, BlockProfChild);
+}
+
+const struct ProfilingRuntime llvm_block_profiling_runtime = {
+  "block", BlockProfStart, BlockProfAtExitHandler,
+  BlockProfResetCounters, BlockProfWriteCounters
+};
+
+/* llvm_start_block_profiling - This is the main entry point of the block
+ * profiling library.  It is responsible for setting up the atexit handler.
+ */
+int llvm_start_block_profiling(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  BlockProfStart(arrayStart, numElements);
+  atexit(BlockProfAtExitHandler);
+  return Ret;
+}
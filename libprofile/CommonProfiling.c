@@ -13,9 +13,13 @@
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
+#include "ProfileVarint.h"
 #include <assert.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,6 +36,55 @@ static const char *SavedEnvVar = 0;
 
 static const char *OutputFilename = "llvmprof.out";
 
+static int OutFile = -1;
+/* set in a process forked after the runtime started, which writes its own
+ * file */
+static int ForkedChild;
+
+/* With LLVMPROF_APPEND every process keeps its packets in AppendBuffer and
+ * appends them to the shared profile file in a single write at exit.
+ */
+static int AppendOutput;
+static ProfilingBuffer AppendBuffer;
+static pthread_mutex_t AppendLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int write_iov(int File, struct iovec* Iov, int Count);
+
+/* the parent's file and buffered packets are not the child's */
+static void output_child(void) {
+  if (OutFile != -1) close(OutFile);
+  OutFile = -1;
+  ForkedChild = 1;
+  AppendBuffer.Size = 0;
+  pthread_mutex_init(&AppendLock, 0);
+}
+
+/* the record of this process, with its ArgumentInfo first */
+static void AppendAtExitHandler(void) {
+  struct iovec Record = { AppendBuffer.Data, AppendBuffer.Size };
+  if (AppendBuffer.Size == 0) return;
+  if (write_iov(OutFile, &Record, 1) < 0) {
+    fprintf(stderr, "error: unable to write to output file.");
+    exit(0);
+  }
+  profiling_buffer_free(&AppendBuffer);
+}
+
+/* setup_output - Install the fork handler and read LLVMPROF_APPEND, once.
+ * It runs before any runtime registers its exit handler, so the record is
+ * appended after all of them ran.
+ */
+static void setup_output(void) {
+  static int Done;
+  if (Done) return;
+  Done = 1;
+  pthread_atfork(0, 0, output_child);
+  if (getenv("LLVMPROF_APPEND")) {
+    AppendOutput = 1;
+    atexit(AppendAtExitHandler);
+  }
+}
+
 /* check_environment_variable - Check to see if the LLVMPROF_OUTPUT environment
  * variable is set.  If it is then save it and set OutputFilename.
  */
@@ -57,6 +110,7 @@ static void check_environment_variable(void) {
  */
 int save_arguments(int argc, const char **argv) {
   unsigned Length, i;
+  setup_output();
   if (!SavedEnvVar && !SavedArgs) check_environment_variable();
   if (SavedArgs || !argv) return argc;  /* This can be called multiple times */
 
@@ -112,37 +166,87 @@ int save_arguments(int argc, const char **argv) {
 }
 
 
+const char *get_saved_arguments(unsigned *Length) {
+  *Length = SavedArgsLength;
+  return SavedArgs;
+}
+
+/* get_output_filename - Put the name of the profile file in Name, in
+ * PROFILING_OUTDIR if it is set, which is created if it doesn't exist.  A
+ * forked child gets its own file even without OUTPUT_HASPID, unless all
+ * processes append to one with LLVMPROF_APPEND.
+ */
+void get_output_filename(char *Name, size_t Size) {
+  char* OutDir = getenv("PROFILING_OUTDIR");
+#ifdef OUTPUT_HASPID
+  int HasPid = !AppendOutput;
+#else
+  int HasPid = ForkedChild && !AppendOutput;
+#endif
+  if (OutDir && access(OutDir, F_OK)) {
+    mkdir(OutDir, 0755);
+  }
+  if (HasPid)
+    snprintf(Name, Size, "%s%s%s.%lu",
+          (OutDir?:""),
+          (OutDir?"/":""),
+          OutputFilename,
+          (unsigned long)getpid());
+  else
+    snprintf(Name, Size, "%s%s%s",
+          (OutDir?:""),
+          (OutDir?"/":""),
+          OutputFilename);
+}
+
+/* Output the command line arguments to the file. */
+static int write_argument_info(int File) {
+  int PTy = ArgumentInfo;
+  int Zeros = 0;
+  /* Pad out to a multiple of four bytes */
+  struct iovec Packet[4] = {
+    { &PTy, sizeof(int) },
+    { &SavedArgsLength, sizeof(unsigned) },
+    { SavedArgs, SavedArgsLength },
+    { &Zeros, (4-(SavedArgsLength&3))&3 }
+  };
+  return write_profiling_iov(File, Packet, 4);
+}
+
+/* The file a snapshot is being written to, by the thread writing it. */
+static __thread int SnapshotFile = -1;
+/* The packets to the profile file the thread collects, see
+ * capture_profiling_output. */
+static __thread ProfilingBuffer* Capture;
+
+void set_snapshot_file(int File) {
+  SnapshotFile = File;
+  if (File != -1 && write_argument_info(File) < 0) {
+    fprintf(stderr,"error: unable to write to snapshot file.");
+    exit(0);
+  }
+}
+
 /*
  * Retrieves the file descriptor for the profile file.
  */
 int getOutFile() {
-  static int OutFile = -1;
   char OutputFilenameRuntime[1024] = {0};
 
+  if (SnapshotFile != -1) return SnapshotFile;
+
   /* If this is the first time this function is called, open the output file
    * for appending, creating it if it does not already exist.
    */
   if (OutFile == -1) {
-     char* OutDir = getenv("PROFILING_OUTDIR");
-     if(access(OutDir,F_OK)){
-        mkdir(OutDir, 0755);
+     get_output_filename(OutputFilenameRuntime, sizeof(OutputFilenameRuntime));
+     if (AppendOutput)
+        OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY | O_APPEND,
+                       0666);
+     else {
+        OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY, 0666);
+        lseek(OutFile, 0, SEEK_END); /* O_APPEND prevents seeking */
      }
-#ifdef OUTPUT_HASPID
-     pid_t pid = getpid();
-     snprintf(OutputFilenameRuntime,sizeof(OutputFilenameRuntime),"%s%s%s.%lu",
-           (OutDir?:""),
-           (OutDir?"/":""),
-           OutputFilename,
-           (unsigned long)pid);
-     OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY, 0666);
-#else
-     snprintf(OutputFilenameRuntime,sizeof(OutputFilenameRuntime),"%s%s%s",
-           (OutDir?:""),
-           (OutDir?"/":""),
-           OutputFilename);
-     OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY, 0666);
-#endif
-     lseek(OutFile, 0, SEEK_END); /* O_APPEND prevents seeking */
      if (OutFile == -1) {
         fprintf(stderr, "LLVM profiling runtime: while opening '%s': ",
               OutputFilename);
@@ -150,24 +254,10 @@ int getOutFile() {
         return(OutFile);
      }
 
-     /* Output the command line arguments to the file. */
-     {
-        int PTy = ArgumentInfo;
-      int Zeros = 0;
-      if (write(OutFile, &PTy, sizeof(int)) < 0 ||
-          write(OutFile, &SavedArgsLength, sizeof(unsigned)) < 0 ||
-          write(OutFile, SavedArgs, SavedArgsLength) < 0 ) {
+     if (write_argument_info(OutFile) < 0) {
         fprintf(stderr,"error: unable to write to output file.");
         exit(0);
-      }
-      /* Pad out to a multiple of four bytes */
-      if (SavedArgsLength & 3) {
-        if (write(OutFile, &Zeros, 4-(SavedArgsLength&3)) < 0) {
-          fprintf(stderr,"error: unable to write to output file.");
-          exit(0);
-        }
-      }
-    }
+     }
   }
   return(OutFile);
 }
@@ -181,29 +271,168 @@ void write_profiling_data(enum ProfilingType PT, unsigned *Start,
                           unsigned NumElements) {
   int PTy;
   int outFile = getOutFile();
+  struct iovec Packet[3] = {
+    { &PTy, sizeof(int) },
+    { &NumElements, sizeof(unsigned) },
+    { Start, NumElements*sizeof(unsigned) }
+  };
 
   /* Write out this record! */
   PTy = PT;
-  if( write(outFile, &PTy, sizeof(int)) < 0 ||
-      write(outFile, &NumElements, sizeof(unsigned)) < 0 ||
-      write(outFile, Start, NumElements*sizeof(unsigned)) < 0 ) {
+  if (write_profiling_iov(outFile, Packet, 3) < 0) {
     fprintf(stderr,"error: unable to write to output file.");
     exit(0);
   }
 }
 
+/* write_sparse_counters - Write an EdgeInfo64 or BlockInfo64 array as
+ * |type|count|bytes|varints...| padded to four bytes, if at most half of its
+ * counters are used and the varints are smaller.  Returns 0 if the dense
+ * packet is to be written instead.
+ */
+static int write_sparse_counters(enum ProfilingType PT, uint64_t* Start,
+                                 uint64_t NumElements)
+{
+  static int Dense = -1;
+  int PTy = PT == EdgeInfo64 ? EdgeInfo64Sparse : BlockInfo64Sparse;
+  int Zeros = 0, Ret;
+  uint64_t Used, Bytes;
+  unsigned char *Encoded;
+  struct iovec Packet[5];
+
+  if (Dense == -1) Dense = getenv("LLVMPROF_COUNTERS_DENSE") != 0;
+  if (Dense) return 0;
+  Bytes = profile_sparse_size(Start, NumElements, &Used);
+  if (Used * 2 > NumElements || Bytes >= NumElements * sizeof(uint64_t))
+    return 0;
+  if (!(Encoded = malloc(Bytes + 1))) return 0;
+  profile_encode_sparse(Start, NumElements, Encoded);
+  Packet[0].iov_base = &PTy;         Packet[0].iov_len = sizeof(int);
+  Packet[1].iov_base = &NumElements; Packet[1].iov_len = sizeof(uint64_t);
+  Packet[2].iov_base = &Bytes;       Packet[2].iov_len = sizeof(uint64_t);
+  Packet[3].iov_base = Encoded;      Packet[3].iov_len = Bytes;
+  Packet[4].iov_base = &Zeros;       Packet[4].iov_len = (4 - (Bytes & 3)) & 3;
+  Ret = write_profiling_iov(getOutFile(), Packet, 5);
+  free(Encoded);
+  if (Ret < 0) {
+    fprintf(stderr, "error: unable to write to output file.");
+    exit(0);
+  }
+  return 1;
+}
+
 void write_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
                           uint64_t NumElements)
 {
   int PTy;
   int outFile = getOutFile();
+  struct iovec Packet[3] = {
+    { &PTy, sizeof(int) },
+    { &NumElements, sizeof(uint64_t) },
+    { Start, NumElements * sizeof(uint64_t) }
+  };
+
+  if ((PT == EdgeInfo64 || PT == BlockInfo64) &&
+      write_sparse_counters(PT, Start, NumElements))
+    return;
 
   /* Write out this record! */
   PTy = PT;
-  if (write(outFile, &PTy, sizeof(int)) < 0
-      || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-      || write(outFile, Start, NumElements * sizeof(uint64_t)) < 0) {
+  if (write_profiling_iov(outFile, Packet, 3) < 0) {
      fprintf(stderr, "error: unable to write to output file.");
      exit(0);
   }
 }
+
+void check_single_start(const char *Name, const void *Counters) {
+  if (!Counters) return;
+  fprintf(stderr, "LLVM profiling runtime: %s profiling is started by two "
+          "modules, instrument them with -profile-counter-registry.\n", Name);
+  exit(1);
+}
+
+void capture_profiling_output(ProfilingBuffer* Buffer) {
+  Capture = Buffer;
+}
+
+/* write_profiling_iov - Write a whole packet with one writev, which is a
+ * single append unless the kernel writes it short; then the rest follows.
+ * With LLVMPROF_APPEND the packets of the profile file are only buffered.
+ */
+int write_profiling_iov(int File, struct iovec* Iov, int Count) {
+  int i;
+  if (Capture && File == OutFile) {
+    ProfilingBuffer* Buffer = Capture;
+    for (i = 0; i < Count; ++i)
+      profiling_buffer_append(Buffer, Iov[i].iov_base, Iov[i].iov_len);
+    if (Buffer->Size < PROFILING_BUFFER_FLUSH) return 0;
+    Capture = 0;
+    profiling_buffer_flush(Buffer);
+    Capture = Buffer;
+    return 0;
+  }
+  if (!AppendOutput || File != OutFile)
+    return write_iov(File, Iov, Count);
+  pthread_mutex_lock(&AppendLock);
+  for (i = 0; i < Count; ++i)
+    profiling_buffer_append(&AppendBuffer, Iov[i].iov_base, Iov[i].iov_len);
+  pthread_mutex_unlock(&AppendLock);
+  return 0;
+}
+
+int write_profiling_stream(struct iovec* Iov, int Count) {
+  return write_iov(getOutFile(), Iov, Count);
+}
+
+static int write_iov(int File, struct iovec* Iov, int Count) {
+  while (Count > 0) {
+    ssize_t Written = writev(File, Iov, Count);
+    if (Written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    /* skip what was written, the last iovec may be partly done */
+    while (Count > 0 && (size_t)Written >= Iov->iov_len) {
+      Written -= Iov->iov_len;
+      ++Iov;
+      --Count;
+    }
+    if (Count > 0) {
+      Iov->iov_base = (char*)Iov->iov_base + Written;
+      Iov->iov_len -= Written;
+    }
+  }
+  return 0;
+}
+
+void profiling_buffer_append(ProfilingBuffer* Buffer, const void* Data,
+                             size_t Size) {
+  if (Buffer->Size + Size > Buffer->Capacity) {
+    size_t Capacity = Buffer->Capacity ? Buffer->Capacity : 4096;
+    while (Capacity < Buffer->Size + Size) Capacity *= 2;
+    Buffer->Data = realloc(Buffer->Data, Capacity);
+    if (!Buffer->Data) {
+      fprintf(stderr, "error: unable to allocate output buffer.");
+      exit(0);
+    }
+    Buffer->Capacity = Capacity;
+  }
+  memcpy(Buffer->Data + Buffer->Size, Data, Size);
+  Buffer->Size += Size;
+}
+
+void profiling_buffer_flush(ProfilingBuffer* Buffer) {
+  struct iovec Packet = { Buffer->Data, Buffer->Size };
+  if (Buffer->Size == 0) return;
+  if (write_profiling_iov(getOutFile(), &Packet, 1) < 0) {
+    fprintf(stderr, "error: unable to write to output file.");
+    exit(0);
+  }
+  Buffer->Size = 0;
+}
+
+void profiling_buffer_free(ProfilingBuffer* Buffer) {
+  free(Buffer->Data);
+  Buffer->Data = 0;
+  Buffer->Size = Buffer->Capacity = 0;
+}
@@ -0,0 +1,145 @@
+/*===-- CounterRegistry.c - Start every profiling runtime at once ---------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routine for the -profile-counter-registry
+|* LLVM pass.  It replaces the llvm_start_* calls of the profiling passes: the
+|* runtimes are started on their ranges of the module's counter region, and a
+|* single exit handler writes all their packets in one append.
+|*
+|* Any number of modules and shared libraries can register their tables.  A
+|* runtime is started on the counters of the first module which uses it, the
+|* counters of the others are only written, behind a ModuleInfo64 packet with
+|* the hash of their module.  Path and value profiling count in tables of
+|* the first module only, the calls of the others return at once.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* RegistryEntry - A runtime and its counters, as the pass emits them.  The
+ * first entry of a table has no runtime, its Start is the name of the module
+ * and its NumElements the module hash.  Ignored, if not 0, is the flag which
+ * turns off the runtime calls of the module that index its tables.
+ */
+struct RegistryEntry {
+  const struct ProfilingRuntime *Runtime;
+  void *Start;
+  uint64_t NumElements;
+  char *Ignored;
+};
+
+/* what became of the counters of an entry */
+enum { Started, Further, Ignored };
+
+struct RegisteredModule {
+  const struct RegistryEntry *Entries;
+  uint32_t NumEntries;
+  char *Roles;
+  struct RegisteredModule *Next;
+};
+
+static struct RegisteredModule *Modules;
+static struct RegisteredModule **LastModule = &Modules;
+static pthread_mutex_t RegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* isStarted - Whether Runtime was started on a registered module. */
+static int isStarted(const struct ProfilingRuntime *Runtime) {
+  struct RegisteredModule *M;
+  uint32_t i;
+  for (M = Modules; M; M = M->Next)
+    for (i = 1; i < M->NumEntries; ++i)
+      if (M->Roles[i] == Started && M->Entries[i].Runtime == Runtime)
+        return 1;
+  return 0;
+}
+
+/* RegistryAtExitHandler - Write the packets of every module, in the order
+ * they were registered, they are buffered until the last one is done.
+ */
+static void RegistryAtExitHandler(void) {
+  ProfilingBuffer Buffer = { 0, 0, 0 };
+  struct RegisteredModule *M;
+  uint32_t i;
+  capture_profiling_output(&Buffer);
+  for (M = Modules; M; M = M->Next) {
+    uint64_t Hash = M->Entries[0].NumElements;
+    write_profiling_data_long(ModuleInfo64, &Hash, 1);
+    for (i = 1; i < M->NumEntries; ++i) {
+      const struct RegistryEntry *E = &M->Entries[i];
+      if (M->Roles[i] == Started)
+        E->Runtime->Write();
+      else if (M->Roles[i] == Further)
+        E->Runtime->WriteCounters(E->Start, E->NumElements);
+    }
+  }
+  capture_profiling_output(0);
+  profiling_buffer_flush(&Buffer);
+  profiling_buffer_free(&Buffer);
+}
+
+/* RegistryChild - A forked child counts from zero, the runtimes reset the
+ * counters they were started on themselves.
+ */
+static void RegistryChild(void) {
+  struct RegisteredModule *M;
+  uint32_t i;
+  pthread_mutex_init(&RegistryLock, 0);
+  for (M = Modules; M; M = M->Next)
+    for (i = 1; i < M->NumEntries; ++i)
+      if (M->Roles[i] == Further)
+        M->Entries[i].Runtime->ResetCounters(M->Entries[i].Start,
+                                             M->Entries[i].NumElements);
+}
+
+/* llvm_start_profile_registry - This is the main entry point of a module
+ * instrumented with -profile-counter-registry.  A module without main calls
+ * it from a constructor, with no arguments.
+ */
+int llvm_start_profile_registry(int argc, const char **argv,
+                                const struct RegistryEntry *entries,
+                                uint32_t numEntries) {
+  int Ret = save_arguments(argc, argv);
+  struct RegisteredModule *M = malloc(sizeof(*M));
+  uint32_t i;
+  if (!M || !(M->Roles = calloc(numEntries, 1))) {
+    fprintf(stderr, "error: unable to register profile counters.\n");
+    exit(0);
+  }
+  M->Entries = entries;
+  M->NumEntries = numEntries;
+  M->Next = 0;
+
+  pthread_mutex_lock(&RegistryLock);
+  if (!Modules) {
+    atexit(RegistryAtExitHandler);
+    pthread_atfork(0, 0, RegistryChild);
+  }
+  for (i = 1; i < numEntries; ++i) {
+    const struct ProfilingRuntime *R = entries[i].Runtime;
+    if (!isStarted(R)) {
+      R->Start(entries[i].Start, entries[i].NumElements);
+      M->Roles[i] = Started;
+    } else if (R->ResetCounters) {
+      R->ResetCounters(entries[i].Start, entries[i].NumElements);
+      M->Roles[i] = Further;
+    } else {
+      fprintf(stderr, "LLVM profiling runtime: %s profiling of '%s' is "
+              "ignored, it works for one module only.\n", R->Name,
+              (const char *)entries[0].Start);
+      if (entries[i].Ignored) *entries[i].Ignored = 1;
+      M->Roles[i] = Ignored;
+    }
+  }
+  *LastModule = M;
+  LastModule = &M->Next;
+  pthread_mutex_unlock(&RegistryLock);
+  return Ret;
+}
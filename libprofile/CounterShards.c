@@ -0,0 +1,95 @@
+/*===-- CounterShards.c - Per-thread counter arrays ------------------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the per-thread counter shards used by
+|* -edge-profiling-sharded.  Every thread gets a private copy of the counter
+|* array on its first instrumented function entry, so hot loops run by many
+|* threads don't share cache lines.  The shards are summed into the module's
+|* array when the program exits.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+/* header of each shard, the counters follow it on the next cache line */
+struct CounterShard {
+  struct CounterShard *Next;
+  uint64_t Counters[] __attribute__((aligned(CACHE_LINE)));
+};
+
+uint64_t *acquire_counter_shard(struct CounterShardList *List,
+                                uint64_t NumElements) {
+  struct CounterShard *Shard;
+  size_t Bytes = sizeof(struct CounterShard) + NumElements * sizeof(uint64_t);
+  /* round up so the last line isn't shared with the next allocation */
+  Bytes = (Bytes + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  if (posix_memalign((void **)&Shard, CACHE_LINE, Bytes) != 0) {
+    fprintf(stderr, "error: unable to allocate counter shard.\n");
+    exit(1);
+  }
+  memset(Shard, 0, Bytes);
+
+  /* keep creation order, so thread packets are numbered stably */
+  pthread_mutex_lock(&List->Lock);
+  *List->Tail = Shard;
+  List->Tail = &Shard->Next;
+  List->NumShards++;
+  pthread_mutex_unlock(&List->Lock);
+  return Shard->Counters;
+}
+
+void merge_counter_shards(struct CounterShardList *List, uint64_t *Start,
+                          uint64_t NumElements) {
+  struct CounterShard *Shard;
+  uint64_t i;
+  pthread_mutex_lock(&List->Lock);
+  /* zeros are not added, not to touch the lazy pages of Start */
+  for (Shard = List->Head; Shard; Shard = Shard->Next)
+    for (i = 0; i < NumElements; ++i)
+      if (Shard->Counters[i]) Start[i] += Shard->Counters[i];
+  pthread_mutex_unlock(&List->Lock);
+}
+
+void reset_counter_shards(struct CounterShardList *List, uint64_t NumElements,
+                          uint64_t *Keep) {
+  struct CounterShard *Shard = List->Head, *Next;
+  /* a thread which wasn't forked may have held the lock */
+  pthread_mutex_init(&List->Lock, 0);
+  List->Head = 0;
+  List->Tail = &List->Head;
+  List->NumShards = 0;
+  for (; Shard; Shard = Next) {
+    Next = Shard->Next;
+    if (Shard->Counters != Keep) {
+      free(Shard);
+      continue;
+    }
+    memset(Shard->Counters, 0, NumElements * sizeof(uint64_t));
+    Shard->Next = 0;
+    *List->Tail = Shard;
+    List->Tail = &Shard->Next;
+    List->NumShards++;
+  }
+}
+
+void write_counter_shards(struct CounterShardList *List, enum ProfilingType PT,
+                          uint64_t NumElements) {
+  struct CounterShard *Shard;
+  if (!List->Head || !getenv("LLVMPROF_THREAD_PACKETS")) return;
+  pthread_mutex_lock(&List->Lock);
+  for (Shard = List->Head; Shard; Shard = Shard->Next)
+    write_profiling_data_long(PT, Shard->Counters, NumElements);
+  pthread_mutex_unlock(&List->Lock);
+}
@@ -9,15 +9,19 @@
 |* 
 |* This file implements the call back routines for the edge profiling
 |* instrumentation pass.  This should be used with the -insert-edge-profiling
-|* LLVM pass.
+|* or -insert-edge-profiling-sampled LLVM pass.
 |*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
 #include <stdlib.h>
+#include <string.h>
 
 static uint64_t *ArrayStart;
 static uint64_t NumElements;
+static struct CounterShardList Shards = COUNTER_SHARD_LIST_INIT(Shards);
+static __thread uint64_t *ThreadShard;
+static uint64_t *SnapshotCounts;
 
 /* EdgeProfAtExitHandler - When the program exits, just write out the profiling
  * data.
@@ -28,9 +32,67 @@ static void EdgeProfAtExitHandler(void) {
    * collected into simple edge profiles.  Since we directly count each edge, we
    * just write out all of the counters directly.
    */
-  write_profiling_data_long(EdgeInfo64, ArrayStart, NumElements);
+  stop_snapshots();
+  merge_counter_shards(&Shards, ArrayStart, NumElements);
+  write_counter_pages(EdgeInfo64, ArrayStart, NumElements);
+  write_counter_shards(&Shards, ThreadEdgeInfo64, NumElements);
 }
 
+/* SampledEdgeProfAtExitHandler - Write the counts of the counting copies,
+ * with the sampling period and burst behind them for the loader to scale
+ * them up.
+ */
+static void SampledEdgeProfAtExitHandler(void) {
+  merge_counter_shards(&Shards, ArrayStart, NumElements);
+  write_profiling_data_long(SampledEdgeInfo64, ArrayStart, NumElements + 2);
+}
+
+/* EdgeProfSnapshot - Write the edge counters of the running program. */
+static void EdgeProfSnapshot(int Delta) {
+  write_counter_snapshot(EdgeInfo64, ArrayStart, NumElements, &Shards, Delta,
+                         &SnapshotCounts);
+}
+
+/* EdgeProfChild - A forked child counts its own edges from zero. */
+static void EdgeProfChild(void) {
+  reset_counter_pages(ArrayStart, NumElements);
+  reset_counter_shards(&Shards, NumElements, ThreadShard);
+}
+
+/* llvm_edge_profiling_shard - Return the calling thread's copy of the edge
+ * counters, used by -edge-profiling-sharded.  Only the first module gets
+ * shards, the others count in their array.
+ */
+uint64_t *llvm_edge_profiling_shard(uint64_t *arrayStart,
+                                    uint64_t numElements) {
+  if (arrayStart != ArrayStart) return arrayStart;
+  if (!ThreadShard)
+    ThreadShard = acquire_counter_shard(&Shards, numElements);
+  return ThreadShard;
+}
+
+
+static void EdgeProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("edge", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  pthread_atfork(0, 0, EdgeProfChild);
+  register_snapshot_writer(EdgeProfSnapshot);
+  share_counters(EdgeInfo64, ArrayStart, NumElements, &Shards);
+}
+
+static void EdgeProfResetCounters(void *Counters, uint64_t N) {
+  reset_counter_pages(Counters, N);
+}
+
+static void EdgeProfWriteCounters(void *Counters, uint64_t N) {
+  write_counter_pages(EdgeInfo64, Counters, N);
+}
+
+const struct ProfilingRuntime llvm_edge_profiling_runtime = {
+  "edge", EdgeProfStart, EdgeProfAtExitHandler,
+  EdgeProfResetCounters, EdgeProfWriteCounters
+};
 
 /* llvm_start_edge_profiling - This is the main entry point of the edge
  * profiling library.  It is responsible for setting up the atexit handler.
@@ -38,8 +100,42 @@ static void EdgeProfAtExitHandler(void) {
 int llvm_start_edge_profiling(int argc, const char **argv,
                               uint64_t *arrayStart, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements;
+  EdgeProfStart(arrayStart, numElements);
   atexit(EdgeProfAtExitHandler);
   return Ret;
 }
+
+static void SampledEdgeProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("sampled edge", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements - 2;
+  pthread_atfork(0, 0, EdgeProfChild);
+}
+
+/* the sampling period and burst behind the counts stay */
+static void SampledEdgeProfResetCounters(void *Counters, uint64_t N) {
+  memset(Counters, 0, (N - 2) * sizeof(uint64_t));
+}
+
+static void SampledEdgeProfWriteCounters(void *Counters, uint64_t N) {
+  write_profiling_data_long(SampledEdgeInfo64, Counters, N);
+}
+
+const struct ProfilingRuntime llvm_sampled_edge_profiling_runtime = {
+  "sampled edge", SampledEdgeProfStart, SampledEdgeProfAtExitHandler,
+  SampledEdgeProfResetCounters, SampledEdgeProfWriteCounters
+};
+
+/* llvm_start_sampled_edge_profiling - The entry point of the
+ * -insert-edge-profiling-sampled instrumentation.  The last two elements of
+ * the array hold the sampling period and burst.  Sampled counts are not
+ * written to snapshots, shared memory or per thread packets.
+ */
+int llvm_start_sampled_edge_profiling(int argc, const char **argv,
+                                      uint64_t *arrayStart,
+                                      uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  SampledEdgeProfStart(arrayStart, numElements);
+  atexit(SampledEdgeProfAtExitHandler);
+  return Ret;
+}
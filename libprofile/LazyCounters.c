@@ -0,0 +1,147 @@
+/*===-- LazyCounters.c - Commit counter pages on their first count --------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routine for the -profile-counters-mmap
+|* option of the edge and pred block profiling passes.  The zero pages of a
+|* counter array are mapped again, in place, as private anonymous memory
+|* without swap reserved for it, so the untouched counters of a huge module
+|* cost no commit charge.  The pages which stay zero are left out of its
+|* packet, written as a PagedInfo64.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* LazyArray - A counter array whose zero pages were mapped again. */
+struct LazyArray {
+  uint64_t *Start;
+  uint64_t NumElements;
+};
+
+#define MAX_LAZY_ARRAYS 64
+static struct LazyArray LazyArrays[MAX_LAZY_ARRAYS];
+static unsigned NumLazyArrays;
+static pthread_mutex_t LazyLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uintptr_t pageSize(void) {
+  static uintptr_t Size;
+  if (!Size) Size = sysconf(_SC_PAGESIZE);
+  return Size;
+}
+
+/* isZeroPage - Reading an untouched page only maps the zero page. */
+static int isZeroPage(const uint64_t *Page) {
+  size_t i, Words = pageSize() / sizeof(uint64_t);
+  for (i = 0; i != Words; ++i)
+    if (Page[i]) return 0;
+  return 1;
+}
+
+static void remapPages(uintptr_t Start, uintptr_t End) {
+  if (Start == End) return;
+  if (mmap((void *)Start, End - Start, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+      == MAP_FAILED)
+    perror("LLVM profiling runtime: unable to map counters lazily");
+}
+
+/* findLazyArray - The lazy array Start is the beginning of, or 0. */
+static const struct LazyArray *findLazyArray(const uint64_t *Start) {
+  unsigned i;
+  for (i = 0; i != NumLazyArrays; ++i)
+    if (LazyArrays[i].Start == Start) return &LazyArrays[i];
+  return 0;
+}
+
+/* llvm_lazy_profile_counters - Map the whole zero pages of the array again.
+ * The counts of the constructors which ran before are kept, as is any array
+ * which is not in writable private memory.
+ */
+int llvm_lazy_profile_counters(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  uintptr_t Page = pageSize();
+  uintptr_t First = ((uintptr_t)arrayStart + Page - 1) & ~(Page - 1);
+  uintptr_t End = (uintptr_t)(arrayStart + numElements) & ~(Page - 1);
+  uintptr_t P, Run = First;
+
+  pthread_mutex_lock(&LazyLock);
+  if (findLazyArray(arrayStart) || NumLazyArrays == MAX_LAZY_ARRAYS) {
+    pthread_mutex_unlock(&LazyLock);
+    return Ret;
+  }
+  for (P = First; P < End; P += Page) {
+    if (isZeroPage((const uint64_t *)P)) continue;
+    remapPages(Run, P);
+    Run = P + Page;
+  }
+  if (Run < End) remapPages(Run, End);
+  LazyArrays[NumLazyArrays].Start = arrayStart;
+  LazyArrays[NumLazyArrays].NumElements = numElements;
+  ++NumLazyArrays;
+  pthread_mutex_unlock(&LazyLock);
+  return Ret;
+}
+
+void reset_counter_pages(uint64_t *Start, uint64_t NumElements) {
+  uintptr_t Page = pageSize();
+  uintptr_t First = ((uintptr_t)Start + Page - 1) & ~(Page - 1);
+  uintptr_t End = (uintptr_t)(Start + NumElements) & ~(Page - 1);
+  if (!findLazyArray(Start) || First >= End) {
+    memset(Start, 0, NumElements * sizeof(uint64_t));
+    return;
+  }
+  /* the whole pages are dropped, back to the zero page they started as */
+  memset(Start, 0, First - (uintptr_t)Start);
+  memset((void *)End, 0, (uintptr_t)(Start + NumElements) - End);
+  if (madvise((void *)First, End - First, MADV_DONTNEED))
+    memset((void *)First, 0, End - First);
+}
+
+void write_counter_pages(enum ProfilingType PT, uint64_t *Start,
+                         uint64_t NumElements) {
+  ProfilingBuffer Buffer = { 0, 0, 0 };
+  uint64_t Header[2], Chunk = pageSize() / sizeof(uint64_t), i, Run;
+  if (!findLazyArray(Start)) {
+    write_profiling_data_long(PT, Start, NumElements);
+    return;
+  }
+
+  /* the runs of chunks of a page's worth of counters which are not zero */
+  Header[0] = PT;
+  Header[1] = NumElements;
+  profiling_buffer_append(&Buffer, Header, sizeof(Header));
+  for (i = 0; i < NumElements; i = Run) {
+    uint64_t Length;
+    for (Run = i; Run < NumElements; ++Run)
+      if (Start[Run]) break;
+    if (Run == NumElements) break;
+    /* from the chunk of the first count to the next zero chunk */
+    i = Run - Run % Chunk;
+    for (Run = i; Run < NumElements; Run += Chunk) {
+      uint64_t j, e = Run + Chunk < NumElements ? Run + Chunk : NumElements;
+      for (j = Run; j != e; ++j)
+        if (Start[j]) break;
+      if (j == e) break;
+    }
+    if (Run > NumElements) Run = NumElements;
+    Header[0] = i;
+    Header[1] = Length = Run - i;
+    profiling_buffer_append(&Buffer, Header, sizeof(Header));
+    profiling_buffer_append(&Buffer, Start + i, Length * sizeof(uint64_t));
+  }
+  write_profiling_data_long(PagedInfo64, (uint64_t *)Buffer.Data,
+                            Buffer.Size / sizeof(uint64_t));
+  profiling_buffer_free(&Buffer);
+}
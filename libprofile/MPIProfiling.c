@@ -19,8 +19,8 @@
 #include <string.h>
 #include <stdio.h>
 
-static unsigned *ArrayStart;
-static unsigned NumElements;
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
 
 /* EdgeProfAtExitHandler - When the program exits, just write out the profiling
  * data.
@@ -31,33 +31,62 @@ static void MPIProfAtExitHandler(void) {
    * collected into simple edge profiles.  Since we directly count each edge, we
    * just write out all of the counters directly.
    */
-  unsigned* MapTable = ArrayStart + NumElements;
-  unsigned* VisitTable = MapTable + FORTRAN_DATATYPE_MAP_SIZE;
+  uint64_t* MapTable = ArrayStart + NumElements;
+  uint64_t* VisitTable = MapTable + FORTRAN_DATATYPE_MAP_SIZE;
   unsigned i;
   for(i=0;i<FORTRAN_DATATYPE_MAP_SIZE;++i){
-    if(*VisitTable++ == 1 && *MapTable++ == 0)
+    if(VisitTable[i] == 1 && MapTable[i] == 0)
       fprintf(stderr, "WARNNING: doesn't consider MPI Fortran Type %d\n", i);
   }
-  write_profiling_data(MPIFullInfo, ArrayStart, NumElements);
+  write_profiling_data_long(MPIFullInfo64, ArrayStart, NumElements);
 }
 
-static int init_datatype_map(uint32_t* DT)
+/* a forked child counts its own calls, the datatype map stays */
+static void MPIProfChild(void) {
+  memset(ArrayStart, 0, NumElements * sizeof(uint64_t));
+}
+
+static int init_datatype_map(uint64_t* DT)
 {
-   memset(DT, 0, sizeof(uint32_t) * FORTRAN_DATATYPE_MAP_SIZE * 2);
+   memset(DT, 0, sizeof(uint64_t) * FORTRAN_DATATYPE_MAP_SIZE * 2);
 #include "datatype.h"
    return 0;
 }
 
 
+static void MPIProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("mpi", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements - FORTRAN_DATATYPE_MAP_SIZE * 2;
+  init_datatype_map(ArrayStart + NumElements);
+  pthread_atfork(0, 0, MPIProfChild);
+}
+
+/* the datatype map behind the counters is set up again */
+static void MPIProfResetCounters(void *Counters, uint64_t N) {
+  uint64_t *C = Counters;
+  uint64_t NumCounters = N - FORTRAN_DATATYPE_MAP_SIZE * 2;
+  memset(C, 0, NumCounters * sizeof(uint64_t));
+  init_datatype_map(C + NumCounters);
+}
+
+static void MPIProfWriteCounters(void *Counters, uint64_t N) {
+  write_profiling_data_long(MPIFullInfo64, Counters,
+                            N - FORTRAN_DATATYPE_MAP_SIZE * 2);
+}
+
+const struct ProfilingRuntime llvm_mpi_profiling_runtime = {
+  "mpi", MPIProfStart, MPIProfAtExitHandler,
+  MPIProfResetCounters, MPIProfWriteCounters
+};
+
 /* llvm_start_edge_profiling - This is the main entry point of the edge
  * profiling library.  It is responsible for setting up the atexit handler.
  */
 int llvm_start_mpi_profiling(int argc, const char **argv,
-                              unsigned *arrayStart, unsigned numElements) {
+                              uint64_t *arrayStart, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements - FORTRAN_DATATYPE_MAP_SIZE * 2;
-  init_datatype_map(ArrayStart + NumElements);
+  MPIProfStart(arrayStart, numElements);
   atexit(MPIProfAtExitHandler);
   return Ret;
 }
@@ -16,8 +16,8 @@
 #include "Profiling.h"
 #include <stdlib.h>
 
-static unsigned *ArrayStart;
-static unsigned NumElements;
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
 
 /* OptEdgeProfAtExitHandler - When the program exits, just write out the
  * profiling data.
@@ -28,18 +28,45 @@ static void OptEdgeProfAtExitHandler(void) {
    * When loading this information the counters with value -1 have to be
    * recalculated, it is guaranteed that this is possible.
    */
-  write_profiling_data(OptEdgeInfo, ArrayStart, NumElements);
+  write_profiling_data_long(OptEdgeInfo64, ArrayStart, NumElements);
 }
 
+/* OptEdgeProfResetCounters - Zero the counters, the unused ones stay -1. */
+static void OptEdgeProfResetCounters(void *Counters, uint64_t N) {
+  uint64_t *C = Counters;
+  uint64_t i;
+  for (i = 0; i < N; ++i)
+    if (C[i] != ~(uint64_t)0) C[i] = 0;
+}
+
+static void OptEdgeProfWriteCounters(void *Counters, uint64_t N) {
+  write_profiling_data_long(OptEdgeInfo64, Counters, N);
+}
+
+/* OptEdgeProfChild - A forked child counts its own edges from zero. */
+static void OptEdgeProfChild(void) {
+  OptEdgeProfResetCounters(ArrayStart, NumElements);
+}
+
+static void OptEdgeProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("optimal edge", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  pthread_atfork(0, 0, OptEdgeProfChild);
+}
+
+const struct ProfilingRuntime llvm_opt_edge_profiling_runtime = {
+  "optimal edge", OptEdgeProfStart, OptEdgeProfAtExitHandler,
+  OptEdgeProfResetCounters, OptEdgeProfWriteCounters
+};
 
 /* llvm_start_opt_edge_profiling - This is the main entry point of the edge
  * profiling library.  It is responsible for setting up the atexit handler.
  */
 int llvm_start_opt_edge_profiling(int argc, const char **argv,
-                                  unsigned *arrayStart, unsigned numElements) {
+                                  uint64_t *arrayStart, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements;
+  OptEdgeProfStart(arrayStart, numElements);
   atexit(OptEdgeProfAtExitHandler);
   return Ret;
 }
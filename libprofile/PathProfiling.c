@@ -27,173 +27,481 @@
 #include <stdio.h>
 
 /* note that this is used for functions with large path counts,
-         but it is unlikely those paths will ALL be executed */
-#define ARBITRARY_HASH_BIN_COUNT 100
+         but it is unlikely those paths will ALL be executed, so each table
+         starts small and doubles whenever it gets half full */
+#define INITIAL_HASH_SLOT_COUNT 64
+#define EMPTY_PATH 0xffffffff
 
-typedef struct pathHashEntry_s {
+/* one open addressing slot, the table is probed linearly */
+typedef struct {
   uint32_t pathNumber;
-  uint32_t pathCount;
-  struct pathHashEntry_s* next;
-} pathHashEntry_t;
+  uint32_t reserved;
+  uint64_t pathCount;
+} pathHashSlot_t;
 
 typedef struct pathHashTable_s {
-  pathHashEntry_t* hashBins[ARBITRARY_HASH_BIN_COUNT];
-  uint32_t pathCounts;
+  pathHashSlot_t* slots;
+  uint32_t mask;          /* slot count - 1, slot count is a power of two */
+  uint32_t pathCounts;    /* used slots */
+  /* path EMPTY_PATH can't live in a slot, it gets a slot of its own, with
+     path number EMPTY_PATH once it is used */
+  pathHashSlot_t emptyPath;
 } pathHashTable_t;
 
+/* Tables and their slots are bump allocated from large chunks, so the
+   increment path never calls malloc for a single path.  Slots left behind
+   by a growing table are only given back at exit. */
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+typedef struct arenaChunk_s {
+  struct arenaChunk_s* next;
+} arenaChunk_t;
+
+static arenaChunk_t* arenaChunks;
+static char* arenaCur;
+static size_t arenaLeft;
+
+static void* arenaAlloc(size_t size) {
+  void* ret;
+  size = (size + 15) & ~(size_t)15;
+  if (size > arenaLeft) {
+    size_t chunkSize = sizeof(arenaChunk_t) + 16 + size;
+    arenaChunk_t* chunk;
+    if (chunkSize < ARENA_CHUNK_SIZE) chunkSize = ARENA_CHUNK_SIZE;
+    chunk = malloc(chunkSize);
+    if (!chunk) {
+      fprintf(stderr, "error: unable to allocate path hash table.\n");
+      exit(1);
+    }
+    chunk->next = arenaChunks;
+    arenaChunks = chunk;
+    arenaCur = (char*)(chunk + 1);
+    arenaCur += (16 - (uintptr_t)arenaCur % 16) % 16;
+    arenaLeft = (char*)chunk + chunkSize - arenaCur;
+  }
+  ret = arenaCur;
+  arenaCur += size;
+  arenaLeft -= size;
+  return ret;
+}
+
+static void arenaFree(void) {
+  while (arenaChunks) {
+    arenaChunk_t* next = arenaChunks->next;
+    free(arenaChunks);
+    arenaChunks = next;
+  }
+  arenaLeft = 0;
+}
+
+static pathHashSlot_t* allocSlots(uint32_t count) {
+  pathHashSlot_t* slots = arenaAlloc(count * sizeof(pathHashSlot_t));
+  /* every byte 0xff marks every pathNumber EMPTY_PATH */
+  memset(slots, 0xff, count * sizeof(pathHashSlot_t));
+  return slots;
+}
+
 typedef struct {
   enum ProfilingStorageType type;
   uint32_t size;
   void* array;
 } ftEntry_t;
 
+/* A ProfilingCachedHash function's entry points to this cache, allocated
+   by the instrumented program.  The inline fast path emitted by
+   -insert-path-profiling adds to the delta of slot pathNumber % numSlots
+   when its tag is pathNumber + 1, and calls llvm_path_cache_fill
+   otherwise.  The deltas are only added to the hash table when a slot is
+   evicted or at exit.  The tag has 64 bits, so that of path EMPTY_PATH
+   doesn't wrap to the one of an unused slot; the slot is as big anyway. */
+typedef struct {
+  uint64_t tag;    /* pathNumber + 1, 0 for an unused slot */
+  int64_t delta;
+} pathCacheSlot_t;
+
+typedef struct {
+  void* table;     /* the function's pathHashTable_t */
+  uint32_t numSlots;
+  uint32_t padding;
+  pathCacheSlot_t slots[];
+} pathCache_t;
+
 /* pointer to the function table allocated in the instrumented program */
 ftEntry_t* ft;
 uint32_t ftSize;
 
-/* write an array table to file */
-void writeArrayTable(uint32_t fNumber, ftEntry_t* ft, uint32_t* funcCount) {
-  int outFile = getOutFile();
-  uint32_t arrayHeaderLocation = 0;
-  uint32_t arrayCurrentLocation = 0;
-  uint32_t arrayIterator = 0;
-  uint32_t functionUsed = 0;
+/* count the executed paths of an array table */
+static uint32_t countArrayTable(ftEntry_t* ft) {
+  uint32_t arrayIterator;
   uint32_t pathCounts = 0;
+  for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ )
+    if( ((uint64_t*)ft->array)[arrayIterator] )
+      pathCounts++;
+  return pathCounts;
+}
+
+/* append an array table to the path packet, unless no path was executed */
+void writeArrayTable(uint32_t fNumber, ftEntry_t* ft, ProfilingBuffer* out) {
+  uint32_t arrayIterator = 0;
+  PathProfileHeader fHeader;
+
+  fHeader.fnNumber = fNumber;
+  fHeader.numEntries = countArrayTable(ft);
+  if( fHeader.numEntries == 0 )
+    return;
+  profiling_buffer_append(out, &fHeader, sizeof(PathProfileHeader));
 
-  /* look through each entry in the array to determine whether the function
-     was executed at all */
   for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ ) {
-    uint32_t pc = ((uint32_t*)ft->array)[arrayIterator];
+    uint64_t pc = ((uint64_t*)ft->array)[arrayIterator];
 
     /* was this path executed? */
     if( pc ) {
-      PathProfileTableEntry pte;
+      PathProfileTableEntry64 pte;
       pte.pathNumber = arrayIterator;
+      pte.reserved = 0;
       pte.pathCounter = pc;
-      pathCounts++;
-
-      /* one-time initialization stuff */
-      if(!functionUsed) {
-        arrayHeaderLocation = lseek(outFile, 0, SEEK_CUR);
-        lseek(outFile, sizeof(PathProfileHeader), SEEK_CUR);
-        functionUsed = 1;
-        (*funcCount)++;
-      }
-
-      /* write path data */
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+      profiling_buffer_append(out, &pte, sizeof(PathProfileTableEntry64));
     }
   }
-
-  /* If this function was executed, write the header */
-  if( functionUsed ) {
-    PathProfileHeader fHeader;
-    fHeader.fnNumber = fNumber;
-    fHeader.numEntries = pathCounts;
-
-    arrayCurrentLocation = lseek(outFile, 0, SEEK_CUR);
-    lseek(outFile, arrayHeaderLocation, SEEK_SET);
-
-    if (write(outFile, &fHeader, sizeof(PathProfileHeader)) < 0) {
-      fprintf(stderr,
-              "error: unable to write function header to output file.\n");
-      return;
-    }
-
-    lseek(outFile, arrayCurrentLocation, SEEK_SET);
-  }
 }
 
+/* murmur3's 32 bit finalizer, path numbers of one function are dense in
+   their low bits so they need to be mixed before masking */
 static uint32_t hash (uint32_t key) {
-  /* this may benefit from a proper hash function */
-  return key%ARBITRARY_HASH_BIN_COUNT;
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
 }
 
-/* output a specific function's hash table to the profile file */
-void writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable) {
-  int outFile = getOutFile();
+/* append a specific function's hash table to the path packet */
+void writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable,
+                    ProfilingBuffer* out) {
   PathProfileHeader header;
   uint32_t i;
 
   header.fnNumber = functionNumber;
   header.numEntries = hashTable->pathCounts;
+  if (hashTable->emptyPath.pathNumber == EMPTY_PATH)
+    header.numEntries++;
+  profiling_buffer_append(out, &header, sizeof(PathProfileHeader));
+
+  /* the slot layout is the same as PathProfileTableEntry64 */
+  for (i = 0; i <= hashTable->mask; i++) {
+    pathHashSlot_t* slot = &hashTable->slots[i];
+    if (slot->pathNumber != EMPTY_PATH)
+      profiling_buffer_append(out, slot, sizeof(PathProfileTableEntry64));
+  }
 
-  if (write(outFile, &header, sizeof(PathProfileHeader)) < 0) {
-    fprintf(stderr, "error: unable to write function header to output file.\n");
-    return;
+  if (hashTable->emptyPath.pathNumber == EMPTY_PATH) {
+    PathProfileTableEntry64 pte;
+    pte.pathNumber = EMPTY_PATH;
+    pte.reserved = 0;
+    pte.pathCounter = hashTable->emptyPath.pathCount;
+    profiling_buffer_append(out, &pte, sizeof(PathProfileTableEntry64));
   }
+}
 
-  for (i = 0; i < ARBITRARY_HASH_BIN_COUNT; i++) {
-    pathHashEntry_t* hashEntry = hashTable->hashBins[i];
+/* Double the slots of hashTable and rehash the used ones */
+static void growHashTable(pathHashTable_t* hashTable) {
+  pathHashSlot_t* oldSlots = hashTable->slots;
+  uint32_t oldCount = hashTable->mask + 1;
+  pathHashSlot_t* slots = allocSlots(oldCount * 2);
+  uint32_t mask = oldCount * 2 - 1;
+  uint32_t i;
 
-    while (hashEntry) {
-      pathHashEntry_t* temp;
+  for (i = 0; i < oldCount; i++) {
+    uint32_t index;
+    if (oldSlots[i].pathNumber == EMPTY_PATH) continue;
+    index = hash(oldSlots[i].pathNumber) & mask;
+    while (slots[index].pathNumber != EMPTY_PATH)
+      index = (index + 1) & mask;
+    slots[index] = oldSlots[i];
+  }
 
-      PathProfileTableEntry pte;
-      pte.pathNumber = hashEntry->pathNumber;
-      pte.pathCounter = hashEntry->pathCount;
+  /* a snapshot reads the mask before the slots, so it never sees the new
+     mask with the old slots */
+  hashTable->slots = slots;
+  __sync_synchronize();
+  hashTable->mask = mask;
+}
 
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+/* Return a pointer to this path's specific path counter */
+static uint64_t* getPathCounter(void** tableRef, uint32_t pathNumber) {
+  pathHashTable_t* hashTable = *tableRef;
+  uint32_t index;
+
+  if (hashTable == 0) {
+    hashTable = arenaAlloc(sizeof(pathHashTable_t));
+    hashTable->slots = allocSlots(INITIAL_HASH_SLOT_COUNT);
+    hashTable->mask = INITIAL_HASH_SLOT_COUNT - 1;
+    hashTable->pathCounts = 0;
+    hashTable->emptyPath.pathNumber = 0;
+    hashTable->emptyPath.reserved = 0;
+    hashTable->emptyPath.pathCount = 0;
+    __sync_synchronize();
+    *tableRef = hashTable;
+  }
 
-      temp = hashEntry;
-      hashEntry = hashEntry->next;
-      free (temp);
+  if (pathNumber == EMPTY_PATH) {
+    hashTable->emptyPath.pathNumber = pathNumber;
+    return &hashTable->emptyPath.pathCount;
+  }
 
-    }
+  index = hash(pathNumber) & hashTable->mask;
+  for (;;) {
+    pathHashSlot_t* slot = &hashTable->slots[index];
+    if (slot->pathNumber == pathNumber)
+      return &slot->pathCount;
+    if (slot->pathNumber == EMPTY_PATH)
+      break;
+    index = (index + 1) & hashTable->mask;
   }
-}
 
-/* Return a pointer to this path's specific path counter */
-static uint32_t* getPathCounter(uint32_t functionNumber,
-                                       uint32_t pathNumber) {
-  pathHashTable_t* hashTable;
-  pathHashEntry_t* hashEntry;
-  uint32_t index = hash(pathNumber);
+  /* keep the load under one half, so probes stay short */
+  if ((hashTable->pathCounts + 1) * 2 > hashTable->mask + 1) {
+    growHashTable(hashTable);
+    index = hash(pathNumber) & hashTable->mask;
+    while (hashTable->slots[index].pathNumber != EMPTY_PATH)
+      index = (index + 1) & hashTable->mask;
+  }
 
-  if( ft[functionNumber-1].array == 0)
-    ft[functionNumber-1].array = calloc(sizeof(pathHashTable_t), 1);
+  /* the count first, a snapshot takes a slot with a path number as used */
+  hashTable->slots[index].reserved = 0;
+  hashTable->slots[index].pathCount = 0;
+  __sync_synchronize();
+  hashTable->slots[index].pathNumber = pathNumber;
+  hashTable->pathCounts++;
+  return &hashTable->slots[index].pathCount;
+}
 
-  hashTable = (pathHashTable_t*)((ftEntry_t*)ft)[functionNumber-1].array;
-  hashEntry = hashTable->hashBins[index];
+/* Return where the hash table of a hashed function is kept */
+static void** getHashTableRef(uint32_t functionNumber) {
+  ftEntry_t* entry = &ft[functionNumber-1];
+  if (entry->type == ProfilingCachedHash)
+    return &((pathCache_t*)entry->array)->table;
+  return &entry->array;
+}
 
-  while (hashEntry) {
-    if (hashEntry->pathNumber == pathNumber) {
-      return &hashEntry->pathCount;
-    }
+/* Add a cache slot's delta to its path counter and empty the slot */
+static void flushCacheSlot(pathCache_t* cache, pathCacheSlot_t* slot) {
+  uint64_t* pathCounter;
+  if (slot->tag == 0) return;
 
-    hashEntry = hashEntry->next;
-  }
+  pathCounter = getPathCounter(&cache->table, slot->tag - 1);
+  *pathCounter += slot->delta;
+  slot->tag = 0;
+  slot->delta = 0;
+}
 
-  hashEntry = malloc(sizeof(pathHashEntry_t));
-  hashEntry->pathNumber = pathNumber;
-  hashEntry->pathCount = 0;
-  hashEntry->next = hashTable->hashBins[index];
-  hashTable->hashBins[index] = hashEntry;
-  hashTable->pathCounts++;
-  return &hashEntry->pathCount;
+/* Called by the inline fast path when pathNumber misses the cache: evict
+   the slot's path and make it pathNumber's */
+void llvm_path_cache_fill (uint32_t functionNumber, uint32_t pathNumber) {
+  pathCache_t* cache = ft[functionNumber-1].array;
+  pathCacheSlot_t* slot = &cache->slots[pathNumber & (cache->numSlots - 1)];
+  flushCacheSlot(cache, slot);
+  slot->tag = (uint64_t)pathNumber + 1;
 }
 
 /* Increment a specific path's count */
 void llvm_increment_path_count (uint32_t functionNumber, uint32_t pathNumber) {
-  uint32_t* pathCounter = getPathCounter(functionNumber, pathNumber);
-  if( *pathCounter < 0xffffffff )
-    (*pathCounter)++;
+  uint64_t* pathCounter = getPathCounter(getHashTableRef(functionNumber),
+                                         pathNumber);
+  (*pathCounter)++;
 }
 
 /* Increment a specific path's count */
 void llvm_decrement_path_count (uint32_t functionNumber, uint32_t pathNumber) {
-  uint32_t* pathCounter = getPathCounter(functionNumber, pathNumber);
+  uint64_t* pathCounter = getPathCounter(getHashTableRef(functionNumber),
+                                         pathNumber);
   (*pathCounter)--;
 }
 
+/* The entries of the function a snapshot is writing.  The snapshot thread
+   allocates with malloc, the arena belongs to the program's threads. */
+static PathProfileTableEntry64* snapshotEntries;
+static uint32_t snapshotEntryCount;
+static uint32_t snapshotEntryCapacity;
+
+static void snapshotEntry(uint32_t pathNumber, uint64_t pathCounter) {
+  if (snapshotEntryCount == snapshotEntryCapacity) {
+    snapshotEntryCapacity = snapshotEntryCapacity ? snapshotEntryCapacity * 2
+                                                  : 1024;
+    snapshotEntries = realloc(snapshotEntries, snapshotEntryCapacity *
+                              sizeof(PathProfileTableEntry64));
+    if (!snapshotEntries) {
+      fprintf(stderr, "error: unable to allocate path snapshot.\n");
+      exit(1);
+    }
+  }
+  snapshotEntries[snapshotEntryCount].pathNumber = pathNumber;
+  snapshotEntries[snapshotEntryCount].reserved = 0;
+  snapshotEntries[snapshotEntryCount].pathCounter = pathCounter;
+  snapshotEntryCount++;
+}
+
+/* Read the used slots of a hash table which may be growing meanwhile */
+static void snapshotHashTable(pathHashTable_t* hashTable) {
+  uint32_t mask = hashTable->mask;
+  pathHashSlot_t* slots;
+  uint32_t i;
+
+  __sync_synchronize();
+  slots = hashTable->slots;
+  for (i = 0; i <= mask; i++)
+    if (slots[i].pathNumber != EMPTY_PATH)
+      snapshotEntry(slots[i].pathNumber, slots[i].pathCount);
+  if (hashTable->emptyPath.pathNumber == EMPTY_PATH)
+    snapshotEntry(EMPTY_PATH, hashTable->emptyPath.pathCount);
+}
+
+static int comparePathNumbers(const void* lhs, const void* rhs) {
+  uint32_t l = ((const PathProfileTableEntry64*)lhs)->pathNumber;
+  uint32_t r = ((const PathProfileTableEntry64*)rhs)->pathNumber;
+  return l < r ? -1 : l > r;
+}
+
+/* Add the deltas still held by a path cache to the entries of its table */
+static void snapshotCache(pathCache_t* cache) {
+  uint32_t sorted = snapshotEntryCount;
+  uint32_t slot;
+
+  qsort(snapshotEntries, sorted, sizeof(PathProfileTableEntry64),
+        comparePathNumbers);
+  for (slot = 0; slot < cache->numSlots; slot++) {
+    PathProfileTableEntry64 key, *entry;
+    int64_t count;
+    uint64_t tag = cache->slots[slot].tag;
+    if (tag == 0) continue;
+
+    key.pathNumber = tag - 1;
+    entry = bsearch(&key, snapshotEntries, sorted,
+                    sizeof(PathProfileTableEntry64), comparePathNumbers);
+    count = (entry ? entry->pathCounter : 0) + cache->slots[slot].delta;
+    if (count < 0) count = 0;
+    if (entry)
+      entry->pathCounter = count;
+    else if (count)
+      snapshotEntry(key.pathNumber, count);
+  }
+}
+
+/* Path counts written by the previous delta snapshot, in a table keyed by
+   function and path number */
+typedef struct {
+  uint64_t key;     /* functionNumber << 32 | pathNumber, 0 if unused */
+  uint64_t count;
+} snapshotCount_t;
+
+static snapshotCount_t* snapshotCounts;
+static uint32_t snapshotCountMask;
+static uint32_t snapshotCountUsed;
+
+static uint32_t snapshotCountSlot(uint64_t key, snapshotCount_t* counts,
+                                  uint32_t mask) {
+  uint32_t index = hash((uint32_t)key ^ hash(key >> 32)) & mask;
+  while (counts[index].key && counts[index].key != key)
+    index = (index + 1) & mask;
+  return index;
+}
+
+static uint64_t* previousCount(uint32_t functionNumber, uint32_t pathNumber) {
+  uint64_t key = (uint64_t)functionNumber << 32 | pathNumber;
+  uint32_t index;
+
+  if ((snapshotCountUsed + 1) * 2 > snapshotCountMask + 1) {
+    uint32_t count = snapshotCounts ? (snapshotCountMask + 1) * 2 : 1024;
+    snapshotCount_t* counts = calloc(count, sizeof(snapshotCount_t));
+    uint32_t i;
+    if (!counts) {
+      fprintf(stderr, "error: unable to allocate path snapshot.\n");
+      exit(1);
+    }
+    for (i = 0; snapshotCounts && i <= snapshotCountMask; i++)
+      if (snapshotCounts[i].key)
+        counts[snapshotCountSlot(snapshotCounts[i].key, counts, count - 1)] =
+          snapshotCounts[i];
+    free(snapshotCounts);
+    snapshotCounts = counts;
+    snapshotCountMask = count - 1;
+  }
+
+  index = snapshotCountSlot(key, snapshotCounts, snapshotCountMask);
+  if (!snapshotCounts[index].key) {
+    snapshotCounts[index].key = key;
+    snapshotCountUsed++;
+  }
+  return &snapshotCounts[index].count;
+}
+
+/* Keep the entries which changed since the previous snapshot, with the
+   difference as their count */
+static void snapshotDelta(uint32_t functionNumber) {
+  uint32_t i, kept = 0;
+  for (i = 0; i < snapshotEntryCount; i++) {
+    PathProfileTableEntry64 entry = snapshotEntries[i];
+    uint64_t* previous = previousCount(functionNumber, entry.pathNumber);
+    if (entry.pathCounter <= *previous) continue;
+    snapshotEntries[kept].pathNumber = entry.pathNumber;
+    snapshotEntries[kept].pathCounter = entry.pathCounter - *previous;
+    *previous = entry.pathCounter;
+    kept++;
+  }
+  snapshotEntryCount = kept;
+}
+
+/* Write the path counts of the running program, in the format of
+   pathProfAtExitHandler, without flushing the caches or freeing the tables */
+static void pathProfSnapshot(int delta) {
+  ProfilingBuffer out = { 0, 0, 0 };
+  uint32_t header[2] = { PathInfo64, 0 };
+  uint32_t i, j;
+
+  profiling_buffer_append(&out, header, sizeof(header));
+  for( i = 0; i < ftSize; i++ ) {
+    PathProfileHeader fHeader;
+    snapshotEntryCount = 0;
+
+    if( ft[i].type == ProfilingArray ) {
+      uint64_t* array = ft[i].array;
+      for( j = 0; j < ft[i].size; j++ )
+        if( array[j] )
+          snapshotEntry(j, array[j]);
+    } else if( ft[i].type == ProfilingHash ) {
+      pathHashTable_t* table = ft[i].array;
+      if( table )
+        snapshotHashTable(table);
+    } else if( ft[i].type == ProfilingCachedHash ) {
+      pathCache_t* cache = ft[i].array;
+      pathHashTable_t* table = cache->table;
+      if( table )
+        snapshotHashTable(table);
+      snapshotCache(cache);
+    }
+
+    if( delta )
+      snapshotDelta(i+1);
+    if( snapshotEntryCount == 0 )
+      continue;
+
+    fHeader.fnNumber = i+1;
+    fHeader.numEntries = snapshotEntryCount;
+    profiling_buffer_append(&out, &fHeader, sizeof(PathProfileHeader));
+    profiling_buffer_append(&out, snapshotEntries,
+                            snapshotEntryCount * sizeof(PathProfileTableEntry64));
+    /* the function count is patched in memory, the packet isn't written yet */
+    ((uint32_t*)out.Data)[1]++;
+  }
+
+  profiling_buffer_flush(&out);
+  profiling_buffer_free(&out);
+}
+
 /*
  * Writes out a path profile given a function table, in the following format.
+ * The packet type is PathInfo64, every entry is a PathProfileTableEntry64.
  *
  *
  *      | <-- 32 bits --> |
@@ -202,68 +510,115 @@ void llvm_decrement_path_count (uint32_t functionNumber, uint32_t pathNumber) {
  *      +-----------------+-----------------+
  * 0x08 | functionNum     | profileEntries  |  // function 1
  *      +-----------------+-----------------+
- * 0x10 | pathNumber      | pathCounter     |  // entry 1.1
+ * 0x10 | pathNumber      | reserved        |  // entry 1.1
+ *      +-----------------+-----------------+
+ * 0x18 | pathCounter (64 bits)             |
+ *      +-----------------+-----------------+
+ * 0x20 | pathNumber      | reserved        |  // entry 1.2
  *      +-----------------+-----------------+
- * 0x18 | pathNumber      | pathCounter     |  // entry 1.2
+ * 0x28 | pathCounter (64 bits)             |
  *      +-----------------+-----------------+
  *  ... |       ...       |       ...       |  // entry 1.n
  *      +-----------------+-----------------+
  *  ... | functionNum     | profileEntries  |  // function 2
  *      +-----------------+-----------------+
- *  ... | pathNumber      | pathCounter     |  // entry 2.1
+ *  ... | pathNumber      | reserved        |  // entry 2.1
  *      +-----------------+-----------------+
- *  ... | pathNumber      | pathCounter     |  // entry 2.2
+ *  ... | pathCounter (64 bits)             |
  *      +-----------------+-----------------+
  *  ... |       ...       |       ...       |  // entry 2.n
  *      +-----------------+-----------------+
  *
  */
 static void pathProfAtExitHandler(void) {
-  int outFile = getOutFile();
+  ProfilingBuffer out = { 0, 0, 0 };
   uint32_t i;
-  uint32_t header[2] = { PathInfo, 0 };
-  uint32_t headerLocation;
-  uint32_t currentLocation;
+  uint32_t header[2] = { PathInfo64, 0 };
 
-  /* skip over the header for now */
-  headerLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, 2*sizeof(uint32_t), SEEK_CUR);
+  stop_snapshots();
+
+  /* Count the functions which will be written, so the whole packet is
+     built in order and appended at once */
+  for( i = 0; i < ftSize; i++ ) {
+    if( ft[i].type == ProfilingArray ) {
+      if( countArrayTable(&ft[i]) )
+        header[1]++;
+    } else if( ft[i].type == ProfilingHash ) {
+      if( ft[i].array )
+        header[1]++;
+    } else if( ft[i].type == ProfilingCachedHash ) {
+      pathCache_t* cache = ft[i].array;
+      uint32_t slot;
+      for( slot = 0; slot < cache->numSlots; slot++ )
+        flushCacheSlot(cache, &cache->slots[slot]);
+      if( cache->table )
+        header[1]++;
+    }
+  }
+  profiling_buffer_append(&out, header, sizeof(header));
 
   /* Iterate through each function */
   for( i = 0; i < ftSize; i++ ) {
     if( ft[i].type == ProfilingArray ) {
-      writeArrayTable(i+1,&ft[i],header + 1);
+      writeArrayTable(i+1,&ft[i],&out);
 
     } else if( ft[i].type == ProfilingHash ) {
       /* If the hash exists, write it to file */
       if( ft[i].array ) {
-        writeHashTable(i+1,ft[i].array);
-        header[1]++;
-        free(ft[i].array);
+        writeHashTable(i+1,ft[i].array,&out);
+        ft[i].array = 0;
+      }
+    } else if( ft[i].type == ProfilingCachedHash ) {
+      pathCache_t* cache = ft[i].array;
+      if( cache->table ) {
+        writeHashTable(i+1,cache->table,&out);
+        cache->table = 0;
       }
     }
   }
 
-  /* Setup and write the path profile header */
-  currentLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, headerLocation, SEEK_SET);
+  arenaFree();
+  profiling_buffer_flush(&out);
+  profiling_buffer_free(&out);
+}
 
-  if (write(outFile, header, sizeof(header)) < 0) {
-    fprintf(stderr,
-            "error: unable to write path profile header to output file.\n");
-    return;
+/* A forked child counts its own paths from zero.  The parent's tables are
+   dropped, their arena chunks are freed at exit. */
+static void pathProfChild(void) {
+  uint32_t i;
+  for( i = 0; i < ftSize; i++ ) {
+    if( ft[i].type == ProfilingArray ) {
+      memset(ft[i].array, 0, ft[i].size * sizeof(uint64_t));
+    } else if( ft[i].type == ProfilingHash ) {
+      ft[i].array = 0;
+    } else if( ft[i].type == ProfilingCachedHash ) {
+      pathCache_t* cache = ft[i].array;
+      memset(cache->slots, 0, cache->numSlots * sizeof(pathCacheSlot_t));
+      cache->table = 0;
+    }
   }
+}
 
-  lseek(outFile, currentLocation, SEEK_SET);
+static void pathProfStart(void* functionTable, uint64_t numElements) {
+  check_single_start("path", ft);
+  ft = functionTable;
+  ftSize = numElements;
+  pthread_atfork(0, 0, pathProfChild);
+  register_snapshot_writer(pathProfSnapshot);
 }
+
+/* the increments index the function table of one module */
+const struct ProfilingRuntime llvm_path_profiling_runtime = {
+  "path", pathProfStart, pathProfAtExitHandler, 0, 0
+};
+
 /* llvm_start_path_profiling - This is the main entry point of the path
  * profiling library.  It is responsible for setting up the atexit handler.
  */
 int llvm_start_path_profiling(int argc, const char** argv,
                               void* functionTable, uint32_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ft = functionTable;
-  ftSize = numElements;
+  pathProfStart(functionTable, numElements);
   atexit(pathProfAtExitHandler);
 
   return Ret;
@@ -1,19 +1,70 @@
 #include "Profiling.h"
 #include <stdlib.h>
+#include <string.h>
 
 static uint64_t *ArrayStart;
 static uint64_t NumElements;
+static struct CounterShardList Shards = COUNTER_SHARD_LIST_INIT(Shards);
+static __thread uint64_t *ThreadShard;
+static uint64_t *SnapshotCounts;
 
 static void PredBlockProfAtExitHandler(void) {
-  write_profiling_data_long(BlockInfo64, ArrayStart, NumElements);
+  stop_snapshots();
+  merge_counter_shards(&Shards, ArrayStart, NumElements);
+  write_counter_pages(BlockInfo64, ArrayStart, NumElements);
+  write_counter_shards(&Shards, ThreadBlockInfo64, NumElements);
 }
 
+static void PredBlockProfSnapshot(int Delta) {
+  write_counter_snapshot(BlockInfo64, ArrayStart, NumElements, &Shards, Delta,
+                         &SnapshotCounts);
+}
+
+static void PredBlockProfChild(void) {
+  reset_counter_pages(ArrayStart, NumElements);
+  reset_counter_shards(&Shards, NumElements, ThreadShard);
+}
+
+uint64_t* llvm_pred_block_profiling_shard(uint64_t* arrayStart,
+                                          uint64_t numElements)
+{
+  /* only the first module gets shards */
+  if (arrayStart != ArrayStart) return arrayStart;
+  if (!ThreadShard)
+    ThreadShard = acquire_counter_shard(&Shards, numElements);
+  return ThreadShard;
+}
+
+static void PredBlockProfStart(void* arrayStart, uint64_t numElements)
+{
+  check_single_start("pred block", ArrayStart);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  pthread_atfork(0, 0, PredBlockProfChild);
+  register_snapshot_writer(PredBlockProfSnapshot);
+  share_counters(BlockInfo64, ArrayStart, NumElements, &Shards);
+}
+
+static void PredBlockProfResetCounters(void* Counters, uint64_t N)
+{
+  reset_counter_pages(Counters, N);
+}
+
+static void PredBlockProfWriteCounters(void* Counters, uint64_t N)
+{
+  write_counter_pages(BlockInfo64, Counters, N);
+}
+
+const struct ProfilingRuntime llvm_pred_block_profiling_runtime = {
+  "pred block", PredBlockProfStart, PredBlockProfAtExitHandler,
+  PredBlockProfResetCounters, PredBlockProfWriteCounters
+};
+
 int llvm_start_pred_block_profiling(int argc, const char** argv,
                                     uint64_t* arrayStart, uint64_t numElements)
 {
   int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements;
+  PredBlockProfStart(arrayStart, numElements);
   atexit(PredBlockProfAtExitHandler);
   return Ret;
 }
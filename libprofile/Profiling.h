@@ -16,6 +16,8 @@
 #define PROFILING_H
 
 #include "ProfileDataTypes.h" /* for enum ProfilingType */
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* save_arguments - Save argc and argv as passed into the program for the file
@@ -23,17 +25,164 @@
  */
 int save_arguments(int argc, const char **argv);
 
+/* get_saved_arguments - The command line saved by save_arguments, as it is
+ * written to the ArgumentInfo packet.
+ */
+const char *get_saved_arguments(unsigned *Length);
+
 /*
  * Retrieves the file descriptor for the profile file.
  */
 int getOutFile();
 
+/* get_output_filename - The name of the profile file, as getOutFile opens
+ * it.
+ */
+void get_output_filename(char *Name, size_t Size);
+
 /* write_profiling_data - Write out a typed packet of profiling data to the
- * current output file.
+ * current output file.  EdgeInfo64 and BlockInfo64 arrays with few used
+ * counters are written as their sparse packets.
  */
 void write_profiling_data(enum ProfilingType PT, unsigned* Start,
                           unsigned NumElements);
 void write_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
                                uint64_t NumElements);
 
+struct iovec;
+/* write_profiling_iov - Write all of Iov to File, in a single writev unless
+ * it comes back short.  Returns -1 on error.
+ */
+int write_profiling_iov(int File, struct iovec* Iov, int Count);
+/* write_profiling_stream - Append a whole packet to the profile file right
+ * away, also with LLVMPROF_APPEND, for the packets written while the program
+ * runs, which must not pile up in memory.  Returns -1 on error.
+ */
+int write_profiling_stream(struct iovec* Iov, int Count);
+
+/* ProfilingBuffer - A packet assembled in memory, so it reaches the output
+ * file in one append.  Zero initialize it.
+ */
+typedef struct {
+  char* Data;
+  size_t Size;
+  size_t Capacity;
+} ProfilingBuffer;
+/* Packets bigger than this are flushed in pieces of about this size. */
+#define PROFILING_BUFFER_FLUSH (8<<20)
+
+void profiling_buffer_append(ProfilingBuffer* Buffer, const void* Data,
+                             size_t Size);
+/* profiling_buffer_flush - Append the buffer to the output file and empty
+ * it.
+ */
+void profiling_buffer_flush(ProfilingBuffer* Buffer);
+void profiling_buffer_free(ProfilingBuffer* Buffer);
+
+/* capture_profiling_output - Collect the packets the calling thread writes
+ * to the profile file in Buffer, until it is called again with 0, so they
+ * can be flushed in a single append.  A buffer grown past
+ * PROFILING_BUFFER_FLUSH is written early.
+ */
+void capture_profiling_output(ProfilingBuffer* Buffer);
+
+/* CounterShardList - the per-thread copies of one counter array, see
+ * CounterShards.c.
+ */
+struct CounterShardList {
+  pthread_mutex_t Lock;
+  struct CounterShard *Head;
+  struct CounterShard **Tail;
+  unsigned NumShards;
+};
+#define COUNTER_SHARD_LIST_INIT(L) \
+  { PTHREAD_MUTEX_INITIALIZER, 0, &(L).Head, 0 }
+
+/* acquire_counter_shard - Allocate a zeroed, cache line aligned shard of
+ * NumElements counters and link it into List.
+ */
+uint64_t *acquire_counter_shard(struct CounterShardList *List,
+                                uint64_t NumElements);
+/* merge_counter_shards - Add every shard of List into Start. */
+void merge_counter_shards(struct CounterShardList *List, uint64_t *Start,
+                          uint64_t NumElements);
+/* reset_counter_shards - Zero the shard Keep of a forked child's thread and
+ * drop the shards of the threads which were not forked.
+ */
+void reset_counter_shards(struct CounterShardList *List, uint64_t NumElements,
+                          uint64_t *Keep);
+/* write_counter_shards - Write one PT packet per shard, when the
+ * LLVMPROF_THREAD_PACKETS environment variable is set.
+ */
+void write_counter_shards(struct CounterShardList *List, enum ProfilingType PT,
+                          uint64_t NumElements);
+
+/* set_snapshot_file - Write the command line to File and make getOutFile
+ * return it in the calling thread, until it is called again with -1.
+ */
+void set_snapshot_file(int File);
+
+/* SnapshotWriter - Write one runtime's packets to a snapshot, see
+ * Snapshot.c.  With Delta only the counts since the previous snapshot are
+ * written.  The program is still running, so it must not change or free
+ * what the instrumentation uses.
+ */
+typedef void (*SnapshotWriter)(int Delta);
+
+/* register_snapshot_writer - Have Writer called for every snapshot, if the
+ * program runs with LLVMPROF_SNAPSHOT_INTERVAL.  Starts the snapshot thread
+ * on the first call.
+ */
+void register_snapshot_writer(SnapshotWriter Writer);
+/* stop_snapshots - Wait for a running snapshot and stop taking them.  Every
+ * exit handler which has a SnapshotWriter calls it first.
+ */
+void stop_snapshots(void);
+/* share_counters - Mirror a 64 bit counter array and its shards into the
+ * shared memory object named by LLVMPROF_SHM, see SharedCounters.c.
+ */
+void share_counters(enum ProfilingType PT, uint64_t *Start,
+                    uint64_t NumElements, struct CounterShardList *Shards);
+
+/* write_counter_snapshot - The SnapshotWriter of a 64 bit counter array and
+ * its shards.  *Previous keeps the counts of the previous delta snapshot.
+ */
+void write_counter_snapshot(enum ProfilingType PT, uint64_t *Start,
+                            uint64_t NumElements,
+                            struct CounterShardList *Shards, int Delta,
+                            uint64_t **Previous);
+
+/* write_counter_pages - Write a 64 bit counter array as a PT packet, or as
+ * a PagedInfo64 without its zero pages if -profile-counters-mmap mapped it
+ * lazily, see LazyCounters.c.
+ */
+void write_counter_pages(enum ProfilingType PT, uint64_t *Start,
+                         uint64_t NumElements);
+/* reset_counter_pages - Zero a counter array, the lazy pages are dropped
+ * rather than written.
+ */
+void reset_counter_pages(uint64_t *Start, uint64_t NumElements);
+
+/* ProfilingRuntime - How the counter registry, see CounterRegistry.c,
+ * starts a runtime on its counters and writes its packets at exit.  Every
+ * runtime exports one as llvm_<name>_runtime next to llvm_start_<name>.
+ * The counters of every further module are prepared, zeroed in a forked
+ * child and written with ResetCounters and WriteCounters, which are 0 if
+ * the instrumentation can only use the counters of one module.
+ */
+struct ProfilingRuntime {
+  const char *Name;
+  void (*Start)(void *Counters, uint64_t NumElements);
+  void (*Write)(void);
+  void (*ResetCounters)(void *Counters, uint64_t NumElements);
+  void (*WriteCounters)(void *Counters, uint64_t NumElements);
+};
+
+/* check_single_start - Stop the program when the runtime Name is started
+ * again while Counters, the counters of its first start, are set.  A second
+ * module calling llvm_start_* would take over the counters of the first one,
+ * only -profile-counter-registry starts a runtime for several modules.
+ */
+void check_single_start(const char *Name, const void *Counters);
+
 #endif
@@ -0,0 +1,192 @@
+/*===-- SharedCounters.c - Live counters in shared memory ------------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the mirror of the edge and pred block counters in a
+|* POSIX shared memory object, so ``llvm-prof -attach`` can print them while
+|* the program runs.  When LLVMPROF_SHM names the object a thread copies the
+|* counters into it every LLVMPROF_SHM_INTERVAL milliseconds (100 by
+|* default).  The instrumented code keeps incrementing its own arrays, it is
+|* never paused and never waits for a reader.  The object is removed when
+|* the program exits, the profile file has the final counts.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  enum ProfilingType PT;
+  uint64_t *Start;
+  uint64_t NumElements;
+  struct CounterShardList *Shards;
+} SharedArray;
+
+static SharedArray Arrays[PROFILE_SHM_MAX_PACKETS];
+static unsigned NumArrays;
+static pthread_mutex_t ArraysLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int Enabled = -1;       /* not configured yet */
+static char Name[256];
+static int SharedFile = -1;
+static ProfileShmHeader *Header;
+static size_t Mapped;          /* bytes mapped at Header */
+static unsigned Interval = 100;
+static volatile int Stopping;
+static pthread_t Thread;
+
+/* Grow the object to Size bytes of packets.  It never shrinks, a reader
+ * which mapped the old size must not fault.
+ */
+static int map_shared(size_t Size) {
+  size_t Bytes = sizeof(ProfileShmHeader) + Size;
+  void *Mem;
+  if (Bytes <= Mapped) return 0;
+  if (ftruncate(SharedFile, Bytes)) {
+    perror("LLVM profiling runtime: unable to grow shared counters");
+    return -1;
+  }
+  Mem = mmap(0, Bytes, PROT_READ | PROT_WRITE, MAP_SHARED, SharedFile, 0);
+  if (Mem == MAP_FAILED) {
+    perror("LLVM profiling runtime: unable to map shared counters");
+    return -1;
+  }
+  if (Header) munmap(Header, Mapped);
+  Header = Mem;
+  Mapped = Bytes;
+  return 0;
+}
+
+static void append_shared(char **Out, const void *Data, size_t Size) {
+  memcpy(*Out, Data, Size);
+  *Out += Size;
+}
+
+/* Copy the arguments and every registered array into the object, as
+ * ArgumentInfo and counter packets.
+ */
+static void update_shared(void) {
+  unsigned ArgsLength, i;
+  const char *Args = get_saved_arguments(&ArgsLength);
+  size_t Size = 8 + ((ArgsLength + 3) & ~3u);
+  char *Packets, *Out;
+  int PTy = ArgumentInfo, Zeros = 0;
+
+  pthread_mutex_lock(&ArraysLock);
+  for (i = 0; i < NumArrays; ++i)
+    Size += 4 + 8 + Arrays[i].NumElements * sizeof(uint64_t);
+  if (map_shared(Size)) {
+    pthread_mutex_unlock(&ArraysLock);
+    return;
+  }
+
+  Header->generation++;
+  __sync_synchronize();
+
+  Packets = Out = (char *)(Header + 1);
+  append_shared(&Out, &PTy, sizeof(int));
+  append_shared(&Out, &ArgsLength, sizeof(unsigned));
+  append_shared(&Out, Args, ArgsLength);
+  append_shared(&Out, &Zeros, (4 - (ArgsLength & 3)) & 3);
+  for (i = 0; i < NumArrays; ++i) {
+    SharedArray *A = &Arrays[i];
+    ProfileShmPacket *P = &Header->packets[i];
+    uint64_t *Counters;
+    PTy = A->PT;
+    P->type = A->PT;
+    P->offset = Out - Packets;
+    P->numElements = A->NumElements;
+    append_shared(&Out, &PTy, sizeof(int));
+    append_shared(&Out, &A->NumElements, sizeof(uint64_t));
+    Counters = (uint64_t *)Out;
+    append_shared(&Out, A->Start, A->NumElements * sizeof(uint64_t));
+    if (A->Shards) merge_counter_shards(A->Shards, Counters, A->NumElements);
+  }
+  Header->magic = PROFILE_SHM_MAGIC;
+  Header->numPackets = NumArrays;
+  Header->size = Size;
+
+  __sync_synchronize();
+  Header->generation++;
+  pthread_mutex_unlock(&ArraysLock);
+}
+
+static void *shared_thread(void *Arg) {
+  struct timespec Sleep;
+  Sleep.tv_sec = Interval / 1000;
+  Sleep.tv_nsec = (Interval % 1000) * 1000000L;
+  while (!Stopping) {
+    update_shared();
+    nanosleep(&Sleep, 0);
+  }
+  return 0;
+}
+
+/* the profile file has the final counts, readers which still map the
+ * object keep the last copy */
+static void SharedCountersAtExitHandler(void) {
+  if (!Enabled) return; /* in a forked child, the object is the parent's */
+  Stopping = 1;
+  pthread_join(Thread, 0);
+  shm_unlink(Name);
+}
+
+/* the forked child counts on its own, without a mirror */
+static void shared_child(void) {
+  Enabled = 0;
+  NumArrays = 0;
+}
+
+static int start_sharing(void) {
+  const char *Env = getenv("LLVMPROF_SHM");
+  if (!Env) return 0;
+  /* shm_open wants a single leading slash */
+  snprintf(Name, sizeof(Name), "%s%s", Env[0] == '/' ? "" : "/", Env);
+  if ((Env = getenv("LLVMPROF_SHM_INTERVAL")) != NULL && atoi(Env) > 0)
+    Interval = atoi(Env);
+
+  SharedFile = shm_open(Name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (SharedFile == -1) {
+    fprintf(stderr, "LLVM profiling runtime: while opening shared memory "
+            "'%s': ", Name);
+    perror("");
+    return 0;
+  }
+  if (map_shared(0)) return 0;
+  if (pthread_create(&Thread, 0, shared_thread, 0)) {
+    fprintf(stderr, "LLVM profiling runtime: unable to start the shared "
+            "counters thread.\n");
+    shm_unlink(Name);
+    return 0;
+  }
+  pthread_atfork(0, 0, shared_child);
+  atexit(SharedCountersAtExitHandler);
+  return 1;
+}
+
+void share_counters(enum ProfilingType PT, uint64_t *Start,
+                    uint64_t NumElements, struct CounterShardList *Shards) {
+  pthread_mutex_lock(&ArraysLock);
+  if (Enabled == -1) Enabled = start_sharing();
+  if (Enabled && NumArrays < PROFILE_SHM_MAX_PACKETS) {
+    SharedArray *A = &Arrays[NumArrays++];
+    A->PT = PT;
+    A->Start = Start;
+    A->NumElements = NumElements;
+    A->Shards = Shards;
+  }
+  pthread_mutex_unlock(&ArraysLock);
+}
@@ -0,0 +1,216 @@
+/*===-- Snapshot.c - Profiles of programs which are still running ----------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the snapshots taken while the program runs, so
+|* daemons which are killed or never exit still leave a profile.  When
+|* LLVMPROF_SNAPSHOT_INTERVAL is set a thread wakes up every that many
+|* seconds (never for 0) and on SIGUSR1, and asks every runtime to write its
+|* counters to the next file of a rotation.  The counters are read while the
+|* program keeps changing them, so a snapshot may miss the increments made
+|* while it is taken.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* edge, pred block, path and value profiling */
+#define MAX_SNAPSHOT_WRITERS 8
+
+static SnapshotWriter Writers[MAX_SNAPSHOT_WRITERS];
+static unsigned NumWriters;
+static pthread_mutex_t WritersLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int Enabled = -1;       /* not configured yet */
+static int Running;
+static volatile int Stopping;
+static pthread_t Thread;
+static sem_t Wakeup;
+
+static unsigned Interval;      /* LLVMPROF_SNAPSHOT_INTERVAL, in seconds */
+static int Delta;              /* LLVMPROF_SNAPSHOT_MODE=delta */
+static unsigned Keep = 4;      /* LLVMPROF_SNAPSHOT_KEEP */
+static uint64_t Sequence;
+
+/* sem_post is async signal safe, the thread does the work */
+static void snapshot_signal(int Signal) {
+  int Errno = errno;
+  sem_post(&Wakeup);
+  errno = Errno;
+}
+
+/* Write every runtime's packets to <profile file>.snap<N>.  The file is
+ * written under a temporary name and renamed, so a reader only ever sees
+ * complete snapshots.
+ */
+static void take_snapshot(void) {
+  char Base[1024], Name[1040], Temp[1048];
+  SnapshotHeader Header;
+  int PTy = SnapshotInfo;
+  struct iovec Packet[2] = {
+    { &PTy, sizeof(int) },
+    { &Header, sizeof(Header) }
+  };
+  unsigned i;
+  int File;
+
+  get_output_filename(Base, sizeof(Base));
+  snprintf(Name, sizeof(Name), "%s.snap%u", Base,
+           (unsigned)(Sequence % Keep));
+  snprintf(Temp, sizeof(Temp), "%s.tmp", Name);
+  File = open(Temp, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if (File == -1) {
+    fprintf(stderr, "LLVM profiling runtime: while opening '%s': ", Temp);
+    perror("");
+    return;
+  }
+
+  memset(&Header, 0, sizeof(Header));
+  Header.flags = Delta ? SNAPSHOT_DELTA : 0;
+  Header.sequence = ++Sequence;
+  Header.time = time(NULL);
+  set_snapshot_file(File);
+  if (write_profiling_iov(File, Packet, 2) < 0) {
+    fprintf(stderr, "error: unable to write to snapshot file.");
+    exit(0);
+  }
+  pthread_mutex_lock(&WritersLock);
+  for (i = 0; i < NumWriters; ++i)
+    Writers[i](Delta);
+  pthread_mutex_unlock(&WritersLock);
+  set_snapshot_file(-1);
+
+  close(File);
+  if (rename(Temp, Name))
+    perror("LLVM profiling runtime: unable to rename snapshot");
+}
+
+static void *snapshot_thread(void *Arg) {
+  struct timespec Next;
+  clock_gettime(CLOCK_REALTIME, &Next);
+  Next.tv_sec += Interval;
+
+  while (!Stopping) {
+    int Ret = Interval ? sem_timedwait(&Wakeup, &Next) : sem_wait(&Wakeup);
+    if (Ret == -1 && errno == EINTR) continue;
+    if (Stopping) break;
+    if (Ret == -1) {
+      /* timed out, don't try to catch up after a slow snapshot */
+      struct timespec Now;
+      clock_gettime(CLOCK_REALTIME, &Now);
+      Next.tv_sec += Interval;
+      if (Next.tv_sec <= Now.tv_sec) Next.tv_sec = Now.tv_sec + Interval;
+    }
+    take_snapshot();
+  }
+  return 0;
+}
+
+/* the thread isn't forked, neither are its snapshots */
+static void snapshot_child(void) {
+  Running = 0;
+}
+
+/* Read the environment, install the SIGUSR1 handler and start the thread.
+ * Returns whether snapshots are taken.
+ */
+static int start_snapshots(void) {
+  const char *Env = getenv("LLVMPROF_SNAPSHOT_INTERVAL");
+  struct sigaction Action, Old;
+
+  if (!Env) return 0;
+  Interval = strtoul(Env, 0, 10);
+  if ((Env = getenv("LLVMPROF_SNAPSHOT_MODE")) != NULL) {
+    if (!strcmp(Env, "delta"))
+      Delta = 1;
+    else if (strcmp(Env, "cumulative"))
+      fprintf(stderr, "LLVM profiling runtime: unknown snapshot mode '%s', "
+              "using cumulative.\n", Env);
+  }
+  if ((Env = getenv("LLVMPROF_SNAPSHOT_KEEP")) != NULL && atoi(Env) > 0)
+    Keep = atoi(Env);
+
+  sem_init(&Wakeup, 0, 0);
+  /* leave a handler of the program alone */
+  sigaction(SIGUSR1, 0, &Old);
+  if (Old.sa_handler == SIG_DFL) {
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = snapshot_signal;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGUSR1, &Action, 0);
+  } else if (Interval == 0) {
+    fprintf(stderr, "LLVM profiling runtime: SIGUSR1 is handled by the "
+            "program, no snapshots will be taken.\n");
+    return 0;
+  }
+
+  if (pthread_create(&Thread, 0, snapshot_thread, 0)) {
+    fprintf(stderr, "LLVM profiling runtime: unable to start the snapshot "
+            "thread.\n");
+    return 0;
+  }
+  pthread_atfork(0, 0, snapshot_child);
+  Running = 1;
+  return 1;
+}
+
+void register_snapshot_writer(SnapshotWriter Writer) {
+  pthread_mutex_lock(&WritersLock);
+  if (Enabled == -1) Enabled = start_snapshots();
+  if (Enabled && NumWriters < MAX_SNAPSHOT_WRITERS)
+    Writers[NumWriters++] = Writer;
+  pthread_mutex_unlock(&WritersLock);
+}
+
+void stop_snapshots(void) {
+  /* a failing snapshot exits from the thread itself */
+  if (!Running || pthread_equal(pthread_self(), Thread)) return;
+  Running = 0;
+  Stopping = 1;
+  sem_post(&Wakeup);
+  pthread_join(Thread, 0);
+}
+
+void write_counter_snapshot(enum ProfilingType PT, uint64_t *Start,
+                            uint64_t NumElements,
+                            struct CounterShardList *Shards, int Delta,
+                            uint64_t **Previous) {
+  uint64_t *Counters = malloc(NumElements * sizeof(uint64_t));
+  uint64_t i;
+  if (!Counters) {
+    fprintf(stderr, "error: unable to allocate counter snapshot.\n");
+    return;
+  }
+  memcpy(Counters, Start, NumElements * sizeof(uint64_t));
+  if (Shards) merge_counter_shards(Shards, Counters, NumElements);
+
+  if (Delta) {
+    if (!*Previous) *Previous = calloc(NumElements, sizeof(uint64_t));
+    for (i = 0; i < NumElements; ++i) {
+      /* racing increments may have been lost, counts only go forward */
+      uint64_t Count = Counters[i];
+      Counters[i] = Count > (*Previous)[i] ? Count - (*Previous)[i] : 0;
+      if (Count > (*Previous)[i]) (*Previous)[i] = Count;
+    }
+  }
+  write_profiling_data_long(PT, Counters, NumElements);
+  free(Counters);
+}
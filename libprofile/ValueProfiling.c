@@ -1,72 +1,457 @@
 #include "Profiling.h"
+#include "ProfileInfoTypes.h"
 #include <sys/queue.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 
 #define malloc0(sz) memset(malloc(sz),0,sz)
+/* a site's first trunk holds trunk_size values, every following trunk
+ * doubles until max_trunk_size, so hot sites need few trunks. both even,
+ * RUN_LENGTH_COMPRESS writes pairs */
 #define trunk_size 100
+#define max_trunk_size (1<<16)
+/* trunks are carved from mmap'd slabs, which are zero filled and only
+ * resident once they are written */
+#define slab_size (1<<24)
+/* LLVMPROF_VALUE_BUDGET below this would spill on almost every trunk */
+#define min_budget (1<<20)
 
-static unsigned *ArrayStart;
-static unsigned NumElements;
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
 //record true write value content count.
 
 typedef struct ValueItem{
 	SLIST_ENTRY(ValueItem) next;
-	int value[trunk_size];
+	int size;
+	int value[];
 }ValueItem;
 typedef SLIST_HEAD(ValueEntry,ValueItem) ValueEntry;
 
+/* a run of values of one site which was spilled to SpillFile */
+typedef struct ValueSegment{
+	struct ValueSegment* next;
+	off_t offset;
+	size_t count;
+}ValueSegment;
+
 typedef struct ValueHead{
 	unsigned count;//real write bits length
 	enum ProfilingFlags flags; //should only use under 32bit
 	int pos; //current write position in first trunk
 	ValueEntry entry;
+	ValueSegment* spilled, *lastSpilled; //oldest first, written before entry
+	unsigned snapCount; //values written by the previous delta snapshot
+	int snapRun; //and the count of their last run
 }ValueHead;
 
 static ValueHead* ValueLink = NULL;
+/* taken to add a trunk or spill, so a snapshot can walk a site's values */
+static pthread_mutex_t ValueLock = PTHREAD_MUTEX_INITIALIZER;
 
-void ValueProfAtExitHandler(void)
+typedef struct ValueSlab{
+	struct ValueSlab* next;
+	size_t size;
+}ValueSlab;
+
+static ValueSlab* FirstSlab = NULL, *CurSlab = NULL;
+static char* SlabCur = NULL;
+static size_t SlabLeft = 0;
+
+/* With LLVMPROF_VALUE_BUDGET, once the trunks take more than Budget bytes
+ * every site's values are appended to SpillFile and the slabs are reused.
+ * the exit handler stitches the segments in front of the trunks. */
+static size_t Budget = 0;
+static size_t Used = 0;
+static int SpillFile = -1;
+static off_t SpillEnd = 0;
+
+/* reverse a site's newest first trunk list, so it starts with the oldest */
+static void reverse_trunks(ValueEntry* entry)
 {
-#define EXIT_ON_ERROR {\
-	fprintf(stderr,"error: unable to write to output file.");\
-	exit(0); }
+	ValueItem* item = SLIST_FIRST(entry), *prev = NULL, *next;
+	while(item){
+		next = SLIST_NEXT(item, next);
+		SLIST_NEXT(item, next) = prev;
+		prev = item;
+		item = next;
+	}
+	SLIST_FIRST(entry) = prev;
+}
+
+static void spill_values(void)
+{
+	unsigned i;
+	if(SpillFile == -1){
+		FILE* F = tmpfile();
+		if(F == NULL){
+			perror("error: unable to create value profiling spill file");
+			exit(0);
+		}
+		SpillFile = fileno(F);
+	}
+	for(i=0;i<NumElements;i++){
+		ValueEntry* entry = &ValueLink[i].entry;
+		ValueItem* item;
+		ValueSegment* seg;
+		if(SLIST_EMPTY(entry)) continue;
+		seg = malloc0(sizeof(ValueSegment));
+		seg->offset = SpillEnd;
+		reverse_trunks(entry);
+		SLIST_FOREACH(item, entry, next){
+			size_t size = SLIST_NEXT(item, next) ? item->size : ValueLink[i].pos;
+			if(write(SpillFile,item->value,sizeof(int)*size)<0){
+				perror("error: unable to write value profiling spill file");
+				exit(0);
+			}
+			seg->count += size;
+		}
+		SpillEnd += seg->count*sizeof(int);
+		if(ValueLink[i].lastSpilled) ValueLink[i].lastSpilled->next = seg;
+		else ValueLink[i].spilled = seg;
+		ValueLink[i].lastSpilled = seg;
+		SLIST_INIT(entry);
+		ValueLink[i].pos = 0;
+	}
+	/* start over in the first slab */
+	CurSlab = FirstSlab;
+	SlabCur = (char*)(CurSlab+1);
+	SlabLeft = CurSlab->size - sizeof(ValueSlab);
+	Used = 0;
+}
+
+static ValueItem* alloc_trunk(int size)
+{
+	size_t len = sizeof(ValueItem)+sizeof(int)*size;
+	ValueItem* item;
+	len = (len+15)&~(size_t)15;
+	if(Budget && Used && Used+len > Budget)
+		spill_values();
+	if(len > SlabLeft){
+		if(CurSlab && CurSlab->next && CurSlab->next->size-sizeof(ValueSlab) >= len)
+			CurSlab = CurSlab->next; // reused after a spill
+		else{
+			size_t slab = len+sizeof(ValueSlab) > slab_size ?
+				len+sizeof(ValueSlab) : slab_size;
+			ValueSlab* mem = mmap(NULL, slab, PROT_READ|PROT_WRITE,
+					MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if(mem == MAP_FAILED){
+				fprintf(stderr,"error: unable to allocate value profiling trunk.");
+				exit(0);
+			}
+			mem->size = slab;
+			if(CurSlab){
+				mem->next = CurSlab->next;
+				CurSlab->next = mem;
+			}else
+				FirstSlab = mem;
+			CurSlab = mem;
+		}
+		/* the rest of the previous slab is abandoned */
+		SlabCur = (char*)(CurSlab+1);
+		SlabLeft = CurSlab->size - sizeof(ValueSlab);
+	}
+	item = (ValueItem*)SlabCur;
+	SlabCur += len;
+	SlabLeft -= len;
+	Used += len;
+	item->size = size;
+	return item;
+}
+
+/* With LLVMPROF_VALUE_TOPK=K each site only keeps the K most frequent values
+ * in a Space-Saving table: a miss on a full table replaces the least
+ * frequent entry, which hands its count down as the new value's error.
+ * Memory stays bounded no matter how long the program runs.  A hit swaps
+ * the entry with the one in front of it, so the frequent values of a site
+ * move to the front of the table and are found after a probe or two.
+ */
+#define MAX_TOPK 1024
+typedef struct ValueSummary{
+	uint64_t others; //observations that missed a full table
+	unsigned used;
+	ValueSummaryEntry entries[];
+}ValueSummary;
+
+static unsigned TopK = 0;
+static char* Summaries = NULL;
+static size_t SummarySize;
+#define SUMMARY(idx) ((ValueSummary*)(Summaries+(size_t)(idx)*SummarySize))
+
+static void summarize_value(ValueSummary* S, int value)
+{
+	unsigned i, min = 0;
+	for(i=0;i<S->used;++i){
+		if(S->entries[i].value == value){
+			++S->entries[i].count;
+			if(i > 0){
+				ValueSummaryEntry E = S->entries[i];
+				S->entries[i] = S->entries[i-1];
+				S->entries[i-1] = E;
+			}
+			return;
+		}
+	}
+	if(S->used < TopK){
+		ValueSummaryEntry* E = &S->entries[S->used++];
+		E->value = value;
+		E->count = 1;
+		E->error = 0;
+		return;
+	}
+	for(i=1;i<S->used;++i)
+		if(S->entries[i].count < S->entries[min].count) min = i;
+	++S->others;
+	S->entries[min].value = value;
+	S->entries[min].error = S->entries[min].count;
+	++S->entries[min].count;
+}
+
+static int entry_count_greater(const void* L, const void* R)
+{
+	const ValueSummaryEntry* Lhs = L, *Rhs = R;
+	if(Lhs->count == Rhs->count) return 0;
+	return Lhs->count < Rhs->count ? 1 : -1;
+}
+
+/* append to the packet, which is written in PROFILING_BUFFER_FLUSH pieces */
+static void append_packet(ProfilingBuffer* out, const void* data, size_t size)
+{
+	profiling_buffer_append(out, data, size);
+	if(out->Size >= PROFILING_BUFFER_FLUSH)
+		profiling_buffer_flush(out);
+}
+
+/* the head of a value packet, like write_profiling_data_long */
+static void append_counters(ProfilingBuffer* out, enum ProfilingType PT,
+		const uint64_t* counts)
+{
+	int PTy = PT;
+	append_packet(out, &PTy, sizeof(int));
+	append_packet(out, &NumElements, sizeof(uint64_t));
+	append_packet(out, counts, sizeof(uint64_t)*NumElements);
+}
+
+/* append the values [from,to) of a site, oldest first, without changing
+ * the site: the spilled segments, then the trunks from the last one */
+static void append_values(ProfilingBuffer* out, unsigned site, size_t from,
+		size_t to)
+{
+	static int buffer[1<<16];
+	ValueSegment* seg;
+	ValueItem* item, **trunks = NULL;
+	size_t pos = 0, n = 0, cap = 0;
+	for(seg = ValueLink[site].spilled; seg && pos < to; seg = seg->next){
+		size_t begin = from > pos ? from-pos : 0;
+		size_t end = to-pos < seg->count ? to-pos : seg->count;
+		while(begin < end){
+			size_t len = end-begin < 1<<16 ? end-begin : 1<<16;
+			if(pread(SpillFile,buffer,sizeof(int)*len,
+						seg->offset+sizeof(int)*begin)!=sizeof(int)*len){
+				perror("error: unable to read value profiling spill file");
+				exit(0);
+			}
+			append_packet(out,buffer,sizeof(int)*len);
+			begin += len;
+		}
+		pos += seg->count;
+	}
+	SLIST_FOREACH(item, &ValueLink[site].entry, next){
+		if(n == cap){
+			cap = cap ? cap*2 : 64;
+			trunks = realloc(trunks, sizeof(ValueItem*)*cap);
+		}
+		trunks[n++] = item;
+	}
+	/* only the part below to of the last trunk is filled */
+	while(n > 0 && pos < to){
+		size_t begin, end;
+		item = trunks[--n];
+		begin = from > pos ? from-pos : 0;
+		end = to-pos < (size_t)item->size ? to-pos : (size_t)item->size;
+		if(begin < end)
+			append_packet(out,item->value+begin,sizeof(int)*(end-begin));
+		pos += item->size;
+	}
+	free(trunks);
+}
+
+/* |counts...|K|, then per site |used|flags|others(64bit)|entries...| */
+static void ValueSummaryAtExitHandler(void)
+{
+	ProfilingBuffer out = {0, 0, 0};
+	unsigned i;
+	stop_snapshots();
+	append_counters(&out, ValueSummaryInfo64, ArrayStart);
+	append_packet(&out, &TopK, sizeof(unsigned));
+	for(i=0;i<NumElements;i++){
+		ValueSummary* S = SUMMARY(i);
+		int flags = ValueLink[i].flags;
+		qsort(S->entries, S->used, sizeof(ValueSummaryEntry), entry_count_greater);
+		append_packet(&out, &S->used, sizeof(unsigned));
+		append_packet(&out, &flags, sizeof(int));
+		append_packet(&out, &S->others, sizeof(uint64_t));
+		append_packet(&out, S->entries, sizeof(ValueSummaryEntry)*S->used);
+	}
+	profiling_buffer_flush(&out);
+	profiling_buffer_free(&out);
+}
 
-	int* buffer = NULL;
-	int OutFile = getOutFile();
-	write_profiling_data(ValueInfo, ArrayStart, NumElements);
+void ValueProfAtExitHandler(void)
+{
+	ProfilingBuffer out = {0, 0, 0};
+	stop_snapshots();
+	append_counters(&out, ValueInfo64, ArrayStart);
 	int i=0;
 	for(i=0;i<NumElements;i++){
 		unsigned writeCount = ValueLink[i].count+1;// extra flags size;
 		int flags = ValueLink[i].flags;// on 64bit enum is long type
-		write(OutFile,&writeCount,sizeof(unsigned));
-		write(OutFile,&flags,sizeof(int));
-		size_t len = sizeof(int)*ValueLink[i].count;
-		if(len==0) continue;
-		buffer = malloc0(len);
-		ValueItem* item = NULL;
-		ValueEntry* entry = &ValueLink[i].entry;
-		int* w = buffer+ValueLink[i].count;
-		SLIST_FOREACH(item, entry, next){
-			if(item == SLIST_FIRST(entry)){
-				int size = ValueLink[i].pos;
-				memcpy(w-size,item->value,sizeof(int)*size);
-				w-=size;
-			}else{
-				memcpy(w-trunk_size,item->value,sizeof(int)*trunk_size);
-				w-=trunk_size;
+		append_packet(&out,&writeCount,sizeof(unsigned));
+		append_packet(&out,&flags,sizeof(int));
+		if(ValueLink[i].count==0) continue;
+		append_values(&out,i,0,ValueLink[i].count);
+	}
+	profiling_buffer_flush(&out);
+	profiling_buffer_free(&out);
+}
+
+/* the site counts of the previous delta snapshot, and its top-K tables */
+static uint64_t* SnapshotCounts = NULL;
+static char* SnapshotSummaries = NULL;
+
+/* the head of a snapshot packet, with the counts since the previous delta
+ * snapshot when delta is set */
+static void append_snapshot_counters(ProfilingBuffer* out,
+		enum ProfilingType PT, int delta)
+{
+	uint64_t* counts = malloc(sizeof(uint64_t)*NumElements);
+	unsigned i;
+	memcpy(counts, ArrayStart, sizeof(uint64_t)*NumElements);
+	if(delta){
+		if(!SnapshotCounts) SnapshotCounts = malloc0(sizeof(uint64_t)*NumElements);
+		for(i=0;i<NumElements;i++){
+			uint64_t count = counts[i];
+			counts[i] = count - SnapshotCounts[i];
+			SnapshotCounts[i] = count;
+		}
+	}
+	append_counters(out, PT, counts);
+	free(counts);
+}
+
+#ifdef ENABLE_COMPRESS
+/* the value and count of the run which starts at the at'th value */
+static void read_run(unsigned site, size_t at, int run[2])
+{
+	static ProfilingBuffer pair = {0, 0, 0};
+	pair.Size = 0;
+	append_values(&pair, site, at, at+2);
+	memcpy(run, pair.Data, sizeof(int)*2);
+}
+#endif
+
+/* the values of every site in the format of ValueProfAtExitHandler.  the
+ * last run may still grow, a delta snapshot writes what it has grown by
+ * since the previous one in front of the new values */
+static void ValueProfSnapshot(int delta)
+{
+	ProfilingBuffer out = {0, 0, 0};
+	unsigned i;
+	append_snapshot_counters(&out, ValueInfo64, delta);
+	for(i=0;i<NumElements;i++){
+		ValueHead* head = &ValueLink[i];
+		size_t from = delta ? head->snapCount : 0, count, end;
+		int flags = head->flags;
+		unsigned writeCount;
+		pthread_mutex_lock(&ValueLock);
+		count = head->count;
+		end = count;
+#ifdef ENABLE_COMPRESS
+		int grown[2] = {0, 0}, last[2] = {0, 0};
+		if(from >= 2){
+			read_run(i, from-2, grown);
+			grown[1] -= head->snapRun;
+		}
+		/* the last run is written as it was read, the next delta goes on
+		 * from there */
+		if(count > from){
+			read_run(i, count-2, last);
+			end = count-2;
+		}
+		writeCount = count-from+(grown[1] > 0 ? 2 : 0)+1;
+#else
+		writeCount = count-from+1;
+#endif
+		append_packet(&out,&writeCount,sizeof(unsigned));
+		append_packet(&out,&flags,sizeof(int));
+#ifdef ENABLE_COMPRESS
+		if(grown[1] > 0)
+			append_packet(&out,grown,sizeof(grown));
+#endif
+		append_values(&out,i,from,end);
+#ifdef ENABLE_COMPRESS
+		if(count > from){
+			append_packet(&out,last,sizeof(last));
+			head->snapRun = last[1];
+		}else if(from >= 2)
+			head->snapRun += grown[1] > 0 ? grown[1] : 0;
+#endif
+		head->snapCount = count;
+		pthread_mutex_unlock(&ValueLock);
+	}
+	profiling_buffer_flush(&out);
+	profiling_buffer_free(&out);
+}
+
+/* the top-K tables, in the format of ValueSummaryAtExitHandler.  a delta
+ * table has what each value's count has grown by since the previous
+ * snapshot, a value which was evicted and came back counts in full */
+static void ValueSummarySnapshot(int delta)
+{
+	ProfilingBuffer out = {0, 0, 0};
+	ValueSummary* S = malloc(SummarySize);
+	unsigned i, j, k;
+	append_snapshot_counters(&out, ValueSummaryInfo64, delta);
+	append_packet(&out, &TopK, sizeof(unsigned));
+	if(delta && !SnapshotSummaries)
+		SnapshotSummaries = malloc0(SummarySize*NumElements);
+	for(i=0;i<NumElements;i++){
+		int flags = ValueLink[i].flags;
+		/* the program keeps updating the table, work on a copy */
+		memcpy(S, SUMMARY(i), SummarySize);
+		if(S->used > TopK) S->used = TopK;
+		if(delta){
+			ValueSummary* P = (ValueSummary*)(SnapshotSummaries+(size_t)i*SummarySize);
+			ValueSummary* N = (ValueSummary*)memcpy(malloc(SummarySize), S, SummarySize);
+			unsigned used = 0;
+			for(j=0;j<S->used;j++){
+				ValueSummaryEntry E = S->entries[j];
+				for(k=0;k<P->used;k++){
+					if(P->entries[k].value != E.value) continue;
+					if(E.count >= P->entries[k].count) E.count -= P->entries[k].count;
+					break;
+				}
+				if(E.count) S->entries[used++] = E;
 			}
+			S->used = used;
+			S->others = N->others >= P->others ? N->others-P->others : 0;
+			memcpy(P, N, SummarySize);
+			free(N);
 		}
-		assert(w==buffer);
-		if(write(OutFile,buffer,len)<0)
-			EXIT_ON_ERROR;
-		free(buffer);
+		qsort(S->entries, S->used, sizeof(ValueSummaryEntry), entry_count_greater);
+		append_packet(&out, &S->used, sizeof(unsigned));
+		append_packet(&out, &flags, sizeof(int));
+		append_packet(&out, &S->others, sizeof(uint64_t));
+		append_packet(&out, S->entries, sizeof(ValueSummaryEntry)*S->used);
 	}
-	close(OutFile);
-#undef EXIT_ON_ERROR
+	free(S);
+	profiling_buffer_flush(&out);
+	profiling_buffer_free(&out);
 }
 
 void llvm_profiling_trap_value(int index,int value,int isConstant)
@@ -76,13 +461,21 @@ void llvm_profiling_trap_value(int index,int value,int isConstant)
 		ValueLink[index].flags |= CONSTANT_COMPRESS;
 		return;
 	}
+	if(TopK){
+		summarize_value(SUMMARY(index), value);
+		return;
+	}
 	int* _pos = &ValueLink[index].pos;
 #define pos (*_pos)
 	ValueEntry* entry = &ValueLink[index].entry;
-	if(pos >= trunk_size || SLIST_EMPTY(entry)){
-		ValueItem* ins = malloc0(sizeof(ValueItem));
+	if(SLIST_EMPTY(entry) || pos >= SLIST_FIRST(entry)->size){
+		int size = SLIST_EMPTY(entry) ? trunk_size : SLIST_FIRST(entry)->size*2;
+		/* may spill, which empties every list, this one too */
+		pthread_mutex_lock(&ValueLock);
+		ValueItem* ins = alloc_trunk(size < max_trunk_size ? size : max_trunk_size);
 		SLIST_INSERT_HEAD(entry, ins, next);
 		pos = 0;
+		pthread_mutex_unlock(&ValueLock);
 	}
 	ValueItem* item = SLIST_FIRST(entry);
 #ifdef ENABLE_COMPRESS
@@ -101,18 +494,94 @@ void llvm_profiling_trap_value(int index,int value,int isConstant)
 #undef pos
 }
 
-int llvm_start_value_profiling(int argc, const char **argv,
-                              unsigned *arrayStart, unsigned numElements) {
-  int Ret = save_arguments(argc, argv);
+/* a forked child logs its own values.  the parent's trunks are dropped and
+ * the slabs reused, the spill file's offset is shared with it */
+static void ValueProfChild(void)
+{
+	unsigned i;
+	pthread_mutex_init(&ValueLock, 0);
+	memset(ArrayStart, 0, sizeof(uint64_t)*NumElements);
+	if(TopK){
+		memset(Summaries, 0, SummarySize*NumElements);
+		return;
+	}
+	for(i=0;i<NumElements;i++){
+		ValueHead* head = &ValueLink[i];
+		ValueSegment* seg, *next;
+		for(seg = head->spilled; seg; seg = next){
+			next = seg->next;
+			free(seg);
+		}
+		head->spilled = head->lastSpilled = NULL;
+		SLIST_INIT(&head->entry);
+		head->count = head->pos = 0;
+		head->snapCount = head->snapRun = 0;
+	}
+	if(SpillFile != -1) close(SpillFile);
+	SpillFile = -1;
+	SpillEnd = 0;
+	if(FirstSlab){
+		CurSlab = FirstSlab;
+		SlabCur = (char*)(CurSlab+1);
+		SlabLeft = CurSlab->size - sizeof(ValueSlab);
+	}
+	Used = 0;
+}
+
+/* the TopK summaries or the full logs, whichever were collected */
+static void ValueProfWrite(void)
+{
+	if(TopK)
+		ValueSummaryAtExitHandler();
+	else
+		ValueProfAtExitHandler();
+}
+
+static void ValueProfStart(void *arrayStart, uint64_t numElements) {
+  check_single_start("value", ArrayStart);
   ArrayStart = arrayStart;
   NumElements = numElements;
   ValueLink = malloc0(sizeof(*ValueLink)*NumElements);
+  pthread_atfork(0, 0, ValueProfChild);
+  const char* K = getenv("LLVMPROF_VALUE_TOPK");
+  if(K && atoi(K) > 0){
+	  TopK = atoi(K) < MAX_TOPK ? atoi(K) : MAX_TOPK;
+	  SummarySize = sizeof(ValueSummary)+sizeof(ValueSummaryEntry)*TopK;
+	  Summaries = malloc0(SummarySize*NumElements);
+	  register_snapshot_writer(ValueSummarySnapshot);
+	  return;
+  }
+  const char* B = getenv("LLVMPROF_VALUE_BUDGET");
+  if(B){
+	  char* unit;
+	  Budget = strtoull(B, &unit, 10);
+	  switch(*unit){
+		  case 'g': case 'G': Budget <<= 10;
+		  /* FALL THROUGH */
+		  case 'm': case 'M': Budget <<= 10;
+		  /* FALL THROUGH */
+		  case 'k': case 'K': Budget <<= 10;
+	  }
+	  if(Budget && Budget < min_budget) Budget = min_budget;
+  }
   int i=0;
   for(i=0;i<NumElements;++i){
 #ifdef ENABLE_COMPRESS
 	  ValueLink[i].flags |= RUN_LENGTH_COMPRESS;
 #endif
   }
-  atexit(ValueProfAtExitHandler);
+  register_snapshot_writer(ValueProfSnapshot);
+}
+
+/* the traps index the values of one module */
+const struct ProfilingRuntime llvm_value_profiling_runtime = {
+  "value", ValueProfStart, ValueProfWrite, 0, 0
+};
+
+int llvm_start_value_profiling(int argc, const char **argv,
+                              uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  ValueProfStart(arrayStart, numElements);
+  atexit(ValueProfWrite);
   return Ret;
 }
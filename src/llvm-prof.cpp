@@ -59,6 +59,10 @@ namespace {
 
   cl::opt<bool> DiffMode("diff",cl::desc("Compare two out file"));
 
+  cl::opt<std::string> Attach("attach", cl::value_desc("name"),
+        cl::desc("Print the live counters of a program running with "
+                 "LLVMPROF_SHM=<name>, instead of a profile file"));
+
   static void printHelpStr(StringRef HelpStr, size_t Indent,
         size_t FirstLineIndentedBy) {
      std::pair<StringRef, StringRef> Split = HelpStr.split('\n');
@@ -141,6 +145,8 @@ int main(int argc, char **argv) {
   llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
   
   cl::ParseCommandLineOptions(argc, argv, "llvm profile dump decoder\n");
+  if (!Attach.empty())
+     ProfileDataFile = "shm:" + Attach;
 
   // Read in the bitcode file...
   std::string ErrorMessage;
@@ -228,7 +234,7 @@ int main(int argc, char **argv) {
      // using the standard profile info provider pass, but for now this gives us
      // access to additional information not exposed via the ProfileInfo
      // interface.
-     ProfileInfoLoader PIL(argv[0], ProfileDataFile);
+     ProfileInfoLoader PIL(argv[0], ProfileDataFile, getProfileModuleHash(*M));
      PassMgr.add(new ProfileInfoPrinterPass(PIL));
   }
   PassMgr.run(*M);
@@ -1,4 +1,5 @@
 #include "passes.h"
+#include <FunctionFilter.h>
 #include <ProfileInfo.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/CommandLine.h>
@@ -28,15 +29,15 @@ bool ProfileInfoConverter::runOnModule(Module &M)
 {
    ProfileInfo& PI = getAnalysis<ProfileInfo>();
 
-   std::vector<unsigned> Counters;
+   std::vector<uint64_t> Counters;
    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-      if (F->isDeclaration()) continue;
+      if (!isProfiledFunction(*F)) continue;
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB){
          Counters.push_back(PI.getExecutionCount(BB));
       }
    }
 
-   Writer.write(BlockInfo, Counters);
+   Writer.write(BlockInfo64, Counters);
 
    return false;
 }
@@ -29,6 +29,8 @@ namespace llvm{
       void printValueContent();
       void printSLGCounts();
       void printMPICounts(ProfilingType Info);
+      void printThreadCounts(const char* What,
+            const std::vector<std::vector<uint64_t> >& Threads);
       virtual const char* getPassName() const {
          return "Print Profile Info";
       }
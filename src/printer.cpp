@@ -1,4 +1,5 @@
 #include "passes.h"
+#include <FunctionFilter.h>
 #include <ProfileInfo.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -6,6 +7,7 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FormattedStream.h>
+#include <ctime>
 
 #if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
 #include <llvm/Assembly/AssemblyAnnotationWriter.h>
@@ -63,6 +65,18 @@ void ProfileInfoPrinterPass::printValueContent()
 		if(isa<Constant>(traped))outs()<<"Constant";
 		else outs()<<"Variable";
 		outs()<<"("<<(unsigned)PI.getExecutionCount(CI)<<"):\t";
+		uint64_t Others;
+		const std::vector<ValueSummaryEntry>& TopK = PI.getValueTopK(CI, &Others);
+		if(!TopK.empty()){
+			// value x count, and the upper bound of overcounting
+			for(unsigned i=0;i<TopK.size();++i){
+				outs()<<TopK[i].value<<" x "<<TopK[i].count;
+				if(TopK[i].error) outs()<<"(-"<<TopK[i].error<<")";
+				outs()<<",";
+			}
+			outs()<<"<others "<<Others<<">\n";
+			continue;
+		}
 		std::vector<int>::iterator II = Contents.begin(),EE=Contents.end(),BND;
 		while(II!=EE){
 			BND = std::upper_bound(II, EE, *II);
@@ -92,6 +106,18 @@ void ProfileInfoPrinterPass::printExecutionCommands()
 		if (e != 1) outs() << i+1 << ". ";
 		outs() << PIL.getExecution(i) << "\n";
 	}
+	const std::vector<SnapshotHeader>& Snapshots = PIL.getSnapshots();
+	for (unsigned i = 0, e = Snapshots.size(); i != e; ++i) {
+		time_t Time = Snapshots[i].time;
+		char When[32];
+		strftime(When, sizeof(When), "%Y-%m-%d %H:%M:%S", localtime(&Time));
+		outs() << "  snapshot " << Snapshots[i].sequence << " at " << When
+			<< ((Snapshots[i].flags & SNAPSHOT_DELTA) ? ", counts since the previous one"
+			    : "") << "\n";
+	}
+	if (PIL.getEdgeSampleScale())
+		outs() << "  edge counts sampled, scaled up "
+			<< format("%g", PIL.getEdgeSampleScale()) << " times\n";
 }
 
 void ProfileInfoPrinterPass::printFunctionCounts( 
@@ -265,6 +291,37 @@ void ProfileInfoPrinterPass::printMPICounts(ProfilingType Info)
    }
 }
 
+void ProfileInfoPrinterPass::printThreadCounts(const char* What,
+      const std::vector<std::vector<uint64_t> >& Threads)
+{
+   if(Threads.empty()) return;
+
+   std::vector<double> Totals;
+   double Sum = 0, Max = 0;
+   for(unsigned i=0;i<Threads.size();i++){
+      double Total = 0;
+      for(unsigned j=0;j<Threads[i].size();j++)
+         if(Threads[i][j] != ProfileInfoLoader::Uncounted)
+            Total += Threads[i][j];
+      Totals.push_back(Total);
+      Sum += Total;
+      Max = std::max(Max, Total);
+   }
+   if(Sum == 0) return;
+
+   outs() << "\n===" << std::string(73, '-') << "===\n";
+   outs() << "per thread " << What << " counts:\n\n";
+   outs() <<" ##      %% \tTotal\n";
+   for(unsigned i=0;i<Totals.size();i++)
+      outs() << format("%3d", i+1) << ". "
+         << format("%5g", Totals[i]/Sum*100) << "% "
+         << format("%5.0f", Totals[i]) << "/" << format("%g", Sum) << "\n";
+   // 1 means perfect balance, Threads.size() means a single thread did
+   // all the work
+   outs() << "\n  imbalance (max/mean): "
+      << format("%.3f", Max/(Sum/Totals.size())) << "\n";
+}
+
 namespace {
    class ProfileAnnotator : public AssemblyAnnotationWriter {
       ProfileInfo &PI;
@@ -348,7 +405,7 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 	std::vector<std::pair<Function*, double> > FunctionCounts;
 	std::vector<std::pair<BasicBlock*, double> > Counts;
 	for (Module::iterator FI = M.begin(), FE = M.end(); FI != FE; ++FI) {
-		if (FI->isDeclaration()) continue;
+		if (!isProfiledFunction(*FI)) continue;
 		double w = ignoreMissing(PI.getExecutionCount(FI));
 		FunctionCounts.push_back(std::make_pair(FI, w));
 		for (Function::iterator BB = FI->begin(), BBE = FI->end(); 
@@ -367,6 +424,8 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
    printSLGCounts();
    printMPICounts(MPInfo);
    printMPICounts(MPIFullInfo);
+   printThreadCounts("edge", PIL.getRawThreadEdgeCounts());
+   printThreadCounts("block", PIL.getRawThreadBlockCounts());
 	printAnnotatedCode(FunctionToPrint,M);
 
 	return false;
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+// the BlockMapInfo64 packet of a diamond entry -> a, b -> join with
+// counters on entry and a
+static std::vector<uint64_t> Diamond(uint64_t Entry, uint64_t A)
+{
+   return {
+      4, 5, 2, 11,         // blocks, slots, counters, rule words
+      0, 1,                // the slots of the counters
+      2, 2, 0 << 1, 1 << 1 | 1, // b = entry - a
+      3, 2, 1 << 1, 2 << 1,     // join = a + b
+      4, 1, 3 << 1,             // the callers = join
+      Entry, A };
+}
+
+TEST(BlockMap, ExpandsAndMerges)
+{
+   ProfileFile F("blockmap");
+   F.packet(BlockMapInfo64, Diamond(10, 3));
+   F.packet(BlockMapInfo64, Diamond(5, 5));
+   F.close();
+
+   ProfileInfoLoader Loader("unit", F.Name);
+   std::vector<uint64_t> Expected = {15, 8, 7, 15};
+   EXPECT_EQ(Loader.getRawBlockCounts(), Expected);
+}
+
+// the loader gives up on a packet which doesn't add up
+static void ExpectBroken(const std::vector<uint64_t>& Packet)
+{
+   ProfileFile F("blockmap");
+   F.packet(BlockMapInfo64, Packet);
+   F.close();
+   EXPECT_EXIT(ProfileInfoLoader("unit", F.Name),
+               ::testing::ExitedWithCode(1), "block map packet broken");
+}
+
+TEST(BlockMapDeathTest, RejectsBrokenPackets)
+{
+   std::vector<uint64_t> Packet;
+
+   ExpectBroken({4, 5, 2});                   // no room for the header
+   Packet = Diamond(1, 1); Packet[0] = 6;     // more blocks than slots
+   ExpectBroken(Packet);
+   Packet = Diamond(1, 1); Packet[3] = 10;    // sizes don't add up
+   ExpectBroken(Packet);
+   Packet = Diamond(1, 1); Packet[5] = 5;     // counter beyond the slots
+   ExpectBroken(Packet);
+   Packet = Diamond(1, 1); Packet[6] = 5;     // rule beyond the slots
+   ExpectBroken(Packet);
+   Packet = Diamond(1, 1); Packet[15] = 2;    // terms beyond the rules
+   ExpectBroken(Packet);
+   Packet = Diamond(1, 1); Packet[16] = 5 << 1; // term beyond the slots
+   ExpectBroken(Packet);
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+static const uint64_t U = ~0ull; // uncounted
+
+// two OptEdgeInfo64 packets with uncounted edges on both sides, the second
+// one longer and of an odd length
+static void WriteOptimalEdges(ProfileFile& F, bool Swap)
+{
+   std::vector<std::vector<uint64_t> > Packets = {
+      {U, 5, U, 7, 1},
+      {3, U, U, 2, U, 4, 1ull << 33} };
+   for (auto& Words : Packets) {
+      if (!Swap) {
+         F.packet(OptEdgeInfo64, Words);
+         continue;
+      }
+      F.word(__builtin_bswap32(OptEdgeInfo64));
+      uint64_t Size = __builtin_bswap64(Words.size());
+      F.bytes(&Size, sizeof(Size));
+      for (uint64_t W : Words) {
+         W = __builtin_bswap64(W);
+         F.bytes(&W, sizeof(W));
+      }
+   }
+}
+
+static const std::vector<uint64_t> Merged = {3, 5, U, 9, 1, 4, 1ull << 33};
+
+TEST(Counters, MergesUncounted)
+{
+   ProfileFile F("counters");
+   WriteOptimalEdges(F, false);
+   F.close();
+
+   ProfileInfoLoader Loader("unit", F.Name);
+   EXPECT_EQ(Loader.getRawOptimalEdgeCounts(), Merged);
+}
+
+// a file of the other byte order is read through the stream
+TEST(Counters, MergesByteSwapped)
+{
+   ProfileFile F("counters");
+   WriteOptimalEdges(F, true);
+   F.close();
+
+   ProfileInfoLoader Loader("unit", F.Name);
+   EXPECT_EQ(Loader.getRawOptimalEdgeCounts(), Merged);
+}
+
+// a pipe can't be mapped, it is read into memory
+TEST(Counters, ReadsPipe)
+{
+   ProfileFile F("counters");
+   WriteOptimalEdges(F, false);
+   F.close();
+   std::vector<char> Contents;
+   FILE* In = fopen(F.Name, "rb");
+   ASSERT_TRUE(In != nullptr);
+   for (int C; (C = fgetc(In)) != EOF;) Contents.push_back(C);
+   fclose(In);
+
+   char Dir[] = "/tmp/counterspipeXXXXXX";
+   ASSERT_TRUE(mkdtemp(Dir) != nullptr);
+   std::string Fifo = std::string(Dir) + "/llvmprof.out";
+   ASSERT_EQ(mkfifo(Fifo.c_str(), 0600), 0);
+   std::thread Writer([&] {
+      int Fd = open(Fifo.c_str(), O_WRONLY);
+      if (Fd == -1) return;
+      EXPECT_EQ(write(Fd, Contents.data(), Contents.size()),
+                (ssize_t)Contents.size());
+      ::close(Fd);
+   });
+   ProfileInfoLoader Loader("unit", Fifo);
+   Writer.join();
+   unlink(Fifo.c_str());
+   rmdir(Dir);
+   EXPECT_EQ(Loader.getRawOptimalEdgeCounts(), Merged);
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+static const uint64_t ModuleA = 0x1111aaaa2222bbbbull;
+static const uint64_t ModuleB = 0x3333cccc4444ddddull;
+
+static void WriteArguments(ProfileFile& F, const char* Arguments)
+{
+   unsigned Length = strlen(Arguments);
+   std::vector<char> Padded((Length + 3) & ~3u);
+   memcpy(Padded.data(), Arguments, Length);
+   F.word(ArgumentInfo);
+   F.word(Length);
+   F.bytes(Padded.data(), Padded.size());
+}
+
+// a process running both modules, then one written before the modules
+// were told apart
+static void WriteTwoProcesses(ProfileFile& F)
+{
+   WriteArguments(F, "prog");
+   F.packet(ModuleInfo64, {ModuleA});
+   F.packet(EdgeInfo64, {1, 2, 3});
+   F.packet(ModuleInfo64, {ModuleB});
+   F.packet(EdgeInfo64, {10, 20, 30});
+   WriteArguments(F, "old prog");
+   F.packet(EdgeInfo64, {100, 100, 100});
+}
+
+TEST(ModuleInfo, LoadsMatchingModule)
+{
+   ProfileFile F("module");
+   WriteTwoProcesses(F);
+   F.close();
+
+   ProfileInfoLoader A("unit", F.Name, ModuleA);
+   std::vector<uint64_t> EdgesA = {101, 102, 103};
+   EXPECT_EQ(A.getRawEdgeCounts(), EdgesA);
+   EXPECT_EQ(A.getNumExecutions(), 2u);
+
+   ProfileInfoLoader B("unit", F.Name, ModuleB);
+   std::vector<uint64_t> EdgesB = {110, 120, 130};
+   EXPECT_EQ(B.getRawEdgeCounts(), EdgesB);
+}
+
+// the warnings don't stop the loader, exit to compare them
+static void Load(const char* Filename, uint64_t ModuleHash)
+{
+   ProfileInfoLoader Loader("unit", Filename, ModuleHash);
+   exit(0);
+}
+
+TEST(ModuleInfoDeathTest, WarnsOfOtherModules)
+{
+   ProfileFile F("module");
+   WriteTwoProcesses(F);
+   F.close();
+
+   EXPECT_EXIT(Load(F.Name, 0), ::testing::ExitedWithCode(0),
+               "has the counters of several modules");
+   EXPECT_EXIT(Load(F.Name, ModuleA ^ ModuleB),
+               ::testing::ExitedWithCode(0),
+               "has no counters of this module");
+}
@@ -0,0 +1,26 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+TEST(PagedCounters, ExpandsAndMerges)
+{
+   ProfileFile F("paged");
+   F.packet(EdgeInfo64, {1, 1, 1, 1, 1, 1});
+   F.packet(PagedInfo64, {
+      EdgeInfo64, 6,       // the packet it stands for, its counters
+      1, 2, 10, 20,        // the run of counters 1 and 2
+      5, 1, 50 });         // the run of counter 5
+   F.packet(PagedInfo64, {BlockInfo64, 3});
+   F.close();
+
+   ProfileInfoLoader Loader("unit", F.Name);
+   std::vector<uint64_t> Edges = {1, 11, 21, 1, 1, 51};
+   std::vector<uint64_t> Blocks = {0, 0, 0};
+   EXPECT_EQ(Loader.getRawEdgeCounts(), Edges);
+   EXPECT_EQ(Loader.getRawBlockCounts(), Blocks);
+}
@@ -0,0 +1,41 @@
+#ifndef UNIT_PROFILEFILE_H
+#define UNIT_PROFILEFILE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+
+// a profile file of hand written packets, removed by the destructor
+class ProfileFile
+{
+   FILE* F;
+   public:
+   char Name[32];
+   explicit ProfileFile(const char* Prefix) {
+      snprintf(Name, sizeof(Name), "/tmp/%.16sXXXXXX", Prefix);
+      int Fd = mkstemp(Name);
+      F = Fd == -1 ? nullptr : fdopen(Fd, "wb");
+      if (F == nullptr) {
+         perror(Name);
+         abort();
+      }
+   }
+   ~ProfileFile() {
+      if (F) fclose(F);
+      unlink(Name);
+   }
+   void word(unsigned W) { fwrite(&W, sizeof(W), 1, F); }
+   void bytes(const void* Data, size_t Size) { fwrite(Data, 1, Size, F); }
+   // a packet of a 64 bit word count and that many words
+   void packet(unsigned Type, const std::vector<uint64_t>& Words) {
+      uint64_t Size = Words.size();
+      word(Type);
+      bytes(&Size, sizeof(Size));
+      bytes(Words.data(), Size * sizeof(uint64_t));
+   }
+   void close() { fclose(F); F = nullptr; }
+};
+
+#endif
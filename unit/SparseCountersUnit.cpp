@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileVarint.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+static void WriteSparse(ProfileFile& F, unsigned Type,
+                        const std::vector<uint64_t>& Counts)
+{
+   uint64_t Size = Counts.size(), Used;
+   uint64_t Bytes = profile_sparse_size(Counts.data(), Size, &Used);
+   std::vector<unsigned char> Encoded((Bytes + 3) & ~3ull);
+   EXPECT_EQ(profile_encode_sparse(Counts.data(), Size, Encoded.data()),
+             Bytes);
+   F.word(Type);
+   F.bytes(&Size, sizeof(Size));
+   F.bytes(&Bytes, sizeof(Bytes));
+   F.bytes(Encoded.data(), Encoded.size());
+}
+
+TEST(SparseCounters, DecodesAndMerges)
+{
+   ProfileFile F("sparse");
+   std::vector<uint64_t> Edges = {0, 5, 0, 0, 300, 1ull << 40, 0};
+   std::vector<uint64_t> Blocks = {0, 0, 7};
+   WriteSparse(F, EdgeInfo64Sparse, Edges);
+   WriteSparse(F, EdgeInfo64Sparse, Edges);
+   WriteSparse(F, BlockInfo64Sparse, Blocks);
+   F.close();
+
+   ProfileInfoLoader Loader("unit", F.Name);
+   for (auto& E : Edges) E *= 2;
+   EXPECT_EQ(Loader.getRawEdgeCounts(), Edges);
+   EXPECT_EQ(Loader.getRawBlockCounts(), Blocks);
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoLoader.h"
+#include "ProfileTraceReader.h"
+#include "ProfileVarint.h"
+#include "ProfileFile.h"
+
+using namespace llvm;
+
+// a profile file of basic block trace packets
+class TraceFile : public ProfileFile
+{
+   public:
+   TraceFile() : ProfileFile("tracereader") {}
+   void raw(const std::vector<unsigned>& Blocks) {
+      word(BBTraceInfo);
+      word(Blocks.size());
+      bytes(Blocks.data(), Blocks.size() * sizeof(unsigned));
+   }
+   void varint(const std::vector<unsigned>& Blocks) {
+      std::vector<unsigned char> Out(Blocks.size() * PROFILE_VARINT_MAX32 + 4);
+      unsigned Bytes = profile_encode_trace(Blocks.data(), Blocks.size(),
+                                            Out.data());
+      word(BBTraceVarintInfo);
+      word(Blocks.size());
+      word(Bytes);
+      bytes(Out.data(), (Bytes + 3) & ~3u);
+   }
+};
+
+static std::vector<unsigned> Pattern(unsigned N, unsigned Seed)
+{
+   std::vector<unsigned> Blocks;
+   for(unsigned i = 0; i < N; ++i)
+      Blocks.push_back(i % 7 == 0 ? Seed * i : Blocks.empty() ? 0 : Blocks.back() + 1);
+   return Blocks;
+}
+
+TEST(TraceReader, KeepsOrderAcrossPackets)
+{
+   TraceFile T;
+   std::vector<unsigned> A = {5, 6, 7}, B = {7, 3, 100000, 0, 0xffffffff, 2};
+   std::vector<unsigned> C = Pattern(200000, 2654435761u), D = Pattern(150000, 40503);
+   std::vector<unsigned> Expected;
+
+   T.word(ArgumentInfo); T.word(5); T.word(0x6c6c612e); T.word(0x2e);
+   T.raw(A);
+   T.word(EdgeInfo); T.word(2); T.word(1); T.word(2);
+   T.varint(B);
+   T.word(ValueInfo); T.word(2); T.word(1); T.word(0); T.word(1); T.word(9); T.word(0);
+   T.varint({});
+   T.raw(C);
+   T.varint(D);
+   T.close();
+   for(auto V : {A, B, C, D})
+      Expected.insert(Expected.end(), V.begin(), V.end());
+
+   BBTraceReader Reader("unit", T.Name);
+   std::vector<unsigned> Trace(Reader.begin(), Reader.end());
+   EXPECT_EQ(Trace, Expected);
+   EXPECT_EQ(Reader.getPosition(), Expected.size());
+   unsigned Block;
+   EXPECT_FALSE(Reader.next(Block));
+
+   // the loader skips the trace, it doesn't add it up as counters
+   ProfileInfoLoader Loader("unit", T.Name);
+   EXPECT_EQ(Loader.getNumExecutions(), 1u);
+   EXPECT_EQ(Loader.getRawEdgeCounts().size(), 2u);
+   EXPECT_EQ(Loader.getRawValueCounts().size(), 2u);
+}